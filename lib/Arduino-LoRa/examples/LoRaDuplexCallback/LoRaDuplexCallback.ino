@@ -50,6 +50,9 @@ void setup() {
 }
 
 void loop() {
+  // run the receive callback once DIO0 has risen
+  LoRa.handleInterrupt();
+
   if (millis() - lastSendTime > interval) {
     String message = "HeLoRa World!";   // send a message
     sendMessage(message);
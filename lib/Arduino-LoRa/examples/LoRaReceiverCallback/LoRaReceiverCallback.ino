@@ -24,7 +24,8 @@ void setup() {
 }
 
 void loop() {
-  // do nothing
+  // run the receive callback once DIO0 has risen
+  LoRa.handleInterrupt();
 }
 
 void onReceive(int packetSize) {
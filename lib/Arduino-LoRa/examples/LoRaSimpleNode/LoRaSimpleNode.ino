@@ -57,6 +57,9 @@ void setup() {
 }
 
 void loop() {
+  // run the receive callback once DIO0 has risen
+  LoRa.handleInterrupt();
+
   if (runEvery(1000)) { // repeat every 1000 millis
 
     String message = "HeLoRa World! ";
@@ -22,6 +22,7 @@
 #define REG_PKT_RSSI_VALUE       0x1a
 #define REG_MODEM_CONFIG_1       0x1d
 #define REG_MODEM_CONFIG_2       0x1e
+#define REG_SYMB_TIMEOUT_LSB     0x1f
 #define REG_PREAMBLE_MSB         0x20
 #define REG_PREAMBLE_LSB         0x21
 #define REG_PAYLOAD_LENGTH       0x22
@@ -52,25 +53,55 @@
 
 // IRQ masks
 #define IRQ_TX_DONE_MASK           0x08
+#define IRQ_VALID_HEADER_MASK      0x10
 #define IRQ_PAYLOAD_CRC_ERROR_MASK 0x20
 #define IRQ_RX_DONE_MASK           0x40
+#define IRQ_RX_TIMEOUT_MASK        0x80
 
-#define MAX_PKT_LENGTH           255
+#define MAX_PKT_LENGTH           LORA_MAX_PACKET_LENGTH
 
-LoRaClass::LoRaClass() :
+LoRaArduinoTransport::LoRaArduinoTransport() :
   _spiSettings(LORA_DEFAULT_SPI_FREQUENCY, MSBFIRST, SPI_MODE0),
   _spi(&LORA_DEFAULT_SPI),
-  _ss(LORA_DEFAULT_SS_PIN), _reset(LORA_DEFAULT_RESET_PIN), _dio0(LORA_DEFAULT_DIO0_PIN),
-  _frequency(0),
-  _packetIndex(0),
-  _implicitHeaderMode(0),
-  _onReceive(NULL)
+  _ss(LORA_DEFAULT_SS_PIN), _reset(LORA_DEFAULT_RESET_PIN), _dio0(LORA_DEFAULT_DIO0_PIN)
 {
-  // overide Stream timeout value
-  setTimeout(0);
 }
 
-int LoRaClass::begin(long frequency)
+void LoRaArduinoTransport::setPins(int ss, int reset, int dio0)
+{
+  _ss = ss;
+  _reset = reset;
+  _dio0 = dio0;
+}
+
+void LoRaArduinoTransport::setSPI(SPIClass& spi)
+{
+  _spi = &spi;
+}
+
+void LoRaArduinoTransport::setSPIFrequency(uint32_t frequency)
+{
+  _spiSettings = SPISettings(frequency, MSBFIRST, SPI_MODE0);
+}
+
+void LoRaArduinoTransport::begin()
+{
+  // setup pins
+  pinMode(_ss, OUTPUT);
+  // set SS high
+  digitalWrite(_ss, HIGH);
+
+  // start SPI
+  _spi->begin();
+}
+
+void LoRaArduinoTransport::end()
+{
+  // stop SPI
+  _spi->end();
+}
+
+void LoRaArduinoTransport::reset()
 {
 #ifdef ARDUINO_SAMD_MKRWAN1300
   pinMode(LORA_IRQ_DUMB, OUTPUT);
@@ -89,11 +120,6 @@ int LoRaClass::begin(long frequency)
   delay(50);
 #endif
 
-  // setup pins
-  pinMode(_ss, OUTPUT);
-  // set SS high
-  digitalWrite(_ss, HIGH);
-
   if (_reset != -1) {
     pinMode(_reset, OUTPUT);
 
@@ -103,9 +129,125 @@ int LoRaClass::begin(long frequency)
     digitalWrite(_reset, HIGH);
     delay(10);
   }
+}
 
-  // start SPI
-  _spi->begin();
+void LoRaArduinoTransport::select()
+{
+  digitalWrite(_ss, LOW);
+
+  _spi->beginTransaction(_spiSettings);
+}
+
+void LoRaArduinoTransport::deselect()
+{
+  _spi->endTransaction();
+
+  digitalWrite(_ss, HIGH);
+}
+
+uint8_t LoRaArduinoTransport::transfer(uint8_t value)
+{
+  return _spi->transfer(value);
+}
+
+void LoRaArduinoTransport::write(const uint8_t* buffer, size_t size)
+{
+#if defined(ARDUINO_ARCH_ESP32)
+  _spi->writeBytes(buffer, size);
+#else
+  for (size_t i = 0; i < size; i++) {
+    _spi->transfer(buffer[i]);
+  }
+#endif
+}
+
+void LoRaArduinoTransport::read(uint8_t* buffer, size_t size)
+{
+#if defined(ARDUINO_ARCH_ESP32)
+  _spi->transferBytes(NULL, buffer, size);
+#else
+  for (size_t i = 0; i < size; i++) {
+    buffer[i] = _spi->transfer(0x00);
+  }
+#endif
+}
+
+void LoRaArduinoTransport::attachDio0(void (*isr)())
+{
+  pinMode(_dio0, INPUT);
+#ifdef SPI_HAS_NOTUSINGINTERRUPT
+  SPI.usingInterrupt(digitalPinToInterrupt(_dio0));
+#endif
+  attachInterrupt(digitalPinToInterrupt(_dio0), isr, RISING);
+}
+
+void LoRaArduinoTransport::detachDio0()
+{
+  detachInterrupt(digitalPinToInterrupt(_dio0));
+#ifdef SPI_HAS_NOTUSINGINTERRUPT
+  SPI.notUsingInterrupt(digitalPinToInterrupt(_dio0));
+#endif
+}
+
+void LoRaArduinoTransport::delayMicroseconds(uint32_t us)
+{
+  ::delayMicroseconds(us);
+}
+
+unsigned long LoRaArduinoTransport::micros()
+{
+  return ::micros();
+}
+
+unsigned long LoRaArduinoTransport::millis()
+{
+  return ::millis();
+}
+
+void LoRaArduinoTransport::yield()
+{
+  ::yield();
+}
+
+LoRaClass::LoRaClass() :
+  _transport(&_arduinoTransport),
+  _frequency(0),
+  _packetIndex(0),
+  _packetLength(0),
+  _payloadLength(0),
+  _implicitHeaderMode(0),
+  _onReceive(NULL),
+  _onTxDone(NULL),
+  _onInterrupt(NULL),
+  _dio0Pending(false),
+  _spiTransactions(0),
+  _spiSaved(0),
+  _rxHead(0),
+  _rxTail(0),
+  _rxQueueEnabled(false),
+  _rxOverflows(0),
+  _rxCrcErrors(0),
+  _rxFilter(NULL),
+  _rxFilterHeaderLength(0),
+  _rxFiltered(0),
+  _dutyCycleBandCount(0),
+  _dutyCycleWindow(3600000),
+  _dutyCycleBucket(0),
+  _dutyCycleRejected(0)
+{
+  // overide Stream timeout value
+  setTimeout(0);
+
+  invalidateRegisterCache();
+}
+
+int LoRaClass::begin(long frequency)
+{
+  _transport->begin();
+  _transport->reset();
+
+  // the radio is back to its reset values
+  invalidateRegisterCache();
 
   // check version
   uint8_t version = readRegister(REG_VERSION);
@@ -144,7 +286,7 @@ void LoRaClass::end()
   sleep();
 
   // stop SPI
-  _spi->end();
+  _transport->end();
 }
 
 int LoRaClass::beginPacket(int implicitHeader)
@@ -163,24 +305,55 @@ int LoRaClass::beginPacket(int implicitHeader)
   }
 
   // reset FIFO address and paload length
+  // the payload length is shadowed and only pushed to the radio by endPacket()
   writeRegister(REG_FIFO_ADDR_PTR, 0);
-  writeRegister(REG_PAYLOAD_LENGTH, 0);
+  _payloadLength = 0;
+  clearWriteError();
 
   return 1;
 }
 
 int LoRaClass::endPacket(bool async)
 {
+  if (getWriteError()) {
+    // a write did not fit in the packet, never send it short
+    return 0;
+  }
+
+  // enforce the duty cycle budget of the band
+  LoRaDutyCycleBand* band = currentDutyCycleBand();
+  uint32_t airtime = 0;
+
+  if (band) {
+    if (!canTransmit(_payloadLength)) {
+      _dutyCycleRejected++;
+      return 0;
+    }
+
+    airtime = timeOnAir(_payloadLength);
+    band->buckets[_dutyCycleBucket % LORA_DUTY_CYCLE_BUCKETS] += airtime;
+  }
+
+  // update length
+  writeRegister(REG_PAYLOAD_LENGTH, _payloadLength);
+
+#ifndef ARDUINO_SAMD_MKRWAN1300
+  if (async && _onTxDone) {
+    // DIO0 => TxDone
+    writeRegister(REG_DIO_MAPPING_1, 0x40);
+  }
+#endif
+
   // put in TX mode
   writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_TX);
 
   if (async) {
     // grace time is required for the radio
-    delayMicroseconds(150);
+    _transport->delayMicroseconds(150);
   } else {
     // wait for TX done
     while ((readRegister(REG_IRQ_FLAGS) & IRQ_TX_DONE_MASK) == 0) {
-      yield();
+      _transport->yield();
     }
     // clear IRQ's
     writeRegister(REG_IRQ_FLAGS, IRQ_TX_DONE_MASK);
@@ -219,6 +392,10 @@ int LoRaClass::parsePacket(int size)
   // clear IRQ's
   writeRegister(REG_IRQ_FLAGS, irqFlags);
 
+  if (irqFlags & IRQ_PAYLOAD_CRC_ERROR_MASK) {
+    _rxCrcErrors++;
+  }
+
   if ((irqFlags & IRQ_RX_DONE_MASK) && (irqFlags & IRQ_PAYLOAD_CRC_ERROR_MASK) == 0) {
     // received a packet
     _packetIndex = 0;
@@ -230,6 +407,8 @@ int LoRaClass::parsePacket(int size)
       packetLength = readRegister(REG_RX_NB_BYTES);
     }
 
+    _packetLength = packetLength;
+
     // set FIFO address to current RX address
     writeRegister(REG_FIFO_ADDR_PTR, readRegister(REG_FIFO_RX_CURRENT_ADDR));
 
@@ -250,7 +429,7 @@ int LoRaClass::parsePacket(int size)
 
 int LoRaClass::packetRssi()
 {
-  return (readRegister(REG_PKT_RSSI_VALUE) - (_frequency < 868E6 ? 164 : 157));
+  return (readRegister(REG_PKT_RSSI_VALUE) - (_frequency < 868000000L ? 164 : 157));
 }
 
 float LoRaClass::packetSnr()
@@ -277,6 +456,25 @@ long LoRaClass::packetFrequencyError()
   return static_cast<long>(fError);
 }
 
+long LoRaClass::frequencyErrorFromRegisters()
+{
+  // integer only variant of packetFrequencyError(), for the queued packets
+  int32_t freqError = 0;
+  uint8_t msb = readRegister(REG_FREQ_ERROR_MSB);
+  freqError = static_cast<int32_t>(msb & B111);
+  freqError <<= 8L;
+  freqError += static_cast<int32_t>(readRegister(REG_FREQ_ERROR_MID));
+  freqError <<= 8L;
+  freqError += static_cast<int32_t>(readRegister(REG_FREQ_ERROR_LSB));
+
+  if (msb & B1000) { // Sign bit is on
+     freqError -= 524288; // B1000'0000'0000'0000'0000
+  }
+
+  // fError = freqError * 2^24 / FXOSC * BW / 500 kHz (p. 37)
+  return static_cast<long>((static_cast<int64_t>(freqError) * getSignalBandwidth() * (1L << 24)) / 16000000000000LL);
+}
+
 size_t LoRaClass::write(uint8_t byte)
 {
   return write(&byte, sizeof(byte));
@@ -284,20 +482,38 @@ size_t LoRaClass::write(uint8_t byte)
 
 size_t LoRaClass::write(const uint8_t *buffer, size_t size)
 {
-  int currentLength = readRegister(REG_PAYLOAD_LENGTH);
+  // check size: a write that does not fit is refused whole, and endPacket() fails
+  if ((_payloadLength + size) > MAX_PKT_LENGTH) {
+    setWriteError();
+    return 0;
+  }
+
+  // write data in a single FIFO burst
+  burstWrite(REG_FIFO, buffer, size);
+
+  _payloadLength += size;
+
+  return size;
+}
+
+size_t LoRaClass::readPacket(uint8_t *buffer, size_t size)
+{
+  // the packet length was latched by parsePacket() or the DIO0 handler,
+  // no register read is needed to know what is left in the FIFO
+  int remaining = _packetLength - _packetIndex;
 
-  // check size
-  if ((currentLength + size) > MAX_PKT_LENGTH) {
-    size = MAX_PKT_LENGTH - currentLength;
+  if (remaining <= 0) {
+    return 0;
   }
 
-  // write data
-  for (size_t i = 0; i < size; i++) {
-    writeRegister(REG_FIFO, buffer[i]);
+  if ((size_t)remaining < size) {
+    size = remaining;
   }
 
-  // update length
-  writeRegister(REG_PAYLOAD_LENGTH, currentLength + size);
+  // drain the FIFO in a single burst
+  burstRead(REG_FIFO, buffer, size);
+
+  _packetIndex += size;
 
   return size;
 }
@@ -346,23 +562,45 @@ void LoRaClass::onReceive(void(*callback)(int))
   _onReceive = callback;
 
   if (callback) {
-    pinMode(_dio0, INPUT);
-
     writeRegister(REG_DIO_MAPPING_1, 0x00);
-#ifdef SPI_HAS_NOTUSINGINTERRUPT
-    SPI.usingInterrupt(digitalPinToInterrupt(_dio0));
-#endif
-    attachInterrupt(digitalPinToInterrupt(_dio0), LoRaClass::onDio0Rise, RISING);
-  } else {
-    detachInterrupt(digitalPinToInterrupt(_dio0));
-#ifdef SPI_HAS_NOTUSINGINTERRUPT
-    SPI.notUsingInterrupt(digitalPinToInterrupt(_dio0));
-#endif
+    attachDio0();
+  } else if (!_onTxDone && !_rxQueueEnabled) {
+    detachDio0();
+  }
+}
+
+void LoRaClass::onTxDone(void(*callback)())
+{
+  _onTxDone = callback;
+
+  if (callback) {
+    attachDio0();
+  } else if (!_onReceive && !_rxQueueEnabled) {
+    detachDio0();
+  }
+}
+
+void LoRaClass::onInterrupt(void(*callback)())
+{
+  _onInterrupt = callback;
+}
+
+void LoRaClass::handleInterrupt()
+{
+  if (!_dio0Pending) {
+    return;
   }
+
+  // a rise from now on is either in the IRQ flags read below or served by the next call
+  _dio0Pending = false;
+  handleDio0Rise();
 }
 
 void LoRaClass::receive(int size)
 {
+  // DIO0 => RxDone, it may have been remapped to TxDone by endPacket()
+  writeRegister(REG_DIO_MAPPING_1, 0x00);
+
   if (size > 0) {
     implicitHeaderMode();
 
@@ -373,6 +611,121 @@ void LoRaClass::receive(int size)
 
   writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_CONTINUOUS);
 }
+
+void LoRaClass::receiveSingle(int symbolTimeout, int size)
+{
+  // DIO0 => RxDone, it may have been remapped to TxDone by endPacket()
+  writeRegister(REG_DIO_MAPPING_1, 0x00);
+
+  if (size > 0) {
+    implicitHeaderMode();
+
+    writeRegister(REG_PAYLOAD_LENGTH, size & 0xff);
+  } else {
+    explicitHeaderMode();
+  }
+
+  // the window closes after symbolTimeout symbols unless a preamble is detected,
+  // the radio then goes back to standby by itself
+  if (symbolTimeout < 4) {
+    symbolTimeout = 4;
+  } else if (symbolTimeout > 1023) {
+    symbolTimeout = 1023;
+  }
+  writeRegister(REG_MODEM_CONFIG_2, (readRegister(REG_MODEM_CONFIG_2) & 0xfc) | (symbolTimeout >> 8));
+  writeRegister(REG_SYMB_TIMEOUT_LSB, symbolTimeout & 0xff);
+
+  // flags left over from an earlier window
+  writeRegister(REG_IRQ_FLAGS, IRQ_RX_TIMEOUT_MASK | IRQ_VALID_HEADER_MASK);
+
+  writeRegister(REG_OP_MODE, MODE_LONG_RANGE_MODE | MODE_RX_SINGLE);
+}
+
+int LoRaClass::receiveSingleStatus()
+{
+  int irqFlags = readRegister(REG_IRQ_FLAGS);
+
+  if (irqFlags & IRQ_RX_TIMEOUT_MASK) {
+    // no preamble within the window, the radio is back to standby
+    writeRegister(REG_IRQ_FLAGS, IRQ_RX_TIMEOUT_MASK);
+    return LORA_RX_TIMEOUT;
+  }
+
+  if (irqFlags & IRQ_VALID_HEADER_MASK) {
+    // a packet is coming in, RxDone follows once it is on air, handleInterrupt() clears the flag
+    return LORA_RX_HEADER;
+  }
+
+  return LORA_RX_LISTENING;
+}
+
+void LoRaClass::enableRxQueue()
+{
+  _rxHead = 0;
+  _rxTail = 0;
+  _rxQueueEnabled = true;
+
+  // DIO0 => RxDone
+  writeRegister(REG_DIO_MAPPING_1, 0x00);
+  attachDio0();
+}
+
+void LoRaClass::disableRxQueue()
+{
+  _rxQueueEnabled = false;
+
+  if (!_onReceive && !_onTxDone) {
+    detachDio0();
+  }
+}
+
+LoRaPacket* LoRaClass::nextPacket()
+{
+  if (_rxTail == _rxHead) {
+    return NULL;
+  }
+
+  return &_rxQueue[_rxTail];
+}
+
+void LoRaClass::releasePacket()
+{
+  if (_rxTail == _rxHead) {
+    return;
+  }
+
+  _rxTail = (_rxTail + 1) % LORA_RX_QUEUE_SIZE;
+}
+
+uint8_t LoRaClass::rxQueueDepth()
+{
+  return (_rxHead + LORA_RX_QUEUE_SIZE - _rxTail) % LORA_RX_QUEUE_SIZE;
+}
+
+uint32_t LoRaClass::rxOverflowCount()
+{
+  return _rxOverflows;
+}
+
+uint32_t LoRaClass::rxCrcErrorCount()
+{
+  return _rxCrcErrors;
+}
+
+void LoRaClass::setRxFilter(bool(*filter)(const uint8_t* header, size_t length), uint8_t headerLength)
+{
+  if (headerLength > LORA_RX_FILTER_MAX_HEADER) {
+    headerLength = LORA_RX_FILTER_MAX_HEADER;
+  }
+
+  _rxFilter = filter;
+  _rxFilterHeaderLength = headerLength;
+}
+
+uint32_t LoRaClass::rxFilteredCount()
+{
+  return _rxFiltered;
+}
 #endif
 
 void LoRaClass::idle()
@@ -587,19 +940,24 @@ byte LoRaClass::random()
 
 void LoRaClass::setPins(int ss, int reset, int dio0)
 {
-  _ss = ss;
-  _reset = reset;
-  _dio0 = dio0;
+  _arduinoTransport.setPins(ss, reset, dio0);
+  _transport = &_arduinoTransport;
 }
 
 void LoRaClass::setSPI(SPIClass& spi)
 {
-  _spi = &spi;
+  _arduinoTransport.setSPI(spi);
+  _transport = &_arduinoTransport;
 }
 
 void LoRaClass::setSPIFrequency(uint32_t frequency)
 {
-  _spiSettings = SPISettings(frequency, MSBFIRST, SPI_MODE0);
+  _arduinoTransport.setSPIFrequency(frequency);
+}
+
+void LoRaClass::setTransport(LoRaTransport& transport)
+{
+  _transport = &transport;
 }
 
 void LoRaClass::dumpRegisters(Stream& out)
@@ -608,8 +966,165 @@ void LoRaClass::dumpRegisters(Stream& out)
     out.print("0x");
     out.print(i, HEX);
     out.print(": 0x");
-    out.println(readRegister(i), HEX);
+    // bypass the register cache, show what the radio actually holds
+    out.println(singleTransfer(i & 0x7f, 0x00), HEX);
+  }
+}
+
+uint32_t LoRaClass::spiTransactionCount()
+{
+  return _spiTransactions;
+}
+
+void LoRaClass::resetSpiTransactionCount()
+{
+  _spiTransactions = 0;
+}
+
+uint32_t LoRaClass::spiTransactionsSaved()
+{
+  return _spiSaved;
+}
+
+uint32_t LoRaClass::symbolTime()
+{
+  return (uint32_t)((1L << getSpreadingFactor()) * 1000000LL / getSignalBandwidth());
+}
+
+uint32_t LoRaClass::timeOnAir(size_t payloadLength)
+{
+  // SX1276 datasheet, 4.1.1.7 Time on air
+  // the modem settings are read from the register cache, no SPI traffic
+  uint8_t modemConfig1 = readRegister(REG_MODEM_CONFIG_1);
+  uint8_t modemConfig2 = readRegister(REG_MODEM_CONFIG_2);
+  uint8_t modemConfig3 = readRegister(REG_MODEM_CONFIG_3);
+  long preambleLength = (readRegister(REG_PREAMBLE_MSB) << 8) | readRegister(REG_PREAMBLE_LSB);
+
+  int sf = modemConfig2 >> 4;
+  int cr = (modemConfig1 >> 1) & 0x07;
+  int ih = modemConfig1 & 0x01;
+  int crc = (modemConfig2 >> 2) & 0x01;
+  int de = (modemConfig3 >> 3) & 0x01;
+
+  // symbol time in us
+  float tSym = (float)(1L << sf) * 1E6 / getSignalBandwidth();
+  float tPreamble = (preambleLength + 4.25) * tSym;
+
+  long payloadSymbols = 8L * payloadLength - 4 * sf + 28 + 16 * crc - 20 * ih;
+  long divisor = 4 * (sf - 2 * de);
+  if (payloadSymbols < 0) {
+    payloadSymbols = 0;
+  }
+  payloadSymbols = 8 + ((payloadSymbols + divisor - 1) / divisor) * (cr + 4);
+
+  return (uint32_t)(tPreamble + payloadSymbols * tSym);
+}
+
+void LoRaClass::setDutyCycle(long minFrequency, long maxFrequency, float dutyCycle)
+{
+  LoRaDutyCycleBand* band = NULL;
+
+  // update an existing band or add a new one
+  for (uint8_t i = 0; i < _dutyCycleBandCount; i++) {
+    if (_dutyCycleBands[i].minFrequency == minFrequency && _dutyCycleBands[i].maxFrequency == maxFrequency) {
+      band = &_dutyCycleBands[i];
+    }
+  }
+
+  if (!band) {
+    if (_dutyCycleBandCount == LORA_DUTY_CYCLE_BANDS) {
+      return;
+    }
+    band = &_dutyCycleBands[_dutyCycleBandCount++];
+    memset(band->buckets, 0, sizeof(band->buckets));
+  }
+
+  band->minFrequency = minFrequency;
+  band->maxFrequency = maxFrequency;
+  // dutyCycle in % of the window, budget in us
+  band->budget = (uint32_t)(_dutyCycleWindow * dutyCycle * 10);
+}
+
+void LoRaClass::setDutyCycleWindow(unsigned long window)
+{
+  for (uint8_t i = 0; i < _dutyCycleBandCount; i++) {
+    _dutyCycleBands[i].budget = (uint32_t)((float)_dutyCycleBands[i].budget * window / _dutyCycleWindow);
+    memset(_dutyCycleBands[i].buckets, 0, sizeof(_dutyCycleBands[i].buckets));
+  }
+
+  _dutyCycleWindow = window;
+}
+
+bool LoRaClass::canTransmit(size_t payloadLength)
+{
+  LoRaDutyCycleBand* band = currentDutyCycleBand();
+
+  if (!band) {
+    // unregulated frequency
+    return true;
+  }
+
+  return timeOnAir(payloadLength) <= airtimeAvailable();
+}
+
+uint32_t LoRaClass::airtimeUsed()
+{
+  LoRaDutyCycleBand* band = currentDutyCycleBand();
+  uint32_t used = 0;
+
+  if (band) {
+    for (uint8_t i = 0; i < LORA_DUTY_CYCLE_BUCKETS; i++) {
+      used += band->buckets[i];
+    }
+  }
+
+  return used;
+}
+
+uint32_t LoRaClass::airtimeAvailable()
+{
+  LoRaDutyCycleBand* band = currentDutyCycleBand();
+
+  if (!band) {
+    return UINT32_MAX;
+  }
+
+  uint32_t used = airtimeUsed();
+
+  return (used < band->budget) ? (band->budget - used) : 0;
+}
+
+uint32_t LoRaClass::dutyCycleRejectedCount()
+{
+  return _dutyCycleRejected;
+}
+
+LoRaDutyCycleBand* LoRaClass::currentDutyCycleBand()
+{
+  updateDutyCycleBuckets();
+
+  for (uint8_t i = 0; i < _dutyCycleBandCount; i++) {
+    if (_frequency >= _dutyCycleBands[i].minFrequency && _frequency < _dutyCycleBands[i].maxFrequency) {
+      return &_dutyCycleBands[i];
+    }
   }
+
+  return NULL;
+}
+
+void LoRaClass::updateDutyCycleBuckets()
+{
+  unsigned long bucket = _transport->millis() / (_dutyCycleWindow / LORA_DUTY_CYCLE_BUCKETS);
+
+  // slide the window: forget the airtime of the buckets that went out of it
+  for (uint8_t n = 0; (_dutyCycleBucket != bucket) && (n < LORA_DUTY_CYCLE_BUCKETS); n++) {
+    _dutyCycleBucket++;
+    for (uint8_t i = 0; i < _dutyCycleBandCount; i++) {
+      _dutyCycleBands[i].buckets[_dutyCycleBucket % LORA_DUTY_CYCLE_BUCKETS] = 0;
+    }
+  }
+
+  _dutyCycleBucket = bucket;
 }
 
 void LoRaClass::explicitHeaderMode()
@@ -630,20 +1145,36 @@ void LoRaClass::handleDio0Rise()
 {
   int irqFlags = readRegister(REG_IRQ_FLAGS);
 
+  if (irqFlags == 0) {
+    // already served along with an earlier rise
+    return;
+  }
+
   // clear IRQ's
   writeRegister(REG_IRQ_FLAGS, irqFlags);
 
-  if ((irqFlags & IRQ_PAYLOAD_CRC_ERROR_MASK) == 0) {
+  if (irqFlags & IRQ_TX_DONE_MASK) {
+    if (_onTxDone) {
+      _onTxDone();
+    }
+  } else if (irqFlags & IRQ_PAYLOAD_CRC_ERROR_MASK) {
+    _rxCrcErrors++;
+  } else {
     // received a packet
     _packetIndex = 0;
 
     // read packet length
     int packetLength = _implicitHeaderMode ? readRegister(REG_PAYLOAD_LENGTH) : readRegister(REG_RX_NB_BYTES);
+    _packetLength = packetLength;
 
     // set FIFO address to current RX address
     writeRegister(REG_FIFO_ADDR_PTR, readRegister(REG_FIFO_RX_CURRENT_ADDR));
 
-    if (_onReceive) {
+    if (_rxQueueEnabled) {
+      if (irqFlags & IRQ_RX_DONE_MASK) {
+        enqueuePacket(packetLength);
+      }
+    } else if (_onReceive) {
       _onReceive(packetLength);
     }
 
@@ -655,35 +1186,177 @@ void LoRaClass::handleDio0Rise()
   }
 }
 
+void LoRaClass::enqueuePacket(int packetLength)
+{
+  uint8_t header[LORA_RX_FILTER_MAX_HEADER];
+  int headerLength = 0;
+
+  if (_rxFilter) {
+    // read only the header and let the filter drop foreign packets
+    headerLength = (packetLength < _rxFilterHeaderLength) ? packetLength : _rxFilterHeaderLength;
+    burstRead(REG_FIFO, header, headerLength);
+
+    if (!_rxFilter(header, headerLength)) {
+      _rxFiltered++;
+      return;
+    }
+  }
+
+  uint8_t next = (_rxHead + 1) % LORA_RX_QUEUE_SIZE;
+
+  if (next == _rxTail) {
+    // queue full, the application is not keeping up
+    _rxOverflows++;
+    return;
+  }
+
+  LoRaPacket& packet = _rxQueue[_rxHead];
+
+  packet.timestamp = _transport->micros();
+  packet.length = packetLength;
+  memcpy(packet.data, header, headerLength);
+  burstRead(REG_FIFO, packet.data + headerLength, packetLength - headerLength);
+  _packetIndex = packetLength;
+
+  packet.rssi = readRegister(REG_PKT_RSSI_VALUE) - (_frequency < 868000000L ? 164 : 157);
+  packet.snrQuarterDb = (int8_t)readRegister(REG_PKT_SNR_VALUE);
+  packet.frequencyError = frequencyErrorFromRegisters();
+
+  // publish the slot only once it is completely filled in
+  __sync_synchronize();
+  _rxHead = next;
+}
+
 uint8_t LoRaClass::readRegister(uint8_t address)
 {
+  if (isCachedRegister(address)) {
+    if (bitRead(_regCacheValid[address >> 3], address & 7)) {
+      _spiSaved++;
+      return _regCache[address];
+    }
+
+    uint8_t value = singleTransfer(address & 0x7f, 0x00);
+    _regCache[address] = value;
+    bitSet(_regCacheValid[address >> 3], address & 7);
+    return value;
+  }
+
   return singleTransfer(address & 0x7f, 0x00);
 }
 
 void LoRaClass::writeRegister(uint8_t address, uint8_t value)
 {
+  if (isCachedRegister(address)) {
+    if (bitRead(_regCacheValid[address >> 3], address & 7) && _regCache[address] == value) {
+      // nothing changes, skip the write
+      _spiSaved++;
+      return;
+    }
+
+    _regCache[address] = value;
+    bitSet(_regCacheValid[address >> 3], address & 7);
+  }
+
   singleTransfer(address | 0x80, value);
 }
 
+bool LoRaClass::isCachedRegister(uint8_t address)
+{
+  // only registers that are never modified by the radio itself can be shadowed
+  switch (address) {
+    case REG_FRF_MSB:
+    case REG_FRF_MID:
+    case REG_FRF_LSB:
+    case REG_PA_CONFIG:
+    case REG_OCP:
+    case REG_LNA:
+    case REG_FIFO_TX_BASE_ADDR:
+    case REG_FIFO_RX_BASE_ADDR:
+    case REG_MODEM_CONFIG_1:
+    case REG_MODEM_CONFIG_2:
+    case REG_SYMB_TIMEOUT_LSB:
+    case REG_PREAMBLE_MSB:
+    case REG_PREAMBLE_LSB:
+    case REG_MODEM_CONFIG_3:
+    case REG_DETECTION_OPTIMIZE:
+    case REG_INVERTIQ:
+    case REG_DETECTION_THRESHOLD:
+    case REG_SYNC_WORD:
+    case REG_INVERTIQ2:
+    case REG_DIO_MAPPING_1:
+    case REG_PA_DAC:
+      return true;
+  }
+
+  return false;
+}
+
+void LoRaClass::invalidateRegisterCache()
+{
+  memset(_regCacheValid, 0, sizeof(_regCacheValid));
+}
+
 uint8_t LoRaClass::singleTransfer(uint8_t address, uint8_t value)
 {
   uint8_t response;
 
-  digitalWrite(_ss, LOW);
-
-  _spi->beginTransaction(_spiSettings);
-  _spi->transfer(address);
-  response = _spi->transfer(value);
-  _spi->endTransaction();
+  _transport->select();
+  _transport->transfer(address);
+  response = _transport->transfer(value);
+  _transport->deselect();
 
-  digitalWrite(_ss, HIGH);
+  _spiTransactions++;
 
   return response;
 }
 
-void LoRaClass::onDio0Rise()
+void LoRaClass::burstWrite(uint8_t address, const uint8_t* buffer, size_t size)
+{
+  if (size == 0) {
+    return;
+  }
+
+  _transport->select();
+  _transport->transfer(address | 0x80);
+  _transport->write(buffer, size);
+  _transport->deselect();
+
+  _spiTransactions++;
+}
+
+void LoRaClass::burstRead(uint8_t address, uint8_t* buffer, size_t size)
 {
-  LoRa.handleDio0Rise();
+  if (size == 0) {
+    return;
+  }
+
+  _transport->select();
+  _transport->transfer(address & 0x7f);
+  _transport->read(buffer, size);
+  _transport->deselect();
+
+  _spiTransactions++;
+}
+
+void LoRaClass::attachDio0()
+{
+  _transport->attachDio0(LoRaClass::onDio0Rise);
+}
+
+void LoRaClass::detachDio0()
+{
+  _transport->detachDio0();
+}
+
+void LORA_IRAM_ATTR LoRaClass::onDio0Rise()
+{
+  // no SPI from here: the bus is shared with the tasks and its transactions take a mutex,
+  // the registers are read by handleInterrupt() in the application context
+  LoRa._dio0Pending = true;
+
+  if (LoRa._onInterrupt) {
+    LoRa._onInterrupt();
+  }
 }
 
 LoRaClass LoRa;
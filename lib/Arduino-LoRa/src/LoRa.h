@@ -6,6 +6,7 @@
 
 #include <Arduino.h>
 #include <SPI.h>
+#include "LoRaTransport.h"
 
 #ifdef ARDUINO_SAMD_MKRWAN1300
 #define LORA_DEFAULT_SPI           SPI1
@@ -21,9 +22,93 @@
 #define LORA_DEFAULT_DIO0_PIN      2
 #endif
 
+// code run from the DIO0 interrupt, in IRAM on the ESP32 so it also runs while the flash cache is off
+#if defined(ARDUINO_ARCH_ESP32)
+#define LORA_IRAM_ATTR             IRAM_ATTR
+#else
+#define LORA_IRAM_ATTR
+#endif
+
 #define PA_OUTPUT_RFO_PIN          0
 #define PA_OUTPUT_PA_BOOST_PIN     1
 
+// number of slots of the interrupt driven RX queue (one slot is always kept free)
+#ifndef LORA_RX_QUEUE_SIZE
+#define LORA_RX_QUEUE_SIZE         4
+#endif
+
+#define LORA_MAX_PACKET_LENGTH     255
+// longest packet header handed to the RX filter
+#define LORA_RX_FILTER_MAX_HEADER  8
+
+// receiveSingleStatus() values
+#define LORA_RX_LISTENING          0
+#define LORA_RX_HEADER             1
+#define LORA_RX_TIMEOUT            2
+
+// duty cycle budget: number of frequency bands, and buckets of the sliding window
+#ifndef LORA_DUTY_CYCLE_BANDS
+#define LORA_DUTY_CYCLE_BANDS      4
+#endif
+#ifndef LORA_DUTY_CYCLE_BUCKETS
+#define LORA_DUTY_CYCLE_BUCKETS    12
+#endif
+
+// configuration registers are shadowed up to REG_PA_DAC (0x4d)
+#define LORA_REG_CACHE_SIZE        0x50
+
+// received packet and its metadata, filled in by handleInterrupt()
+struct LoRaPacket {
+  uint8_t data[LORA_MAX_PACKET_LENGTH];
+  uint8_t length;
+  int16_t rssi;             // dBm
+  int8_t snrQuarterDb;      // raw SNR register, 0.25 dB steps
+  long frequencyError;      // Hz
+  unsigned long timestamp;  // micros() when handleInterrupt() took the packet from the radio
+
+  float snr() const { return snrQuarterDb * 0.25; }
+};
+
+// LoRaTransport over the Arduino SPI, digitalWrite and attachInterrupt APIs
+class LoRaArduinoTransport : public LoRaTransport {
+public:
+  LoRaArduinoTransport();
+
+  void setPins(int ss, int reset, int dio0);
+  void setSPI(SPIClass& spi);
+  void setSPIFrequency(uint32_t frequency);
+
+  virtual void begin();
+  virtual void end();
+  virtual void reset();
+  virtual void select();
+  virtual void deselect();
+  virtual uint8_t transfer(uint8_t value);
+  virtual void write(const uint8_t* buffer, size_t size);
+  virtual void read(uint8_t* buffer, size_t size);
+  virtual void attachDio0(void (*isr)());
+  virtual void detachDio0();
+  virtual void delayMicroseconds(uint32_t us);
+  virtual unsigned long micros();
+  virtual unsigned long millis();
+  virtual void yield();
+
+private:
+  SPISettings _spiSettings;
+  SPIClass* _spi;
+  int _ss;
+  int _reset;
+  int _dio0;
+};
+
+// airtime used in a regulated band over a sliding window, in buckets of window / LORA_DUTY_CYCLE_BUCKETS
+struct LoRaDutyCycleBand {
+  long minFrequency;
+  long maxFrequency;
+  uint32_t budget;                              // airtime allowed per window, us
+  uint32_t buckets[LORA_DUTY_CYCLE_BUCKETS];    // airtime used, us
+};
+
 class LoRaClass : public Stream {
 public:
   LoRaClass();
@@ -43,6 +128,9 @@ public:
   virtual size_t write(uint8_t byte);
   virtual size_t write(const uint8_t *buffer, size_t size);
 
+  // bulk packet read
+  size_t readPacket(uint8_t *buffer, size_t size);
+
   // from Stream
   virtual int available();
   virtual int read();
@@ -51,8 +139,26 @@ public:
 
 #ifndef ARDUINO_SAMD_MKRWAN1300
   void onReceive(void(*callback)(int));
+  void onTxDone(void(*callback)());
+
+  // DIO0: the interrupt only flags the event, handleInterrupt() serves it
+  void onInterrupt(void(*callback)());
+  void handleInterrupt();
 
   void receive(int size = 0);
+  void receiveSingle(int symbolTimeout, int size = 0);
+  int receiveSingleStatus();
+
+  // interrupt driven RX queue
+  void enableRxQueue();
+  void disableRxQueue();
+  LoRaPacket* nextPacket();
+  void releasePacket();
+  uint8_t rxQueueDepth();
+  uint32_t rxOverflowCount();
+  uint32_t rxCrcErrorCount();
+  void setRxFilter(bool(*filter)(const uint8_t* header, size_t length), uint8_t headerLength);
+  uint32_t rxFilteredCount();
 #endif
   void idle();
   void sleep();
@@ -80,14 +186,36 @@ public:
   void setPins(int ss = LORA_DEFAULT_SS_PIN, int reset = LORA_DEFAULT_RESET_PIN, int dio0 = LORA_DEFAULT_DIO0_PIN);
   void setSPI(SPIClass& spi);
   void setSPIFrequency(uint32_t frequency);
+  void setTransport(LoRaTransport& transport);
 
   void dumpRegisters(Stream& out);
 
+  // time on air and duty cycle budget
+  uint32_t symbolTime();
+  uint32_t timeOnAir(size_t payloadLength);
+  void setDutyCycle(long minFrequency, long maxFrequency, float dutyCycle);
+  void setDutyCycleWindow(unsigned long window);
+  bool canTransmit(size_t payloadLength);
+  uint32_t airtimeUsed();
+  uint32_t airtimeAvailable();
+  uint32_t dutyCycleRejectedCount();
+
+  // SPI instrumentation
+  uint32_t spiTransactionCount();
+  void resetSpiTransactionCount();
+  uint32_t spiTransactionsSaved();
+
 private:
   void explicitHeaderMode();
   void implicitHeaderMode();
 
   void handleDio0Rise();
+  void enqueuePacket(int packetLength);
+  void attachDio0();
+  void detachDio0();
+  LoRaDutyCycleBand* currentDutyCycleBand();
+  void updateDutyCycleBuckets();
+  long frequencyErrorFromRegisters();
   bool isTransmitting();
 
   int getSpreadingFactor();
@@ -97,20 +225,49 @@ private:
 
   uint8_t readRegister(uint8_t address);
   void writeRegister(uint8_t address, uint8_t value);
+  static bool isCachedRegister(uint8_t address);
+  void invalidateRegisterCache();
   uint8_t singleTransfer(uint8_t address, uint8_t value);
+  void burstWrite(uint8_t address, const uint8_t* buffer, size_t size);
+  void burstRead(uint8_t address, uint8_t* buffer, size_t size);
 
   static void onDio0Rise();
 
 private:
-  SPISettings _spiSettings;
-  SPIClass* _spi;
-  int _ss;
-  int _reset;
-  int _dio0;
+  LoRaArduinoTransport _arduinoTransport;
+  LoRaTransport* _transport;
   long _frequency;
   int _packetIndex;
+  int _packetLength;
+  int _payloadLength;
   int _implicitHeaderMode;
   void (*_onReceive)(int);
+  void (*_onTxDone)();
+  void (*_onInterrupt)();
+  volatile bool _dio0Pending;
+  uint32_t _spiTransactions;
+  uint32_t _spiSaved;
+
+  // write-through shadow of the configuration registers
+  uint8_t _regCache[LORA_REG_CACHE_SIZE];
+  uint8_t _regCacheValid[(LORA_REG_CACHE_SIZE + 7) / 8];
+
+  // single producer (handleInterrupt) / single consumer (application) ring
+  LoRaPacket _rxQueue[LORA_RX_QUEUE_SIZE];
+  volatile uint8_t _rxHead;
+  volatile uint8_t _rxTail;
+  bool _rxQueueEnabled;
+  volatile uint32_t _rxOverflows;
+  volatile uint32_t _rxCrcErrors;
+  bool (*_rxFilter)(const uint8_t*, size_t);
+  uint8_t _rxFilterHeaderLength;
+  volatile uint32_t _rxFiltered;
+
+  LoRaDutyCycleBand _dutyCycleBands[LORA_DUTY_CYCLE_BANDS];
+  uint8_t _dutyCycleBandCount;
+  unsigned long _dutyCycleWindow;               // ms
+  unsigned long _dutyCycleBucket;               // index of the current bucket since startup
+  uint32_t _dutyCycleRejected;
 };
 
 extern LoRaClass LoRa;
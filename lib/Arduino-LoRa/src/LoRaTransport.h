@@ -0,0 +1,47 @@
+// Copyright (c) Sandeep Mistry. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef LORA_TRANSPORT_H
+#define LORA_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hardware access used by LoRaClass: SPI, chip select, reset line, DIO0 interrupt and timing.
+// The default implementation (LoRaArduinoTransport) drives the Arduino SPI and GPIO APIs,
+// other implementations (e.g. a simulated SX1276) can be injected with LoRa.setTransport().
+// This header must stay free of Arduino dependencies.
+class LoRaTransport {
+public:
+  virtual ~LoRaTransport() {}
+
+  // bring up the bus and the control lines, end() releases them
+  virtual void begin() = 0;
+  virtual void end() = 0;
+
+  // pulse the radio reset line, if there is one
+  virtual void reset() = 0;
+
+  // chip select low + start of the SPI transaction, deselect() ends it
+  virtual void select() = 0;
+  virtual void deselect() = 0;
+
+  // full duplex transfer of one byte within a selected transaction
+  virtual uint8_t transfer(uint8_t value) = 0;
+
+  // burst transfers within a selected transaction
+  virtual void write(const uint8_t* buffer, size_t size) = 0;
+  virtual void read(uint8_t* buffer, size_t size) = 0;
+
+  // DIO0 rising edge interrupt
+  virtual void attachDio0(void (*isr)()) = 0;
+  virtual void detachDio0() = 0;
+
+  // timing
+  virtual void delayMicroseconds(uint32_t us) = 0;
+  virtual unsigned long micros() = 0;
+  virtual unsigned long millis() = 0;
+  virtual void yield() = 0;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef ARDUINO_HOST_H
+#define ARDUINO_HOST_H
+
+/**
+* Minimal Arduino API for the host (PlatformIO native) build, enough to compile
+* the radio driver, the frame writer and the Lora2MQTT libraries into unit tests.
+*
+* Time is the host monotonic clock, pins are kept in a table and never change by
+* themselves, interrupts are never raised: hardware is modelled behind the
+* LoRaTransport and L2MFlash interfaces, not here.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Print.h"
+#include "Stream.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x01
+#define OUTPUT       0x02
+#define INPUT_PULLUP 0x05
+
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+// the binary.h constants used by the libraries
+#define B111  7
+#define B1000 8
+
+// code and data placement attributes of the ESP32 core
+#define IRAM_ATTR
+
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) (p)
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// console, written to stdout
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+  virtual size_t write(uint8_t byte);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+  virtual void flush();
+  operator bool() { return true; }
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,184 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#define ARDUINO_HOST_PINS 64
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+static uint8_t pinLevels[ARDUINO_HOST_PINS];
+
+static uint64_t monotonicMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = monotonicMicros();
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin < ARDUINO_HOST_PINS) {
+    pinLevels[pin] = value ? HIGH : LOW;
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pin < ARDUINO_HOST_PINS ? pinLevels[pin] : LOW;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode)
+{
+  (void)interrupt;
+  (void)isr;
+  (void)mode;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+  (void)interrupt;
+}
+
+unsigned long millis()
+{
+  return (monotonicMicros() - startMicros) / 1000;
+}
+
+unsigned long micros()
+{
+  return monotonicMicros() - startMicros;
+}
+
+void delay(unsigned long ms)
+{
+  delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  struct timespec duration;
+  duration.tv_sec = us / 1000000;
+  duration.tv_nsec = (us % 1000000) * 1000L;
+  nanosleep(&duration, NULL);
+}
+
+void yield()
+{
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--) {
+    if (write(*buffer++) == 0) {
+      break;
+    }
+    n++;
+  }
+  return n;
+}
+
+size_t Print::write(const char* str)
+{
+  return str ? write((const uint8_t*)str, strlen(str)) : 0;
+}
+
+size_t Print::print(const char* str)
+{
+  return write(str);
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t Print::print(long value, int base)
+{
+  if (base == DEC) {
+    return printf("%ld", value);
+  }
+  return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+  char buffer[8 * sizeof(long) + 1];
+  char* p = &buffer[sizeof(buffer) - 1];
+  *p = '\0';
+
+  if (base < 2) {
+    base = DEC;
+  }
+  do {
+    unsigned long digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+
+  return write(p);
+}
+
+size_t Print::print(double value, int digits)
+{
+  return printf("%.*f", digits, value);
+}
+
+size_t Print::println()
+{
+  return write("\r\n");
+}
+
+size_t Print::printf(const char* format, ...)
+{
+  char buffer[256];
+  va_list args;
+
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+
+  if (length < 0) {
+    return 0;
+  }
+  return write((const uint8_t*)buffer, (size_t)length < sizeof(buffer) ? length : sizeof(buffer) - 1);
+}
+
+size_t Stream::readBytes(char* buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length) {
+    int c = read();
+    if (c < 0) {
+      break;
+    }
+    buffer[count++] = (char)c;
+  }
+  return count;
+}
+
+size_t HardwareSerial::write(uint8_t byte)
+{
+  return fwrite(&byte, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+  return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush()
+{
+  fflush(stdout);
+}
@@ -0,0 +1,57 @@
+#ifndef PRINT_H
+#define PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+/**
+* Host version of the Arduino Print class: byte sink with the print helpers
+* used by the node and its libraries (ArduinoJson, LoRa, LoRaFrameWriter).
+*/
+class Print {
+public:
+  Print() : _writeError(0) {}
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t byte) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str);
+  virtual void flush() {}
+
+  size_t print(const char* str);
+  size_t print(char c);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(int value, int base = DEC) { return print((long)value, base); }
+  size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+  size_t print(double value, int digits = 2);
+
+  size_t println();
+  size_t println(const char* str) { return print(str) + println(); }
+  size_t println(char c) { return print(c) + println(); }
+  size_t println(long value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(unsigned long value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(int value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(unsigned int value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(unsigned char value, int base = DEC) { return print(value, base) + println(); }
+  size_t println(double value, int digits = 2) { return print(value, digits) + println(); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  int getWriteError() { return _writeError; }
+  void clearWriteError() { setWriteError(0); }
+
+protected:
+  void setWriteError(int error = 1) { _writeError = error; }
+
+private:
+  int _writeError;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "Print.h"
+
+// host version of the Arduino Stream class, reads are not timed
+class Stream : public Print {
+public:
+  Stream() : _timeout(1000) {}
+
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+protected:
+  unsigned long _timeout;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "L2MBatch.h"
+#include "L2MCodec.h"
+#include <string.h>
+
+static uint32_t zigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+L2MBatch::L2MBatch() :
+  _first(0),
+  _count(0),
+  _encoded(0),
+  _dropped(0)
+{
+}
+
+/**
+* Drop all the buffered samples
+*/
+void L2MBatch::clear()
+{
+  _first = 0;
+  _count = 0;
+  _encoded = 0;
+}
+
+/**
+* Buffer a sample, the oldest one is dropped when the batch is full
+* @param  sample the sample, time in ms
+* @return        false if a sample was dropped
+*/
+bool L2MBatch::add(const L2MSample& sample)
+{
+  bool dropped = false;
+  if (_count == L2M_BATCH_MAX_SAMPLES) {
+    _first = (_first + 1) % L2M_BATCH_MAX_SAMPLES;
+    _count--;
+    if (_encoded > 0) {
+      _encoded--;
+    }
+    _dropped++;
+    dropped = true;
+  }
+  _samples[(_first + _count) % L2M_BATCH_MAX_SAMPLES] = sample;
+  _count++;
+  return !dropped;
+}
+
+/**
+* @return the number of buffered samples
+*/
+size_t L2MBatch::count() const
+{
+  return _count;
+}
+
+/**
+* @param  index 0 for the oldest buffered sample
+* @return       the sample
+*/
+const L2MSample& L2MBatch::sample(size_t index) const
+{
+  return _samples[(_first + index) % L2M_BATCH_MAX_SAMPLES];
+}
+
+/**
+* Encode the buffered samples into a batch frame, oldest first, as many as fit.
+* They stay buffered until release(), the frame may have to be sent again
+* @param  nodeId  node id
+* @param  counter uplink counter
+* @param  now     current time, ms
+* @param  buffer  destination buffer
+* @param  size    buffer size
+* @return         the frame length, 0 if not even one record fits
+*/
+size_t L2MBatch::encode(uint8_t nodeId, uint32_t counter, uint32_t now, uint8_t* buffer, size_t size)
+{
+  _encoded = 0;
+  if (_count == 0 || size < L2M_BATCH_HEADER_MAX_SIZE) {
+    return 0;
+  }
+
+  // the record count and the age of the newest record are only known at the end
+  uint8_t records[L2M_BATCH_RECORD_MAX_SIZE];
+  uint8_t header[L2M_BATCH_HEADER_MAX_SIZE];
+  size_t headerLength = 0;
+  header[headerLength++] = L2M_BATCH_MARKER;
+  header[headerLength++] = nodeId;
+  headerLength += L2MEncodeVarint(counter, header + headerLength, sizeof(header) - headerLength);
+  size_t countOffset = headerLength++;
+
+  size_t length = L2M_BATCH_HEADER_MAX_SIZE;
+  uint32_t previousTime = sample(0).time / L2M_BATCH_TIME_UNIT;
+  L2MSample previous;
+  memset(&previous, 0, sizeof(previous));
+
+  for (size_t i = 0; i < _count && i < 255; i++) {
+    const L2MSample& current = sample(i);
+    uint32_t time = current.time / L2M_BATCH_TIME_UNIT;
+    size_t n = 0;
+    n += L2MEncodeVarint(time - previousTime, records + n, sizeof(records) - n);
+    records[n++] = (current.mail ? L2M_SAMPLE_FLAG_MAIL : 0) | (current.reedSwitch ? L2M_SAMPLE_FLAG_REED_SWITCH : 0);
+    n += L2MEncodeVarint(zigzag(current.heading - previous.heading), records + n, sizeof(records) - n);
+    n += L2MEncodeVarint(zigzag(current.x - previous.x), records + n, sizeof(records) - n);
+    n += L2MEncodeVarint(zigzag(current.y - previous.y), records + n, sizeof(records) - n);
+    n += L2MEncodeVarint(zigzag(current.z - previous.z), records + n, sizeof(records) - n);
+    n += L2MEncodeVarint(current.closes - previous.closes, records + n, sizeof(records) - n);
+    if (length + n > size) {
+      break;
+    }
+    memcpy(buffer + length, records, n);
+    length += n;
+    previousTime = time;
+    previous = current;
+    _encoded++;
+  }
+  if (_encoded == 0) {
+    return 0;
+  }
+
+  header[countOffset] = _encoded;
+  headerLength += L2MEncodeVarint(now / L2M_BATCH_TIME_UNIT - previousTime, header + headerLength, sizeof(header) - headerLength);
+  // records were written after the longest possible header, move them next to the actual one
+  memmove(buffer + headerLength, buffer + L2M_BATCH_HEADER_MAX_SIZE, length - L2M_BATCH_HEADER_MAX_SIZE);
+  memcpy(buffer, header, headerLength);
+  return length - L2M_BATCH_HEADER_MAX_SIZE + headerLength;
+}
+
+/**
+* @return the number of samples carried by the last encoded frame
+*/
+size_t L2MBatch::encodedCount() const
+{
+  return _encoded;
+}
+
+/**
+* Drop the samples carried by the last encoded frame, once it was delivered
+*/
+void L2MBatch::release()
+{
+  _first = (_first + _encoded) % L2M_BATCH_MAX_SAMPLES;
+  _count -= _encoded;
+  _encoded = 0;
+}
+
+/**
+* @return the number of samples dropped because the batch was full
+*/
+uint32_t L2MBatch::droppedCount() const
+{
+  return _dropped;
+}
+
+/**
+* Decode a batch frame into individual timestamped samples
+* @param  frame      the frame
+* @param  length     frame length
+* @param  time       when the frame was sent, on the receiver clock, ms
+* @param  nodeId     node id
+* @param  counter    uplink counter
+* @param  samples    decoded samples, oldest first, time on the receiver clock
+* @param  maxSamples size of samples
+* @return            the number of samples, 0 if the frame is not a valid batch frame
+*/
+size_t L2MDecodeBatch(const uint8_t* frame, size_t length, uint32_t time,
+                      uint8_t& nodeId, uint32_t& counter, L2MSample* samples, size_t maxSamples)
+{
+  if (length < 5 || frame[0] != L2M_BATCH_MARKER) {
+    return 0;
+  }
+  nodeId = frame[1];
+
+  size_t offset = 2;
+  size_t n = L2MDecodeVarint(frame + offset, length - offset, counter);
+  if (n == 0 || offset + n >= length) {
+    return 0;
+  }
+  offset += n;
+  size_t count = frame[offset++];
+  uint32_t age;
+  n = L2MDecodeVarint(frame + offset, length - offset, age);
+  if (n == 0 || count == 0 || count > maxSamples) {
+    return 0;
+  }
+  offset += n;
+
+  // records carry their time relative to the previous one: first on a relative scale,
+  // then shifted so that the newest record is age time units before the frame
+  uint32_t relativeTime = 0;
+  L2MSample previous;
+  memset(&previous, 0, sizeof(previous));
+  for (size_t i = 0; i < count; i++) {
+    uint32_t values[5];
+    uint32_t step;
+    n = L2MDecodeVarint(frame + offset, length - offset, step);
+    if (n == 0 || offset + n >= length) {
+      return 0;
+    }
+    offset += n;
+    uint8_t flags = frame[offset++];
+    for (size_t v = 0; v < 5; v++) {
+      n = L2MDecodeVarint(frame + offset, length - offset, values[v]);
+      if (n == 0) {
+        return 0;
+      }
+      offset += n;
+    }
+    relativeTime += step;
+    samples[i].time = relativeTime;
+    samples[i].mail = (flags & L2M_SAMPLE_FLAG_MAIL) != 0;
+    samples[i].reedSwitch = (flags & L2M_SAMPLE_FLAG_REED_SWITCH) != 0;
+    samples[i].heading = previous.heading + unzigzag(values[0]);
+    samples[i].x = previous.x + unzigzag(values[1]);
+    samples[i].y = previous.y + unzigzag(values[2]);
+    samples[i].z = previous.z + unzigzag(values[3]);
+    samples[i].closes = previous.closes + values[4];
+    previous = samples[i];
+  }
+  if (offset != length) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    samples[i].time = time - (age + relativeTime - samples[i].time) * L2M_BATCH_TIME_UNIT;
+  }
+  return count;
+}
@@ -0,0 +1,77 @@
+#ifndef L2MBATCH_H
+#define L2MBATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* Multi-record uplinks: samples buffered by the node and sent several per frame,
+* so that the preamble, header and CRC are paid once per batch.
+*
+* Batch frame layout (L2M_CODEC_BATCH):
+*   byte 0      L2M_BATCH_MARKER (0xC2)
+*   byte 1      node id
+*   varint      uplink counter
+*   byte        number of records
+*   varint      age of the newest record when the frame was encoded, L2M_BATCH_TIME_UNIT
+*   then per record, oldest first:
+*     varint      time since the previous record, L2M_BATCH_TIME_UNIT (0 for the first one)
+*     byte        bit 3 mail, bit 4 reed switch
+*     4 varints   heading, x, y, z: difference from the previous record (from 0 for the
+*                 first one), zigzag encoded so that small negative differences stay short
+*     varint      reed switch closes since the previous record (since the node started for
+*                 the first one)
+*
+* Times are quantized on the node clock, not per difference: the error on a decoded
+* timestamp stays under one time unit whatever the batch length.
+*/
+
+#define L2M_BATCH_MARKER              0xC2
+#define L2M_BATCH_MAX_SAMPLES         32
+#define L2M_BATCH_TIME_UNIT           100     // ms
+#define L2M_BATCH_HEADER_MAX_SIZE     13
+#define L2M_BATCH_RECORD_MAX_SIZE     23
+// a record of a slowly changing sensor: short time step, flags, one byte differences
+#define L2M_BATCH_RECORD_TYPICAL_SIZE 7
+
+#define L2M_SAMPLE_FLAG_MAIL          0x08
+#define L2M_SAMPLE_FLAG_REED_SWITCH   0x10
+
+struct L2MSample {
+  uint32_t time;        // ms, node clock when encoded, gateway clock when decoded
+  int16_t heading;      // degrees
+  int16_t x;            // raw magnetic field
+  int16_t y;
+  int16_t z;
+  bool reedSwitch;
+  bool mail;
+  uint32_t closes;      // reed switch closes since the node started
+};
+
+class L2MBatch {
+public:
+  L2MBatch();
+
+  void clear();
+  bool add(const L2MSample& sample);
+  size_t count() const;
+  const L2MSample& sample(size_t index) const;
+
+  size_t encode(uint8_t nodeId, uint32_t counter, uint32_t now, uint8_t* buffer, size_t size);
+  size_t encodedCount() const;
+  void release();
+
+  uint32_t droppedCount() const;
+
+private:
+  L2MSample _samples[L2M_BATCH_MAX_SAMPLES];
+  size_t _first;                // oldest sample
+  size_t _count;
+  size_t _encoded;              // oldest samples carried by the last encoded frame
+  uint32_t _dropped;
+};
+
+size_t L2MDecodeBatch(const uint8_t* frame, size_t length, uint32_t time,
+                      uint8_t& nodeId, uint32_t& counter, L2MSample* samples, size_t maxSamples);
+
+#endif
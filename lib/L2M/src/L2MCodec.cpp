@@ -0,0 +1,285 @@
+#include "L2MCodec.h"
+#include "L2MBatch.h"
+#include <string.h>
+
+#define COMPACT_FLAG_MAIL           0x08
+#define COMPACT_FLAG_REED_SWITCH    0x10
+#define COMPACT_FLAG_HEADING_VALID  0x80
+#define COMPACT_HEADING_MASK        0x07
+
+/**
+* Guess the codec of a frame from its first byte
+* @param  frame  the frame
+* @param  length frame length
+* @return        L2M_CODEC_xx
+*/
+uint8_t L2MDetectCodec(const uint8_t* frame, size_t length)
+{
+  if (length == 0) {
+    return L2M_CODEC_UNKNOWN;
+  }
+  if (frame[0] == L2M_COMPACT_MARKER) {
+    return L2M_CODEC_COMPACT;
+  }
+  if (frame[0] == L2M_BATCH_MARKER) {
+    return L2M_CODEC_BATCH;
+  }
+  if (frame[0] == '{') {
+    return L2M_CODEC_JSON;
+  }
+  // fixmap, map16, map32
+  if ((frame[0] & 0xF0) == 0x80 || frame[0] == 0xDE || frame[0] == 0xDF) {
+    return L2M_CODEC_MSGPACK;
+  }
+  return L2M_CODEC_UNKNOWN;
+}
+
+/**
+* Encode an uplink with the compact codec
+* @param  uplink the uplink fields
+* @param  buffer destination buffer
+* @param  size   buffer size, L2M_COMPACT_MAX_SIZE is always enough
+* @return        the frame length, 0 if the buffer is too small
+*/
+size_t L2MEncodeCompact(const L2MUplink& uplink, uint8_t* buffer, size_t size)
+{
+  if (size < 2) {
+    return 0;
+  }
+  buffer[0] = L2M_COMPACT_MARKER;
+  buffer[1] = uplink.nodeId;
+
+  size_t length = 2;
+  size_t n = L2MEncodeVarint(uplink.counter, buffer + length, size - length);
+  if (n == 0 || length + n >= size) {
+    return 0;
+  }
+  length += n;
+
+  buffer[length++] = L2MEncodeFlags(uplink);
+
+  n = L2MEncodeVarint(uplink.closes, buffer + length, size - length);
+  if (n == 0) {
+    return 0;
+  }
+  length += n;
+
+  return length;
+}
+
+/**
+* Decode a compact uplink frame
+* @param  frame  the frame
+* @param  length frame length
+* @param  uplink decoded fields
+* @return        false if the frame is not a valid compact frame
+*/
+bool L2MDecodeCompact(const uint8_t* frame, size_t length, L2MUplink& uplink)
+{
+  if (length < 4 || frame[0] != L2M_COMPACT_MARKER) {
+    return false;
+  }
+  uplink.nodeId = frame[1];
+
+  size_t offset = 2;
+  size_t n = L2MDecodeVarint(frame + offset, length - offset, uplink.counter);
+  if (n == 0 || offset + n >= length) {
+    return false;
+  }
+  offset += n;
+
+  L2MDecodeFlags(frame[offset++], uplink);
+
+  // frames of older nodes end with the flags
+  uplink.closes = 0;
+  if (offset < length && L2MDecodeVarint(frame + offset, length - offset, uplink.closes) == 0) {
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Pack the state fields of an uplink into the compact flags byte
+* @param  uplink the uplink fields
+* @return        the flags
+*/
+uint8_t L2MEncodeFlags(const L2MUplink& uplink)
+{
+  uint8_t flags = 0;
+  if (uplink.heading != L2M_HEADING_UNKNOWN) {
+    flags |= COMPACT_FLAG_HEADING_VALID | (uplink.heading & COMPACT_HEADING_MASK);
+  }
+  if (uplink.mail) {
+    flags |= COMPACT_FLAG_MAIL;
+  }
+  if (uplink.reedSwitch) {
+    flags |= COMPACT_FLAG_REED_SWITCH;
+  }
+  return flags;
+}
+
+/**
+* Unpack the compact flags byte into the state fields of an uplink
+* @param flags  the flags
+* @param uplink decoded fields
+*/
+void L2MDecodeFlags(uint8_t flags, L2MUplink& uplink)
+{
+  uplink.heading = (flags & COMPACT_FLAG_HEADING_VALID) ? (flags & COMPACT_HEADING_MASK) : L2M_HEADING_UNKNOWN;
+  uplink.mail = (flags & COMPACT_FLAG_MAIL) != 0;
+  uplink.reedSwitch = (flags & COMPACT_FLAG_REED_SWITCH) != 0;
+}
+
+/**
+* Encode logged records into a replay batch, as many as fit
+* @param  records the records, oldest first
+* @param  count   number of records
+* @param  boot    current boot number
+* @param  now     current time, seconds since boot
+* @param  buffer  destination buffer
+* @param  size    buffer size
+* @param  encoded number of records encoded
+* @return         the batch length, 0 if not even one record fits
+*/
+size_t L2MEncodeLogBatch(const L2MLogRecord* records, size_t count, uint16_t boot, uint32_t now,
+                         uint8_t* buffer, size_t size, size_t& encoded)
+{
+  encoded = 0;
+  size_t length = 1;
+
+  for (size_t i = 0; i < count && i < 255; i++) {
+    uint8_t record[1 + 5 + 5];
+    uint8_t flags = records[i].flags;
+    if (records[i].boot != boot) {
+      // logged before a reset: the clock restarted since, the age is unknown
+      flags |= L2M_LOG_FLAG_AGE_UNKNOWN;
+    }
+
+    size_t n = 0;
+    record[n++] = flags;
+    if (!(flags & L2M_LOG_FLAG_AGE_UNKNOWN)) {
+      n += L2MEncodeVarint(now - records[i].time, record + n, sizeof(record) - n);
+    }
+    n += L2MEncodeVarint(records[i].counter, record + n, sizeof(record) - n);
+
+    if (length + n > size) {
+      break;
+    }
+    memcpy(buffer + length, record, n);
+    length += n;
+    encoded++;
+  }
+
+  if (encoded == 0) {
+    return 0;
+  }
+  buffer[0] = encoded;
+  return length;
+}
+
+/**
+* Decode one record of a replay batch
+* @param  batch  the batch, after its count byte
+* @param  length remaining batch length
+* @param  uplink decoded fields, nodeId is left untouched, closes L2M_CLOSES_UNKNOWN unless the record carries them
+* @param  age    record age in seconds, L2M_LOG_AGE_UNKNOWN if logged before a reset
+* @return        the number of bytes read, 0 if the record is truncated
+*/
+size_t L2MDecodeLogRecord(const uint8_t* batch, size_t length, L2MUplink& uplink, uint32_t& age)
+{
+  if (length < 2) {
+    return 0;
+  }
+  uint8_t flags = batch[0];
+  L2MDecodeFlags(flags, uplink);
+  uplink.closes = L2M_CLOSES_UNKNOWN;
+
+  size_t offset = 1;
+  age = L2M_LOG_AGE_UNKNOWN;
+  if (!(flags & L2M_LOG_FLAG_AGE_UNKNOWN)) {
+    size_t n = L2MDecodeVarint(batch + offset, length - offset, age);
+    if (n == 0) {
+      return 0;
+    }
+    offset += n;
+  }
+  size_t n = L2MDecodeVarint(batch + offset, length - offset, uplink.counter);
+  if (n == 0) {
+    return 0;
+  }
+  offset += n;
+  if (flags & L2M_LOG_FLAG_CLOSES) {
+    n = L2MDecodeVarint(batch + offset, length - offset, uplink.closes);
+    if (n == 0) {
+      return 0;
+    }
+    offset += n;
+  }
+  return offset;
+}
+
+/**
+* Unsigned LEB128 encoding: 7 bits per byte, least significant group first, bit 7 set when more bytes follow
+* @return the number of bytes written, 0 if the buffer is too small
+*/
+size_t L2MEncodeVarint(uint32_t value, uint8_t* buffer, size_t size)
+{
+  size_t length = 0;
+  do {
+    if (length == size) {
+      return 0;
+    }
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    if (value) {
+      byte |= 0x80;
+    }
+    buffer[length++] = byte;
+  } while (value);
+  return length;
+}
+
+/**
+* Unsigned LEB128 decoding
+* @return the number of bytes read, 0 if the varint is truncated or longer than 32 bits
+*/
+size_t L2MDecodeVarint(const uint8_t* buffer, size_t size, uint32_t& value)
+{
+  value = 0;
+  for (size_t i = 0; i < size && i < 5; i++) {
+    value |= (uint32_t)(buffer[i] & 0x7F) << (7 * i);
+    if ((buffer[i] & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+/**
+* Heading sector of a compass heading
+* @param  heading heading in degrees, 0 to 360
+* @return         L2M_HEADING_N to L2M_HEADING_NW
+*/
+uint8_t L2MHeadingSector(int heading)
+{
+  if ((heading >= 340) || (heading <= 23)) { return L2M_HEADING_N; }
+  if (heading <= 68) { return L2M_HEADING_NE; }
+  if (heading <= 113) { return L2M_HEADING_E; }
+  if (heading <= 158) { return L2M_HEADING_SE; }
+  if (heading <= 203) { return L2M_HEADING_S; }
+  if (heading <= 248) { return L2M_HEADING_SW; }
+  if (heading <= 293) { return L2M_HEADING_W; }
+  return L2M_HEADING_NW;
+}
+
+/**
+* Name of a heading sector as used in the JSON payload
+* @param  sector L2M_HEADING_xx
+* @return        "N", "NE", ... or "" if unknown
+*/
+const char* L2MHeadingName(uint8_t sector)
+{
+  static const char* names[] = { "N", "NE", "E", "SE", "S", "SW", "W", "NW" };
+  return (sector <= L2M_HEADING_NW) ? names[sector] : "";
+}
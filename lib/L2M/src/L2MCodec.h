@@ -0,0 +1,86 @@
+#ifndef L2MCODEC_H
+#define L2MCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "L2MRingLog.h"
+
+/**
+* Lora2MQTT uplink codecs.
+* Shared by the node (encoder) and the gateway (decoder): this library has no
+* Arduino dependency and builds on any host.
+*
+* Compact frame layout:
+*   byte 0      L2M_COMPACT_MARKER (0xC1, never used by MsgPack nor JSON text)
+*   byte 1      node id
+*   bytes 2..n  uplink counter, unsigned LEB128 varint (1 to 5 bytes)
+*   byte n+1    bits 0-2 heading sector, bit 3 mail, bit 4 reed switch, bit 7 heading valid
+*   bytes n+2.. reed switch closes since the node started (pulse counter), varint (1 to 5 bytes),
+*               absent in frames of older nodes, which decode with 0 closes
+*
+* Replay batch layout (records of the store-and-forward log, oldest first):
+*   byte 0      number of records
+*   then per record:
+*     flags       as above, bit 5 set when the age is unknown, bit 6 set when the closes follow
+*     age         seconds since the record was logged, varint, absent when unknown
+*     counter     uplink counter, varint
+*     closes      reed switch closes since the node started, varint, present with bit 6 only
+*   The log does not store the reed switch closes, so the node never sets bit 6: replayed
+*   records decode with L2M_CLOSES_UNKNOWN closes, not with a count that dropped to 0
+*/
+
+// codecs
+#define L2M_CODEC_JSON        0
+#define L2M_CODEC_MSGPACK     1
+#define L2M_CODEC_COMPACT     2
+#define L2M_CODEC_BATCH       3     // several samples per frame, see L2MBatch
+#define L2M_CODEC_UNKNOWN     0xFF
+
+#define L2M_COMPACT_MARKER    0xC1
+#define L2M_COMPACT_MAX_SIZE  13
+
+// replay batch: record logged before the last reset, its age is unknown
+#define L2M_LOG_FLAG_AGE_UNKNOWN  0x20
+#define L2M_LOG_AGE_UNKNOWN       0xFFFFFFFF
+// replay batch: the reed switch closes follow the counter
+#define L2M_LOG_FLAG_CLOSES       0x40
+#define L2M_CLOSES_UNKNOWN        0xFFFFFFFF
+
+// heading sectors of 45 degrees
+#define L2M_HEADING_N         0
+#define L2M_HEADING_NE        1
+#define L2M_HEADING_E         2
+#define L2M_HEADING_SE        3
+#define L2M_HEADING_S         4
+#define L2M_HEADING_SW        5
+#define L2M_HEADING_W         6
+#define L2M_HEADING_NW        7
+#define L2M_HEADING_UNKNOWN   0xFF
+
+struct L2MUplink {
+  uint8_t nodeId;
+  uint32_t counter;
+  uint8_t heading;      // L2M_HEADING_xx
+  bool mail;
+  bool reedSwitch;
+  uint32_t closes;      // reed switch closes since the node started, L2M_CLOSES_UNKNOWN if absent
+};
+
+uint8_t L2MDetectCodec(const uint8_t* frame, size_t length);
+
+size_t L2MEncodeCompact(const L2MUplink& uplink, uint8_t* buffer, size_t size);
+bool L2MDecodeCompact(const uint8_t* frame, size_t length, L2MUplink& uplink);
+uint8_t L2MEncodeFlags(const L2MUplink& uplink);
+void L2MDecodeFlags(uint8_t flags, L2MUplink& uplink);
+
+size_t L2MEncodeLogBatch(const L2MLogRecord* records, size_t count, uint16_t boot, uint32_t now,
+                         uint8_t* buffer, size_t size, size_t& encoded);
+size_t L2MDecodeLogRecord(const uint8_t* batch, size_t length, L2MUplink& uplink, uint32_t& age);
+
+size_t L2MEncodeVarint(uint32_t value, uint8_t* buffer, size_t size);
+size_t L2MDecodeVarint(const uint8_t* buffer, size_t size, uint32_t& value);
+
+uint8_t L2MHeadingSector(int heading);
+const char* L2MHeadingName(uint8_t sector);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef L2MCRC16_H
+#define L2MCRC16_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* CRC16-CCITT (polynomial 0x1021, initial value 0xFFFF, no reflection, no final xor),
+* the frame check appended to every Lora2MQTT frame, least significant byte first.
+*
+* Table driven, processing 4 bytes per step (slice-by-4) on long runs.
+* Incremental: begin a CRC, update() it with the frame bytes as they are produced,
+* e.g. while they are streamed into the radio FIFO, then read value().
+*/
+class L2MCrc16 {
+public:
+  L2MCrc16();
+
+  void begin();
+  void update(uint8_t byte);
+  void update(const uint8_t* data, size_t length);
+  uint16_t value() const;
+
+  static uint16_t compute(const uint8_t* data, size_t length);
+  static bool check(const uint8_t* frame, size_t length);
+
+private:
+  uint16_t _crc;
+};
+
+#endif
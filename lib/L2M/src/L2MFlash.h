@@ -0,0 +1,25 @@
+#ifndef L2MFLASH_H
+#define L2MFLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* NOR flash area used by the store-and-forward log: erased bytes read 0xFF,
+* programming only clears bits (1 -> 0), and only erasing a whole sector sets
+* them back. Implemented on the node over a flash partition, and on a host by
+* a simulated flash (L2MFlashSim).
+*/
+class L2MFlash {
+public:
+  virtual ~L2MFlash() {}
+
+  virtual size_t sectorSize() = 0;
+  virtual size_t sectorCount() = 0;
+
+  virtual bool read(uint32_t address, uint8_t* buffer, size_t size) = 0;
+  virtual bool program(uint32_t address, const uint8_t* buffer, size_t size) = 0;
+  virtual bool erase(uint32_t sector) = 0;
+};
+
+#endif
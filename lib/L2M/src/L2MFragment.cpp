@@ -0,0 +1,342 @@
+#include "L2MFragment.h"
+#include <string.h>
+
+static uint32_t fragmentMask(uint8_t count)
+{
+  return (count >= 32) ? 0xFFFFFFFF : (((uint32_t)1 << count) - 1);
+}
+
+L2MFragmenter::L2MFragmenter() :
+  _length(0),
+  _fragmentSize(0),
+  _count(0),
+  _messageId(0),
+  _active(false),
+  _toSend(0),
+  _acked(0),
+  _sent(0),
+  _rounds(0)
+{
+}
+
+/**
+* @return the message buffer, to be filled in before begin()
+*/
+uint8_t* L2MFragmenter::buffer()
+{
+  return _data;
+}
+
+/**
+* @return the message buffer size
+*/
+size_t L2MFragmenter::capacity() const
+{
+  return sizeof(_data);
+}
+
+/**
+* Start sending the message written in buffer()
+* @param  messageId    message id, must differ from the previous message
+* @param  length       message length
+* @param  fragmentSize data bytes per fragment
+* @return              false if the message does not fit in L2M_FRAGMENT_MAX_COUNT fragments
+*/
+bool L2MFragmenter::begin(uint8_t messageId, size_t length, size_t fragmentSize)
+{
+  _active = false;
+  if (length == 0 || length > sizeof(_data) || fragmentSize == 0 || fragmentSize > 255) {
+    return false;
+  }
+  size_t count = (length + fragmentSize - 1) / fragmentSize;
+  if (count > L2M_FRAGMENT_MAX_COUNT) {
+    return false;
+  }
+  _length = length;
+  _fragmentSize = fragmentSize;
+  _count = count;
+  _messageId = messageId;
+  _toSend = fragmentMask(_count);
+  _acked = 0;
+  _sent = 0;
+  _rounds = 1;
+  _active = true;
+  return true;
+}
+
+/**
+* Give up the message
+*/
+void L2MFragmenter::abort()
+{
+  _active = false;
+}
+
+/**
+* @return true while the message is not acknowledged nor aborted
+*/
+bool L2MFragmenter::active() const
+{
+  return _active;
+}
+
+/**
+* @return true once the receiver holds every fragment
+*/
+bool L2MFragmenter::complete() const
+{
+  return (_count > 0) && (_acked == fragmentMask(_count));
+}
+
+uint8_t L2MFragmenter::messageId() const
+{
+  return _messageId;
+}
+
+uint8_t L2MFragmenter::fragmentCount() const
+{
+  return _count;
+}
+
+/**
+* @return the next fragment to send in this round, -1 if the round is over
+*/
+int L2MFragmenter::nextFragment() const
+{
+  if (!_active || _toSend == 0) {
+    return -1;
+  }
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_toSend & ((uint32_t)1 << i)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+* @param  index fragment index
+* @return       true if the fragment is the last one to send in this round, it then
+*               requests the acknowledgement
+*/
+bool L2MFragmenter::isLastOfRound(uint8_t index) const
+{
+  return _toSend == ((uint32_t)1 << index);
+}
+
+/**
+* The fragment went out
+* @param index fragment index
+*/
+void L2MFragmenter::sent(uint8_t index)
+{
+  _toSend &= ~((uint32_t)1 << index);
+  _sent++;
+}
+
+/**
+* Encode a fragment, header included
+* @param  index      fragment index
+* @param  ackRequest true to request the acknowledgement
+* @param  buffer     destination buffer
+* @param  size       buffer size
+* @return            the fragment length, 0 if the buffer is too small
+*/
+size_t L2MFragmenter::encode(uint8_t index, bool ackRequest, uint8_t* buffer, size_t size) const
+{
+  if (index >= _count) {
+    return 0;
+  }
+  size_t offset = (size_t)index * _fragmentSize;
+  size_t length = (_length - offset < _fragmentSize) ? _length - offset : _fragmentSize;
+  if (size < L2M_FRAGMENT_HEADER_SIZE + length) {
+    return 0;
+  }
+  buffer[0] = _messageId;
+  buffer[1] = index | (ackRequest ? L2M_FRAGMENT_ACK_REQUEST : 0);
+  buffer[2] = _count;
+  buffer[3] = _fragmentSize;
+  memcpy(buffer + L2M_FRAGMENT_HEADER_SIZE, _data + offset, length);
+  return L2M_FRAGMENT_HEADER_SIZE + length;
+}
+
+/**
+* Selective acknowledgement from the receiver: the next round carries the missing fragments
+* @param  ack    the acknowledgement, frame header excluded
+* @param  length acknowledgement length
+* @return        false if the acknowledgement is not for the message in flight
+*/
+bool L2MFragmenter::acknowledge(const uint8_t* ack, size_t length)
+{
+  if (!_active || length < L2M_FRAGMENT_ACK_SIZE || ack[0] != _messageId) {
+    return false;
+  }
+  _acked |= ((uint32_t)ack[1] | ((uint32_t)ack[2] << 8) | ((uint32_t)ack[3] << 16) | ((uint32_t)ack[4] << 24))
+            & fragmentMask(_count);
+  if (complete()) {
+    _toSend = 0;
+    _active = false;
+  } else {
+    _toSend = fragmentMask(_count) & ~_acked;
+    _rounds++;
+  }
+  return true;
+}
+
+/**
+* @return fragments sent for this message, first transmissions and repeats
+*/
+uint32_t L2MFragmenter::fragmentsSent() const
+{
+  return _sent;
+}
+
+/**
+* @return rounds started for this message
+*/
+uint8_t L2MFragmenter::rounds() const
+{
+  return _rounds;
+}
+
+L2MReassembler::L2MReassembler()
+{
+  reset();
+}
+
+/**
+* Forget the message being reassembled
+*/
+void L2MReassembler::reset()
+{
+  _length = 0;
+  _fragmentSize = 0;
+  _count = 0;
+  _messageId = 0;
+  _started = false;
+  _ackRequested = false;
+  _received = 0;
+}
+
+/**
+* Store a fragment. A fragment of another message id drops the message being reassembled
+* @param  fragment the fragment, frame header excluded
+* @param  length   fragment length
+* @return          L2M_FRAGMENT_COMPLETE once every fragment is in (also for repeats of
+*                  a complete message), L2M_FRAGMENT_INCOMPLETE, or L2M_FRAGMENT_INVALID
+*/
+int L2MReassembler::add(const uint8_t* fragment, size_t length)
+{
+  if (length < L2M_FRAGMENT_HEADER_SIZE) {
+    return L2M_FRAGMENT_INVALID;
+  }
+  uint8_t messageId = fragment[0];
+  uint8_t index = fragment[1] & L2M_FRAGMENT_INDEX_MASK;
+  uint8_t count = fragment[2];
+  uint8_t fragmentSize = fragment[3];
+  size_t dataLength = length - L2M_FRAGMENT_HEADER_SIZE;
+
+  if (count == 0 || count > L2M_FRAGMENT_MAX_COUNT || index >= count || fragmentSize == 0
+      || (size_t)(count - 1) * fragmentSize >= sizeof(_data)) {
+    return L2M_FRAGMENT_INVALID;
+  }
+  // every fragment but the last one is fragmentSize long
+  size_t offset = (size_t)index * fragmentSize;
+  if ((index < count - 1) ? (dataLength != fragmentSize) : (dataLength == 0 || dataLength > fragmentSize)) {
+    return L2M_FRAGMENT_INVALID;
+  }
+  if (offset + dataLength > sizeof(_data)) {
+    return L2M_FRAGMENT_INVALID;
+  }
+
+  if (!_started || messageId != _messageId) {
+    reset();
+    _messageId = messageId;
+    _count = count;
+    _fragmentSize = fragmentSize;
+    _started = true;
+  } else if (count != _count || fragmentSize != _fragmentSize) {
+    return L2M_FRAGMENT_INVALID;
+  }
+
+  _ackRequested = (fragment[1] & L2M_FRAGMENT_ACK_REQUEST) != 0;
+  memcpy(_data + offset, fragment + L2M_FRAGMENT_HEADER_SIZE, dataLength);
+  _received |= (uint32_t)1 << index;
+  if (index == count - 1) {
+    _length = offset + dataLength;
+  }
+  return complete() ? L2M_FRAGMENT_COMPLETE : L2M_FRAGMENT_INCOMPLETE;
+}
+
+/**
+* @return true once every fragment of the message is in
+*/
+bool L2MReassembler::complete() const
+{
+  return _started && (_received == fragmentMask(_count));
+}
+
+/**
+* @return true if the last fragment added requested an acknowledgement
+*/
+bool L2MReassembler::ackRequested() const
+{
+  return _ackRequested;
+}
+
+uint8_t L2MReassembler::messageId() const
+{
+  return _messageId;
+}
+
+/**
+* @return bitmap of the fragments received
+*/
+uint32_t L2MReassembler::received() const
+{
+  return _received;
+}
+
+/**
+* @return the message, once complete
+*/
+const uint8_t* L2MReassembler::data() const
+{
+  return _data;
+}
+
+/**
+* @return the message, once complete, writable: e.g. parsed in place by a zero-copy JSON parser.
+* Fragments repeated by the sender are written again over it
+*/
+uint8_t* L2MReassembler::data()
+{
+  return _data;
+}
+
+/**
+* @return the message length, once complete
+*/
+size_t L2MReassembler::length() const
+{
+  return complete() ? _length : 0;
+}
+
+/**
+* Encode the acknowledgement of the fragments received
+* @param  buffer destination buffer
+* @param  size   buffer size
+* @return        the acknowledgement length, 0 if the buffer is too small
+*/
+size_t L2MReassembler::encodeAck(uint8_t* buffer, size_t size) const
+{
+  if (size < L2M_FRAGMENT_ACK_SIZE) {
+    return 0;
+  }
+  buffer[0] = _messageId;
+  buffer[1] = _received;
+  buffer[2] = _received >> 8;
+  buffer[3] = _received >> 16;
+  buffer[4] = _received >> 24;
+  return L2M_FRAGMENT_ACK_SIZE;
+}
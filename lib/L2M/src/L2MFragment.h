@@ -0,0 +1,106 @@
+#ifndef L2MFRAGMENT_H
+#define L2MFRAGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* Fragmentation of messages longer than a LoRa packet, with selective repeat.
+*
+* The sender splits the message in up to L2M_FRAGMENT_MAX_COUNT fragments of the same
+* size (the last one may be shorter), sent in L2M_MSG_FRAGMENT frames. The last fragment
+* of each round requests an acknowledgement: the receiver answers with a
+* L2M_MSG_FRAGMENT_ACK frame carrying the bitmap of the fragments it holds, and the next
+* round only carries the missing ones. Both ends use bounded buffers of
+* L2M_FRAGMENT_MAX_MESSAGE bytes.
+*
+* Fragment layout, after the frame header:
+*   byte 0    message id
+*   byte 1    bits 0-6 fragment index, bit 7 acknowledgement requested
+*   byte 2    fragment count
+*   byte 3    fragment size, length of every fragment but the last one
+*   bytes 4-  data
+*
+* Acknowledgement layout, after the frame header:
+*   byte 0    message id
+*   bytes 1-4 bitmap of the fragments received, bit i for fragment i, little endian
+*/
+
+#ifndef L2M_FRAGMENT_MAX_MESSAGE
+#define L2M_FRAGMENT_MAX_MESSAGE  1024
+#endif
+#define L2M_FRAGMENT_MAX_COUNT    32
+#define L2M_FRAGMENT_HEADER_SIZE  4
+#define L2M_FRAGMENT_ACK_SIZE     5
+#define L2M_FRAGMENT_ACK_REQUEST  0x80
+#define L2M_FRAGMENT_INDEX_MASK   0x7F
+
+// L2MReassembler::add results
+#define L2M_FRAGMENT_INVALID      0
+#define L2M_FRAGMENT_INCOMPLETE   1
+#define L2M_FRAGMENT_COMPLETE     2
+
+class L2MFragmenter {
+public:
+  L2MFragmenter();
+
+  uint8_t* buffer();
+  size_t capacity() const;
+  bool begin(uint8_t messageId, size_t length, size_t fragmentSize);
+  void abort();
+
+  bool active() const;
+  bool complete() const;
+  uint8_t messageId() const;
+  uint8_t fragmentCount() const;
+
+  int nextFragment() const;
+  bool isLastOfRound(uint8_t index) const;
+  void sent(uint8_t index);
+  size_t encode(uint8_t index, bool ackRequest, uint8_t* buffer, size_t size) const;
+  bool acknowledge(const uint8_t* ack, size_t length);
+
+  uint32_t fragmentsSent() const;
+  uint8_t rounds() const;
+
+private:
+  uint8_t _data[L2M_FRAGMENT_MAX_MESSAGE];
+  size_t _length;
+  uint8_t _fragmentSize;
+  uint8_t _count;
+  uint8_t _messageId;
+  bool _active;
+  uint32_t _toSend;             // fragments still to be sent in this round
+  uint32_t _acked;              // fragments the receiver holds
+  uint32_t _sent;
+  uint8_t _rounds;
+};
+
+class L2MReassembler {
+public:
+  L2MReassembler();
+
+  void reset();
+  int add(const uint8_t* fragment, size_t length);
+
+  bool complete() const;
+  bool ackRequested() const;
+  uint8_t messageId() const;
+  uint32_t received() const;
+  const uint8_t* data() const;
+  uint8_t* data();
+  size_t length() const;
+  size_t encodeAck(uint8_t* buffer, size_t size) const;
+
+private:
+  uint8_t _data[L2M_FRAGMENT_MAX_MESSAGE];
+  size_t _length;
+  uint8_t _fragmentSize;
+  uint8_t _count;
+  uint8_t _messageId;
+  bool _started;
+  bool _ackRequested;
+  uint32_t _received;
+};
+
+#endif
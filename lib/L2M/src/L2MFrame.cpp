@@ -0,0 +1,62 @@
+#include "L2MFrame.h"
+
+/**
+* Encode a frame header
+* @param  header the header fields
+* @param  buffer destination buffer
+* @param  size   buffer size
+* @return        L2M_FRAME_HEADER_SIZE, 0 if the buffer is too small
+*/
+size_t L2MEncodeHeader(const L2MFrameHeader& header, uint8_t* buffer, size_t size)
+{
+  if (size < L2M_FRAME_HEADER_SIZE) {
+    return 0;
+  }
+  buffer[0] = header.destination;
+  buffer[1] = header.source;
+  buffer[2] = header.type;
+  buffer[3] = header.sequence;
+  return L2M_FRAME_HEADER_SIZE;
+}
+
+/**
+* Decode a frame header
+* @param  frame  the frame
+* @param  length frame length
+* @param  header decoded fields
+* @return        false if the frame is too short
+*/
+bool L2MDecodeHeader(const uint8_t* frame, size_t length, L2MFrameHeader& header)
+{
+  if (length < L2M_FRAME_HEADER_SIZE) {
+    return false;
+  }
+  header.destination = frame[0];
+  header.source = frame[1];
+  header.type = frame[2];
+  header.sequence = frame[3];
+  return true;
+}
+
+/**
+* @param  address an address
+* @return         true for a group address (broadcast excluded)
+*/
+bool L2MIsGroupAddress(uint8_t address)
+{
+  return address >= L2M_ADDRESS_GROUP_FIRST && address != L2M_ADDRESS_BROADCAST;
+}
+
+/**
+* Tell whether a frame destination concerns a device
+* @param  destination the frame destination
+* @param  address     the device address
+* @param  group       the device group, L2M_ADDRESS_NO_GROUP if none
+* @return             true if addressed to the device, its group or broadcast
+*/
+bool L2MIsAddressedTo(uint8_t destination, uint8_t address, uint8_t group)
+{
+  return destination == address
+      || destination == L2M_ADDRESS_BROADCAST
+      || (L2MIsGroupAddress(destination) && destination == group);
+}
@@ -0,0 +1,53 @@
+#ifndef L2MFRAME_H
+#define L2MFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* Lora2MQTT frame header, in front of every payload (the CRC16 follows the payload).
+*
+*   byte 0  destination address
+*   byte 1  source address
+*   byte 2  message type: bits 4-7 kind (L2M_MSG_xx), bits 0-3 payload codec (L2M_CODEC_xx)
+*   byte 3  sequence number, per source; an ACK carries the sequence number it acknowledges
+*
+* The destination comes first so that a receiver can drop foreign frames after
+* reading the first bytes of the packet, before the payload is read or parsed.
+*
+* Addresses: 0x00 gateway, 0x01-0xEF nodes, 0xF0-0xFE groups, 0xFF broadcast.
+*/
+
+#define L2M_FRAME_HEADER_SIZE   4
+
+// addresses
+#define L2M_ADDRESS_GATEWAY     0x00
+#define L2M_ADDRESS_GROUP_FIRST 0xF0
+#define L2M_ADDRESS_BROADCAST   0xFF
+#define L2M_ADDRESS_NO_GROUP    L2M_ADDRESS_BROADCAST
+
+// message kinds
+#define L2M_MSG_UPLINK          0x10
+#define L2M_MSG_DOWNLINK        0x20
+#define L2M_MSG_CONFIRMED       0x30    // uplink to be acknowledged by the gateway
+#define L2M_MSG_ACK             0x40    // optional payload: uplink SNR at the gateway, int8 quarter dB
+#define L2M_MSG_LOG             0x50    // replay batch of logged uplinks, acknowledged like a confirmed uplink
+#define L2M_MSG_FRAGMENT        0x60    // fragment of a long message, see L2MFragment; codec of the whole message
+#define L2M_MSG_FRAGMENT_ACK    0x70    // fragments received, see L2MFragment
+#define L2M_MSG_KIND_MASK       0xF0
+#define L2M_MSG_CODEC_MASK      0x0F
+
+struct L2MFrameHeader {
+  uint8_t destination;
+  uint8_t source;
+  uint8_t type;         // L2M_MSG_xx | L2M_CODEC_xx
+  uint8_t sequence;
+};
+
+size_t L2MEncodeHeader(const L2MFrameHeader& header, uint8_t* buffer, size_t size);
+bool L2MDecodeHeader(const uint8_t* frame, size_t length, L2MFrameHeader& header);
+
+bool L2MIsGroupAddress(uint8_t address);
+bool L2MIsAddressedTo(uint8_t destination, uint8_t address, uint8_t group);
+
+#endif
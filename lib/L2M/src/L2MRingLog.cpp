@@ -0,0 +1,289 @@
+#include "L2MRingLog.h"
+#include <string.h>
+
+static uint32_t getLe32(const uint8_t* data)
+{
+  return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void putLe32(uint8_t* data, uint32_t value)
+{
+  data[0] = value;
+  data[1] = value >> 8;
+  data[2] = value >> 16;
+  data[3] = value >> 24;
+}
+
+static bool isBlank(const uint8_t* data, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+L2MRingLog::L2MRingLog(L2MFlash& flash) :
+  _flash(flash),
+  _slotsPerSector(0),
+  _slotCount(0),
+  _head(0),
+  _tail(0),
+  _pending(0),
+  _nextSequence(0),
+  _boot(0),
+  _appended(0),
+  _dropped(0)
+{
+}
+
+/**
+* Find the head and the oldest unacknowledged record, once at startup
+* @return false if the flash area is too small
+*/
+bool L2MRingLog::begin()
+{
+  _slotsPerSector = _flash.sectorSize() / L2M_LOG_SLOT_SIZE;
+  _slotCount = _slotsPerSector * _flash.sectorCount();
+  if (_flash.sectorCount() < 2 || _slotsPerSector == 0) {
+    return false;
+  }
+
+  bool found = false;
+  bool pendingFound = false;
+  uint32_t lastSequence = 0;
+  uint32_t oldestSequence = 0;
+  uint16_t lastBoot = 0;
+  uint8_t data[L2M_LOG_SLOT_SIZE];
+
+  _head = 0;
+  _tail = 0;
+  _pending = 0;
+
+  for (uint32_t slot = 0; slot < _slotCount; slot++) {
+    if (!readSlot(slot, data) || (data[0] != L2M_LOG_SLOT_VALID && data[0] != L2M_LOG_SLOT_ACKED)) {
+      continue;
+    }
+    uint32_t sequence = getLe32(data + 4);
+
+    if (!found || (int32_t)(sequence - lastSequence) > 0) {
+      found = true;
+      lastSequence = sequence;
+      lastBoot = data[2] | (data[3] << 8);
+      _head = (slot + 1) % _slotCount;
+    }
+    if (data[0] == L2M_LOG_SLOT_VALID) {
+      _pending++;
+      if (!pendingFound || (int32_t)(sequence - oldestSequence) < 0) {
+        pendingFound = true;
+        oldestSequence = sequence;
+        _tail = slot;
+      }
+    }
+  }
+
+  _nextSequence = found ? lastSequence + 1 : 0;
+  _boot = found ? lastBoot + 1 : 0;
+  if (!pendingFound) {
+    _tail = _head;
+  }
+
+  return true;
+}
+
+/**
+* Append a record
+* @param  time    seconds since boot
+* @param  counter counter value
+* @param  flags   compact codec flags
+* @return         false on a flash error
+*/
+bool L2MRingLog::append(uint32_t time, uint32_t counter, uint8_t flags)
+{
+  uint8_t data[L2M_LOG_SLOT_SIZE];
+
+  // find a blank slot: skip the ones programmed by a write cut by a reset
+  for (uint32_t tries = 0; ; tries++) {
+    if (tries > _slotCount) {
+      return false;
+    }
+    if (_head % _slotsPerSector == 0) {
+      releaseSector(_head / _slotsPerSector);
+    }
+    if (!readSlot(_head, data)) {
+      return false;
+    }
+    if (isBlank(data, sizeof(data))) {
+      break;
+    }
+    if (_pending == 0) {
+      _tail = (_head + 1) % _slotCount;
+    }
+    _head = (_head + 1) % _slotCount;
+  }
+
+  data[0] = L2M_LOG_SLOT_VALID;
+  data[1] = flags;
+  data[2] = _boot;
+  data[3] = _boot >> 8;
+  putLe32(data + 4, _nextSequence);
+  putLe32(data + 8, time);
+  putLe32(data + 12, counter);
+
+  // the state byte goes last, it validates the record
+  uint32_t address = slotAddress(_head);
+  if (!_flash.program(address + 1, data + 1, L2M_LOG_SLOT_SIZE - 1) || !_flash.program(address, data, 1)) {
+    return false;
+  }
+
+  if (_pending == 0) {
+    _tail = _head;
+  }
+  _pending++;
+  _nextSequence++;
+  _appended++;
+  _head = (_head + 1) % _slotCount;
+
+  return true;
+}
+
+/**
+* @return number of records not acknowledged yet
+*/
+size_t L2MRingLog::pending() const
+{
+  return _pending;
+}
+
+/**
+* Read the oldest records not acknowledged yet
+* @param  records destination
+* @param  count   maximum number of records
+* @return         number of records read
+*/
+size_t L2MRingLog::peek(L2MLogRecord* records, size_t count)
+{
+  uint8_t data[L2M_LOG_SLOT_SIZE];
+  size_t n = 0;
+  uint32_t slot = _tail;
+
+  for (uint32_t i = 0; i < _slotCount && n < count && n < _pending && slot != _head; i++) {
+    if (readSlot(slot, data) && data[0] == L2M_LOG_SLOT_VALID) {
+      records[n].flags = data[1];
+      records[n].boot = data[2] | (data[3] << 8);
+      records[n].sequence = getLe32(data + 4);
+      records[n].time = getLe32(data + 8);
+      records[n].counter = getLe32(data + 12);
+      n++;
+    }
+    slot = (slot + 1) % _slotCount;
+  }
+
+  return n;
+}
+
+/**
+* Acknowledge the records up to a sequence number, in place
+* @param  sequence last record sequence number acknowledged
+* @return          number of records acknowledged
+*/
+size_t L2MRingLog::acknowledge(uint32_t sequence)
+{
+  static const uint8_t acked = L2M_LOG_SLOT_ACKED;
+  uint8_t data[L2M_LOG_SLOT_SIZE];
+  size_t n = 0;
+
+  for (uint32_t i = 0; i < _slotCount && _pending > 0 && _tail != _head; i++) {
+    if (!readSlot(_tail, data)) {
+      break;
+    }
+    if (data[0] == L2M_LOG_SLOT_VALID) {
+      if ((int32_t)(getLe32(data + 4) - sequence) > 0) {
+        break;
+      }
+      _flash.program(slotAddress(_tail), &acked, 1);
+      _pending--;
+      n++;
+    }
+    _tail = (_tail + 1) % _slotCount;
+  }
+
+  if (_pending == 0) {
+    _tail = _head;
+  }
+
+  return n;
+}
+
+/**
+* @return the boot number stamped on the records appended since begin()
+*/
+uint16_t L2MRingLog::boot() const
+{
+  return _boot;
+}
+
+/**
+* @return minimum number of records the log holds before the oldest ones are dropped
+*/
+size_t L2MRingLog::capacity() const
+{
+  return _slotCount - _slotsPerSector;
+}
+
+/**
+* @return number of records appended since begin()
+*/
+uint32_t L2MRingLog::appendedCount() const
+{
+  return _appended;
+}
+
+/**
+* @return number of unacknowledged records overwritten since begin()
+*/
+uint32_t L2MRingLog::droppedCount() const
+{
+  return _dropped;
+}
+
+uint32_t L2MRingLog::slotAddress(uint32_t slot) const
+{
+  return (slot / _slotsPerSector) * _flash.sectorSize() + (slot % _slotsPerSector) * L2M_LOG_SLOT_SIZE;
+}
+
+bool L2MRingLog::readSlot(uint32_t slot, uint8_t* data)
+{
+  return _flash.read(slotAddress(slot), data, L2M_LOG_SLOT_SIZE);
+}
+
+void L2MRingLog::releaseSector(uint32_t sector)
+{
+  uint32_t first = sector * _slotsPerSector;
+  uint8_t data[L2M_LOG_SLOT_SIZE];
+  bool blank = true;
+
+  for (uint32_t slot = first; slot < first + _slotsPerSector && blank; slot++) {
+    blank = readSlot(slot, data) && isBlank(data, sizeof(data));
+  }
+  if (blank) {
+    return;
+  }
+
+  // the ring wrapped: the records still pending in this sector are lost
+  if (_pending > 0 && _tail / _slotsPerSector == sector) {
+    uint32_t lost = _slotsPerSector - (_tail % _slotsPerSector);
+    if (lost > _pending) {
+      lost = _pending;
+    }
+    _dropped += lost;
+    _pending -= lost;
+    _tail = (first + _slotsPerSector) % _slotCount;
+  }
+  if (_pending == 0) {
+    _tail = _head;
+  }
+
+  _flash.erase(sector);
+}
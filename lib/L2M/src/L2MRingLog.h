@@ -0,0 +1,74 @@
+#ifndef L2MRINGLOG_H
+#define L2MRINGLOG_H
+
+#include "L2MFlash.h"
+
+/**
+* Append-only ring log of uplink records in flash, for store-and-forward.
+*
+* Records are written in 16-byte slots, sector after sector. A slot is written
+* once, its state byte last so that a record cut by a reset is never seen, and
+* acknowledged in place by clearing its state byte: neither needs an erase. A
+* sector is erased only when the ring wraps onto it, so each sector is erased
+* once per (sector size / 16) records. Unacknowledged records still in that
+* sector are then dropped, oldest first.
+*
+* Slot layout:
+*   byte 0       state: 0xFF free, L2M_LOG_SLOT_VALID written, 0x00 acknowledged
+*   byte 1       flags, as in the compact codec (heading sector, mail, reed switch)
+*   bytes 2-3    boot number
+*   bytes 4-7    record sequence number
+*   bytes 8-11   time, seconds since boot
+*   bytes 12-15  counter
+*/
+
+#define L2M_LOG_SLOT_SIZE   16
+#define L2M_LOG_SLOT_FREE   0xFF
+#define L2M_LOG_SLOT_VALID  0xA5
+#define L2M_LOG_SLOT_ACKED  0x00
+
+struct L2MLogRecord {
+  uint32_t sequence;
+  uint16_t boot;
+  uint32_t time;        // seconds since boot
+  uint32_t counter;
+  uint8_t flags;
+};
+
+class L2MRingLog {
+public:
+  L2MRingLog(L2MFlash& flash);
+
+  bool begin();
+
+  bool append(uint32_t time, uint32_t counter, uint8_t flags);
+  size_t pending() const;
+  size_t peek(L2MLogRecord* records, size_t count);
+  size_t acknowledge(uint32_t sequence);
+
+  uint16_t boot() const;
+  size_t capacity() const;
+  uint32_t appendedCount() const;
+  uint32_t droppedCount() const;
+
+private:
+  uint32_t slotAddress(uint32_t slot) const;
+  bool readSlot(uint32_t slot, uint8_t* data);
+  void releaseSector(uint32_t sector);
+
+private:
+  L2MFlash& _flash;
+  uint32_t _slotsPerSector;
+  uint32_t _slotCount;
+
+  uint32_t _head;               // next slot written
+  uint32_t _tail;               // oldest unacknowledged slot
+  uint32_t _pending;            // unacknowledged records, contiguous from _tail
+  uint32_t _nextSequence;
+  uint16_t _boot;
+
+  uint32_t _appended;
+  uint32_t _dropped;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "L2MFlashSim.h"
+#include <string.h>
+
+L2MFlashSim::L2MFlashSim(size_t sectorSize, size_t sectorCount) :
+  _sectorSize(sectorSize),
+  _sectorCount(sectorCount),
+  _failAfter(-1),
+  _bytesRead(0),
+  _bytesProgrammed(0),
+  _sectorsErased(0)
+{
+  _data = new uint8_t[sectorSize * sectorCount];
+  _erases = new uint32_t[sectorCount];
+
+  memset(_data, 0xFF, sectorSize * sectorCount);
+  memset(_erases, 0, sectorCount * sizeof(uint32_t));
+}
+
+L2MFlashSim::~L2MFlashSim()
+{
+  delete[] _data;
+  delete[] _erases;
+}
+
+size_t L2MFlashSim::sectorSize()
+{
+  return _sectorSize;
+}
+
+size_t L2MFlashSim::sectorCount()
+{
+  return _sectorCount;
+}
+
+bool L2MFlashSim::read(uint32_t address, uint8_t* buffer, size_t size)
+{
+  if (address + size > _sectorSize * _sectorCount) {
+    return false;
+  }
+
+  memcpy(buffer, _data + address, size);
+  _bytesRead += size;
+
+  return true;
+}
+
+bool L2MFlashSim::program(uint32_t address, const uint8_t* buffer, size_t size)
+{
+  if (address + size > _sectorSize * _sectorCount) {
+    return false;
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    if (_failAfter == 0) {
+      // reset in the middle of the write
+      _failAfter = -1;
+      return false;
+    }
+    if (_failAfter > 0) {
+      _failAfter--;
+    }
+
+    // NOR flash: programming only clears bits
+    _data[address + i] &= buffer[i];
+    _bytesProgrammed++;
+  }
+
+  return true;
+}
+
+bool L2MFlashSim::erase(uint32_t sector)
+{
+  if (sector >= _sectorCount) {
+    return false;
+  }
+
+  memset(_data + sector * _sectorSize, 0xFF, _sectorSize);
+  _erases[sector]++;
+  _sectorsErased++;
+
+  return true;
+}
+
+void L2MFlashSim::failProgramAfter(size_t bytes)
+{
+  _failAfter = bytes;
+}
+
+uint32_t L2MFlashSim::bytesRead() const
+{
+  return _bytesRead;
+}
+
+uint32_t L2MFlashSim::bytesProgrammed() const
+{
+  return _bytesProgrammed;
+}
+
+uint32_t L2MFlashSim::sectorsErased() const
+{
+  return _sectorsErased;
+}
+
+uint32_t L2MFlashSim::maxSectorErases() const
+{
+  uint32_t max = 0;
+
+  for (size_t i = 0; i < _sectorCount; i++) {
+    if (_erases[i] > max) {
+      max = _erases[i];
+    }
+  }
+
+  return max;
+}
@@ -0,0 +1,47 @@
+#ifndef L2MFLASHSIM_H
+#define L2MFLASHSIM_H
+
+#include <L2MFlash.h>
+
+/**
+* RAM model of a NOR flash area, to run the store-and-forward log on a host.
+*
+* Modelled: erased state 0xFF, programming that can only clear bits (a program
+* over non erased bytes ANDs them, as the real part does), sector erase, and the
+* counters needed to measure write amplification and wear: bytes programmed,
+* sectors erased, erase count of the most worn sector.
+*/
+class L2MFlashSim : public L2MFlash {
+public:
+  L2MFlashSim(size_t sectorSize = 4096, size_t sectorCount = 8);
+  virtual ~L2MFlashSim();
+
+  // L2MFlash
+  virtual size_t sectorSize();
+  virtual size_t sectorCount();
+  virtual bool read(uint32_t address, uint8_t* buffer, size_t size);
+  virtual bool program(uint32_t address, const uint8_t* buffer, size_t size);
+  virtual bool erase(uint32_t sector);
+
+  // simulation control: the next program stops after `bytes` bytes, like a reset would
+  void failProgramAfter(size_t bytes);
+
+  // inspection
+  uint32_t bytesRead() const;
+  uint32_t bytesProgrammed() const;
+  uint32_t sectorsErased() const;
+  uint32_t maxSectorErases() const;
+
+private:
+  size_t _sectorSize;
+  size_t _sectorCount;
+  uint8_t* _data;
+  uint32_t* _erases;
+
+  long _failAfter;
+  uint32_t _bytesRead;
+  uint32_t _bytesProgrammed;
+  uint32_t _sectorsErased;
+};
+
+#endif
@@ -0,0 +1,509 @@
+#include "SX1276Sim.h"
+#include <string.h>
+#include <math.h>
+
+// registers
+#define REG_FIFO                 0x00
+#define REG_OP_MODE              0x01
+#define REG_FIFO_ADDR_PTR        0x0d
+#define REG_FIFO_TX_BASE_ADDR    0x0e
+#define REG_FIFO_RX_BASE_ADDR    0x0f
+#define REG_FIFO_RX_CURRENT_ADDR 0x10
+#define REG_IRQ_FLAGS            0x12
+#define REG_RX_NB_BYTES          0x13
+#define REG_PKT_SNR_VALUE        0x19
+#define REG_PKT_RSSI_VALUE       0x1a
+#define REG_MODEM_CONFIG_1       0x1d
+#define REG_MODEM_CONFIG_2       0x1e
+#define REG_SYMB_TIMEOUT_LSB     0x1f
+#define REG_PREAMBLE_MSB         0x20
+#define REG_PREAMBLE_LSB         0x21
+#define REG_PAYLOAD_LENGTH       0x22
+#define REG_MODEM_CONFIG_3       0x26
+#define REG_RSSI_WIDEBAND        0x2c
+#define REG_DIO_MAPPING_1        0x40
+#define REG_VERSION              0x42
+
+// modes
+#define MODE_MASK                0x07
+#define MODE_STDBY               0x01
+#define MODE_TX                  0x03
+#define MODE_RX_CONTINUOUS       0x05
+#define MODE_RX_SINGLE           0x06
+
+// IRQ masks
+#define IRQ_TX_DONE_MASK           0x08
+#define IRQ_VALID_HEADER_MASK      0x10
+#define IRQ_PAYLOAD_CRC_ERROR_MASK 0x20
+#define IRQ_RX_DONE_MASK           0x40
+#define IRQ_RX_TIMEOUT_MASK        0x80
+
+// SPI clock: 8 bits at 8 MHz
+#define SPI_BYTE_TIME_US         1
+
+SX1276Sim::SX1276Sim() :
+  _selected(false),
+  _addressPhase(false),
+  _writeAccess(false),
+  _address(0),
+  _dio0Isr(NULL),
+  _dio0Pending(false),
+  _inIsr(false),
+  _now(0),
+  _txPending(false),
+  _txDoneAt(0),
+  _rxTimeoutPending(false),
+  _rxTimeoutAt(0),
+  _rxPending(false),
+  _rxHeaderPending(false),
+  _rxHeaderAt(0),
+  _rxDoneAt(0),
+  _rxPacketLength(0),
+  _rxSnr(0),
+  _rxRssi(0),
+  _txPayloadLength(0),
+  _txPackets(0),
+  _lastTimeOnAir(0),
+  _spiTransactions(0),
+  _spiBytes(0),
+  _rxTimeouts(0),
+  _random(0x2545F491)
+{
+  memset(_fifo, 0, sizeof(_fifo));
+  memset(_txPayload, 0, sizeof(_txPayload));
+  memset(_rxPacket, 0, sizeof(_rxPacket));
+  reset();
+}
+
+void SX1276Sim::begin()
+{
+}
+
+void SX1276Sim::end()
+{
+}
+
+void SX1276Sim::reset()
+{
+  memset(_regs, 0, sizeof(_regs));
+
+  // reset values (SX1276 datasheet, table 41)
+  _regs[REG_OP_MODE] = 0x09;
+  _regs[0x06] = 0x6c;
+  _regs[0x07] = 0x80;
+  _regs[0x08] = 0x00;
+  _regs[0x09] = 0x4f;
+  _regs[0x0b] = 0x2b;
+  _regs[0x0c] = 0x20;
+  _regs[REG_FIFO_TX_BASE_ADDR] = 0x80;
+  _regs[REG_MODEM_CONFIG_1] = 0x72;
+  _regs[REG_MODEM_CONFIG_2] = 0x70;
+  _regs[REG_SYMB_TIMEOUT_LSB] = 0x64;
+  _regs[REG_PREAMBLE_LSB] = 0x08;
+  _regs[REG_PAYLOAD_LENGTH] = 0x01;
+  _regs[REG_MODEM_CONFIG_3] = 0x04;
+  _regs[0x31] = 0xc3;
+  _regs[0x33] = 0x27;
+  _regs[0x37] = 0x0a;
+  _regs[0x39] = 0x12;
+  _regs[0x3b] = 0x1d;
+  _regs[REG_VERSION] = 0x12;
+  _regs[0x4d] = 0x84;
+
+  _txPending = false;
+  _rxTimeoutPending = false;
+  _rxPending = false;
+  _dio0Pending = false;
+}
+
+void SX1276Sim::select()
+{
+  _selected = true;
+  _addressPhase = true;
+  _spiTransactions++;
+}
+
+void SX1276Sim::deselect()
+{
+  _selected = false;
+
+  // an interrupt raised during the transaction is delivered once the bus is released
+  fireDio0();
+}
+
+uint8_t SX1276Sim::transfer(uint8_t value)
+{
+  tick(SPI_BYTE_TIME_US);
+  _spiBytes++;
+
+  if (_addressPhase) {
+    _addressPhase = false;
+    _writeAccess = (value & 0x80) != 0;
+    _address = value & 0x7f;
+    return 0x00;
+  }
+
+  uint8_t response = 0x00;
+
+  if (_writeAccess) {
+    writeRegister(_address, value);
+  } else {
+    response = readRegister(_address);
+  }
+
+  // burst access: the address auto increments, except for the FIFO
+  if (_address != REG_FIFO) {
+    _address = (_address + 1) & 0x7f;
+  }
+
+  return response;
+}
+
+void SX1276Sim::write(const uint8_t* buffer, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    transfer(buffer[i]);
+  }
+}
+
+void SX1276Sim::read(uint8_t* buffer, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    buffer[i] = transfer(0x00);
+  }
+}
+
+void SX1276Sim::attachDio0(void (*isr)())
+{
+  _dio0Isr = isr;
+}
+
+void SX1276Sim::detachDio0()
+{
+  _dio0Isr = NULL;
+}
+
+void SX1276Sim::delayMicroseconds(uint32_t us)
+{
+  advance(us);
+}
+
+unsigned long SX1276Sim::micros()
+{
+  return _now;
+}
+
+unsigned long SX1276Sim::millis()
+{
+  return _now / 1000;
+}
+
+void SX1276Sim::yield()
+{
+  advance(1);
+}
+
+void SX1276Sim::advance(uint32_t us)
+{
+  tick(us);
+  fireDio0();
+}
+
+bool SX1276Sim::injectPacket(const uint8_t* data, uint8_t length, int8_t snrQuarterDb, uint8_t rssiValue, bool crcError)
+{
+  uint8_t mode = opMode();
+
+  if (mode != MODE_RX_CONTINUOUS && mode != MODE_RX_SINGLE) {
+    // the radio is not listening, the packet is lost
+    return false;
+  }
+
+  receivePacket(data, length, snrQuarterDb, rssiValue, crcError);
+  if (!_selected) {
+    fireDio0();
+  }
+
+  return true;
+}
+
+bool SX1276Sim::startPacket(const uint8_t* data, uint8_t length, int8_t snrQuarterDb, uint8_t rssiValue)
+{
+  uint8_t mode = opMode();
+
+  if ((mode != MODE_RX_CONTINUOUS && mode != MODE_RX_SINGLE) || _rxPending) {
+    // the radio is not listening, the packet is lost
+    return false;
+  }
+
+  memcpy(_rxPacket, data, length);
+  _rxPacketLength = length;
+  _rxSnr = snrQuarterDb;
+  _rxRssi = rssiValue;
+
+  // the preamble is detected: a single window no longer times out. The explicit header
+  // follows the preamble (the first 8 symbols), RxDone comes after the time on air
+  uint16_t preambleLength = (_regs[REG_PREAMBLE_MSB] << 8) | _regs[REG_PREAMBLE_LSB];
+  uint32_t tSym = symbolTime(_regs[REG_MODEM_CONFIG_1], _regs[REG_MODEM_CONFIG_2]);
+  _rxTimeoutPending = false;
+  _rxHeaderAt = _now + (uint32_t)((preambleLength + 4.25 + 8) * tSym);
+  _rxDoneAt = _now + timeOnAir(_regs[REG_MODEM_CONFIG_1], _regs[REG_MODEM_CONFIG_2], _regs[REG_MODEM_CONFIG_3],
+                               preambleLength, length);
+  _rxHeaderPending = true;
+  _rxPending = true;
+
+  return true;
+}
+
+uint8_t SX1276Sim::registerValue(uint8_t address) const
+{
+  return _regs[address & 0x7f];
+}
+
+const uint8_t* SX1276Sim::txPayload() const
+{
+  return _txPayload;
+}
+
+uint8_t SX1276Sim::txPayloadLength() const
+{
+  return _txPayloadLength;
+}
+
+uint32_t SX1276Sim::txPacketCount() const
+{
+  return _txPackets;
+}
+
+uint32_t SX1276Sim::lastTimeOnAir() const
+{
+  return _lastTimeOnAir;
+}
+
+uint32_t SX1276Sim::spiTransactionCount() const
+{
+  return _spiTransactions;
+}
+
+uint32_t SX1276Sim::spiByteCount() const
+{
+  return _spiBytes;
+}
+
+uint32_t SX1276Sim::rxTimeoutCount() const
+{
+  return _rxTimeouts;
+}
+
+bool SX1276Sim::isReceiving() const
+{
+  uint8_t mode = opMode();
+
+  return mode == MODE_RX_CONTINUOUS || mode == MODE_RX_SINGLE;
+}
+
+uint32_t SX1276Sim::symbolTime(uint8_t modemConfig1, uint8_t modemConfig2)
+{
+  static const double bandwidths[] = { 7.8E3, 10.4E3, 15.6E3, 20.8E3, 31.25E3, 41.7E3, 62.5E3, 125E3, 250E3, 500E3 };
+
+  uint8_t bwIndex = modemConfig1 >> 4;
+  int sf = modemConfig2 >> 4;
+
+  return (uint32_t)((double)(1L << sf) * 1E6 / bandwidths[bwIndex < 10 ? bwIndex : 9]);
+}
+
+uint32_t SX1276Sim::timeOnAir(uint8_t modemConfig1, uint8_t modemConfig2, uint8_t modemConfig3,
+                              uint16_t preambleLength, uint8_t payloadLength)
+{
+  static const double bandwidths[] = { 7.8E3, 10.4E3, 15.6E3, 20.8E3, 31.25E3, 41.7E3, 62.5E3, 125E3, 250E3, 500E3 };
+
+  uint8_t bwIndex = modemConfig1 >> 4;
+  double bw = bandwidths[bwIndex < 10 ? bwIndex : 9];
+  int cr = (modemConfig1 >> 1) & 0x07;
+  int ih = modemConfig1 & 0x01;
+  int sf = modemConfig2 >> 4;
+  int crc = (modemConfig2 >> 2) & 0x01;
+  int de = (modemConfig3 >> 3) & 0x01;
+
+  // SX1276 datasheet, 4.1.1.7 Time on air
+  double tSym = (double)(1L << sf) / bw;
+  double tPreamble = (preambleLength + 4.25) * tSym;
+  double payloadSymbols = ceil((8.0 * payloadLength - 4.0 * sf + 28 + 16 * crc - 20 * ih) / (4.0 * (sf - 2 * de))) * (cr + 4);
+  if (payloadSymbols < 0) {
+    payloadSymbols = 0;
+  }
+  payloadSymbols += 8;
+
+  return (uint32_t)((tPreamble + payloadSymbols * tSym) * 1E6);
+}
+
+void SX1276Sim::receivePacket(const uint8_t* data, uint8_t length, int8_t snrQuarterDb, uint8_t rssiValue, bool crcError)
+{
+  uint8_t base = _regs[REG_FIFO_RX_BASE_ADDR];
+  for (uint8_t i = 0; i < length; i++) {
+    _fifo[(uint8_t)(base + i)] = data[i];
+  }
+
+  _regs[REG_FIFO_RX_CURRENT_ADDR] = base;
+  _regs[REG_RX_NB_BYTES] = length;
+  _regs[REG_PKT_SNR_VALUE] = (uint8_t)snrQuarterDb;
+  _regs[REG_PKT_RSSI_VALUE] = rssiValue;
+
+  if (opMode() == MODE_RX_SINGLE) {
+    // the preamble was detected within the window, the radio is done once the packet is in
+    setOpMode((_regs[REG_OP_MODE] & ~MODE_MASK) | MODE_STDBY);
+  }
+
+  setIrq(crcError ? (IRQ_RX_DONE_MASK | IRQ_PAYLOAD_CRC_ERROR_MASK) : IRQ_RX_DONE_MASK);
+}
+
+uint8_t SX1276Sim::opMode() const
+{
+  return _regs[REG_OP_MODE] & MODE_MASK;
+}
+
+void SX1276Sim::setOpMode(uint8_t mode)
+{
+  _regs[REG_OP_MODE] = mode;
+
+  if ((mode & MODE_MASK) == MODE_TX) {
+    // the packet is taken from FifoTxBaseAddr, PayloadLength bytes long
+    _txPayloadLength = _regs[REG_PAYLOAD_LENGTH];
+    for (uint8_t i = 0; i < _txPayloadLength; i++) {
+      _txPayload[i] = _fifo[(uint8_t)(_regs[REG_FIFO_TX_BASE_ADDR] + i)];
+    }
+
+    _lastTimeOnAir = timeOnAir(_regs[REG_MODEM_CONFIG_1], _regs[REG_MODEM_CONFIG_2], _regs[REG_MODEM_CONFIG_3],
+                               (_regs[REG_PREAMBLE_MSB] << 8) | _regs[REG_PREAMBLE_LSB], _txPayloadLength);
+    _txDoneAt = _now + _lastTimeOnAir;
+    _txPending = true;
+  } else {
+    _txPending = false;
+  }
+
+  if ((mode & MODE_MASK) != MODE_RX_CONTINUOUS && (mode & MODE_MASK) != MODE_RX_SINGLE) {
+    // the radio stopped listening, a packet on air is lost
+    _rxPending = false;
+  }
+
+  if ((mode & MODE_MASK) == MODE_RX_SINGLE) {
+    // RxTimeout unless a preamble shows up within SymbTimeout symbols
+    uint16_t symbols = ((_regs[REG_MODEM_CONFIG_2] & 0x03) << 8) | _regs[REG_SYMB_TIMEOUT_LSB];
+    _rxTimeoutAt = _now + symbols * symbolTime(_regs[REG_MODEM_CONFIG_1], _regs[REG_MODEM_CONFIG_2]);
+    _rxTimeoutPending = true;
+  } else {
+    _rxTimeoutPending = false;
+  }
+}
+
+void SX1276Sim::setIrq(uint8_t mask)
+{
+  _regs[REG_IRQ_FLAGS] |= mask;
+
+  uint8_t mapped;
+  switch (_regs[REG_DIO_MAPPING_1] >> 6) {
+    case 0: mapped = IRQ_RX_DONE_MASK; break;
+    case 1: mapped = IRQ_TX_DONE_MASK; break;
+    default: mapped = 0; break;
+  }
+
+  if (mask & mapped) {
+    _dio0Pending = true;
+  }
+}
+
+void SX1276Sim::fireDio0()
+{
+  if (!_dio0Pending || _inIsr || _selected) {
+    return;
+  }
+
+  _dio0Pending = false;
+
+  if (_dio0Isr) {
+    _inIsr = true;
+    _dio0Isr();
+    _inIsr = false;
+  }
+}
+
+void SX1276Sim::writeRegister(uint8_t address, uint8_t value)
+{
+  switch (address) {
+    case REG_FIFO:
+      _fifo[_regs[REG_FIFO_ADDR_PTR]++] = value;
+      break;
+
+    case REG_OP_MODE:
+      setOpMode(value);
+      break;
+
+    case REG_IRQ_FLAGS:
+      // write 1 to clear
+      _regs[REG_IRQ_FLAGS] &= ~value;
+      break;
+
+    case REG_FIFO_RX_CURRENT_ADDR:
+    case REG_RX_NB_BYTES:
+    case REG_PKT_SNR_VALUE:
+    case REG_PKT_RSSI_VALUE:
+    case REG_RSSI_WIDEBAND:
+    case REG_VERSION:
+      // read only
+      break;
+
+    default:
+      _regs[address] = value;
+      break;
+  }
+}
+
+uint8_t SX1276Sim::readRegister(uint8_t address)
+{
+  switch (address) {
+    case REG_FIFO:
+      return _fifo[_regs[REG_FIFO_ADDR_PTR]++];
+
+    case REG_RSSI_WIDEBAND:
+      // xorshift, stands in for the wideband RSSI noise
+      _random ^= _random << 13;
+      _random ^= _random >> 17;
+      _random ^= _random << 5;
+      return (uint8_t)_random;
+
+    default:
+      return _regs[address];
+  }
+}
+
+void SX1276Sim::tick(uint32_t us)
+{
+  _now += us;
+
+  if (_txPending && (long)(_now - _txDoneAt) >= 0) {
+    _txPending = false;
+    _txPackets++;
+
+    // back to standby once the packet is sent
+    _regs[REG_OP_MODE] = (_regs[REG_OP_MODE] & ~MODE_MASK) | MODE_STDBY;
+    setIrq(IRQ_TX_DONE_MASK);
+  }
+
+  if (_rxTimeoutPending && (long)(_now - _rxTimeoutAt) >= 0) {
+    _rxTimeoutPending = false;
+    _rxTimeouts++;
+
+    // nothing detected, back to standby
+    _regs[REG_OP_MODE] = (_regs[REG_OP_MODE] & ~MODE_MASK) | MODE_STDBY;
+    setIrq(IRQ_RX_TIMEOUT_MASK);
+  }
+
+  if (_rxPending && _rxHeaderPending && (long)(_now - _rxHeaderAt) >= 0) {
+    _rxHeaderPending = false;
+    setIrq(IRQ_VALID_HEADER_MASK);
+  }
+
+  if (_rxPending && (long)(_now - _rxDoneAt) >= 0) {
+    _rxPending = false;
+    receivePacket(_rxPacket, _rxPacketLength, _rxSnr, _rxRssi, false);
+  }
+}
@@ -0,0 +1,107 @@
+#ifndef SX1276SIM_H
+#define SX1276SIM_H
+
+#include <LoRaTransport.h>
+
+/**
+* Register level model of a SX1276 in LoRa mode, to run LoRaClass on a host.
+* Inject it with LoRa.setTransport(sim) before LoRa.begin().
+*
+* Modelled: register file with reset values, SPI single and burst access (address
+* auto increment, FIFO access through RegFifoAddrPtr), op modes, IRQ flags (write 1
+* to clear), DIO0 mapping (RxDone / TxDone), payload length and TxDone raised after
+* the time on air computed from the modem settings (SX1276 datasheet 4.1.1.7), the
+* RxTimeout of single receive windows after SymbTimeout symbols, and packets on air
+* (startPacket()): preamble detection, ValidHeader, then RxDone.
+*
+* Time is virtual: it only moves with delayMicroseconds(), advance() and the SPI
+* traffic itself (one microsecond per transferred byte, i.e. a 8 MHz bus).
+*/
+class SX1276Sim : public LoRaTransport {
+public:
+  SX1276Sim();
+
+  // LoRaTransport
+  virtual void begin();
+  virtual void end();
+  virtual void reset();
+  virtual void select();
+  virtual void deselect();
+  virtual uint8_t transfer(uint8_t value);
+  virtual void write(const uint8_t* buffer, size_t size);
+  virtual void read(uint8_t* buffer, size_t size);
+  virtual void attachDio0(void (*isr)());
+  virtual void detachDio0();
+  virtual void delayMicroseconds(uint32_t us);
+  virtual unsigned long micros();
+  virtual unsigned long millis();
+  virtual void yield();
+
+  // simulation control
+  void advance(uint32_t us);
+  bool injectPacket(const uint8_t* data, uint8_t length, int8_t snrQuarterDb = 40, uint8_t rssiValue = 100, bool crcError = false);
+  bool startPacket(const uint8_t* data, uint8_t length, int8_t snrQuarterDb = 40, uint8_t rssiValue = 100);
+
+  // inspection
+  uint8_t registerValue(uint8_t address) const;
+  const uint8_t* txPayload() const;
+  uint8_t txPayloadLength() const;
+  uint32_t txPacketCount() const;
+  uint32_t lastTimeOnAir() const;
+  uint32_t spiTransactionCount() const;
+  uint32_t spiByteCount() const;
+  uint32_t rxTimeoutCount() const;
+  bool isReceiving() const;
+
+  static uint32_t symbolTime(uint8_t modemConfig1, uint8_t modemConfig2);
+  static uint32_t timeOnAir(uint8_t modemConfig1, uint8_t modemConfig2, uint8_t modemConfig3,
+                            uint16_t preambleLength, uint8_t payloadLength);
+
+private:
+  uint8_t opMode() const;
+  void setOpMode(uint8_t mode);
+  void setIrq(uint8_t mask);
+  void fireDio0();
+  void receivePacket(const uint8_t* data, uint8_t length, int8_t snrQuarterDb, uint8_t rssiValue, bool crcError);
+  void writeRegister(uint8_t address, uint8_t value);
+  uint8_t readRegister(uint8_t address);
+  void tick(uint32_t us);
+
+private:
+  uint8_t _regs[128];
+  uint8_t _fifo[256];
+
+  bool _selected;
+  bool _addressPhase;
+  bool _writeAccess;
+  uint8_t _address;
+
+  void (*_dio0Isr)();
+  bool _dio0Pending;
+  bool _inIsr;
+
+  unsigned long _now;
+  bool _txPending;
+  unsigned long _txDoneAt;
+  bool _rxTimeoutPending;
+  unsigned long _rxTimeoutAt;
+  bool _rxPending;
+  bool _rxHeaderPending;
+  unsigned long _rxHeaderAt;
+  unsigned long _rxDoneAt;
+  uint8_t _rxPacket[256];
+  uint8_t _rxPacketLength;
+  int8_t _rxSnr;
+  uint8_t _rxRssi;
+
+  uint8_t _txPayload[256];
+  uint8_t _txPayloadLength;
+  uint32_t _txPackets;
+  uint32_t _lastTimeOnAir;
+  uint32_t _spiTransactions;
+  uint32_t _spiBytes;
+  uint32_t _rxTimeouts;
+  uint32_t _random;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include <CompassSensor.h>
+#include <Wire.h>
+#include <L2MCodec.h>
+
+#define DEBUG_ESP_PORT Serial
+#ifdef DEBUG_ESP_PORT
+#define DEBUG_MSG(...) DEBUG_ESP_PORT.printf( __VA_ARGS__ )
+#else
+#define DEBUG_MSG(...)
+#endif
+
+/**
+* CompassSensor Constructor
+*/
+CompassSensor::CompassSensor() :
+  calibrating(false),
+  calibCounter(0)
+{
+
+}
+
+const char* CompassSensor::Name()
+{
+  return "compass";
+}
+
+/**
+* Start the I2C bus and the compass
+*/
+void CompassSensor::Setup()
+{
+  Wire.begin();
+  compass.init();
+  compass.setSamplingRate(50);
+}
+
+/**
+* Read the heading, calibrating the compass meanwhile if a calibration is running
+* @param reading the heading
+* @param sample  heading and raw magnetic field of the binary sample
+*/
+void CompassSensor::Sample(Reading& reading, L2MSample& sample)
+{
+  int16_t x,y,z,t;
+  compass.readRaw(&x,&y,&z,&t);
+  DEBUG_MSG("x: %i",x);
+  DEBUG_MSG("    y: %i",y);
+  DEBUG_MSG("    z: %i",z);
+  int heading = 0;
+  if (calibrating)
+  {
+    DEBUG_MSG(" calibrating ... ");
+    calibCounter++;
+    heading = compass.readHeadingAndCalibrate();
+    // if more than COMPASS_CALIBRATION_CYCLES calibration cycles, stop calibration
+    if (calibCounter > COMPASS_CALIBRATION_CYCLES)
+    {
+      calibCounter = 0;
+      calibrating = false;
+      compass.saveCalibrationSettings();
+    }
+  }
+  else
+  {
+    DEBUG_MSG(" ... ");
+    heading = compass.readHeading();
+  }
+  reading.heading = heading;
+  sample.heading = heading;
+  sample.x = x;
+  sample.y = y;
+  sample.z = z;
+}
+
+/**
+* Add the heading to the JSON uplink
+* @param reading the heading
+* @param payload the JSON payload
+*/
+void CompassSensor::Encode(const Reading& reading, JsonDocument& payload)
+{
+  payload["heading"] = L2MHeadingName(L2MHeadingSector(reading.heading));
+}
+
+/**
+* Find a calibration command in a downlink
+* @param  payload the JSON downlink
+* @param  value   1 to start a calibration, 0 to stop it
+* @return         true if the downlink carries a calibration command
+*/
+bool CompassSensor::Decode(JsonDocument& payload, int32_t& value)
+{
+  // other downlinks (e.g. radio settings) leave the calibration alone
+  if (payload["calibration"].isNull())
+  {
+    return false;
+  }
+  bool calibration = payload["calibration"];
+  value = calibration;
+  return true;
+}
+
+/**
+* Start or stop a calibration
+* @param value 1 to start a calibration, 0 to stop it
+*/
+void CompassSensor::Run(int32_t value)
+{
+  calibrating = (value != 0);
+  compass.resetCalibration();
+}
+
+/**
+* @return true while a calibration is running
+*/
+bool CompassSensor::IsCalibrating()
+{
+  return calibrating;
+}
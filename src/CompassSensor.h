@@ -0,0 +1,40 @@
+#ifndef COMPASSSENSOR_H
+#define COMPASSSENSOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <L2MBatch.h>
+#include <QMC5883L.h>
+
+// a calibration lasts COMPASS_CALIBRATION_CYCLES processings
+#define COMPASS_CALIBRATION_CYCLES 20
+
+/**
+* QMC5883L compass (GY-271 board), on the first I2C controller: heading and raw magnetic field.
+* Sensor of the node sensor list, see SensorList.
+* Uplink field "heading" (name of the heading sector); downlink command {"calibration":true}
+*/
+class CompassSensor
+{
+  public:
+    struct Reading
+    {
+      int16_t heading;            // degrees
+    };
+
+    CompassSensor();
+    static const char* Name();
+    void Setup();
+    void Sample(Reading& reading, L2MSample& sample);
+    static void Encode(const Reading& reading, JsonDocument& payload);
+    static bool Decode(JsonDocument& payload, int32_t& value);
+    void Run(int32_t value);
+    bool IsCalibrating();
+
+  private:
+    QMC5883L compass;
+    bool calibrating;
+    int calibCounter;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include <DallasSensor.h>
+
+#define DEBUG_ESP_PORT Serial
+#ifdef DEBUG_ESP_PORT
+#define DEBUG_MSG(...) DEBUG_ESP_PORT.printf( __VA_ARGS__ )
+#else
+#define DEBUG_MSG(...)
+#endif
+
+/**
+* DallasSensor Constructor
+*/
+DallasSensor::DallasSensor() :
+  oneWire(DALLAS_ONE_WIRE_PIN),
+  probes(&oneWire),
+  found(false),
+  requested(false)
+{
+  last.temperature = 0;
+  last.valid = false;
+}
+
+const char* DallasSensor::Name()
+{
+  return "dallas";
+}
+
+/**
+* Find the probe on the 1-Wire bus
+*/
+void DallasSensor::Setup()
+{
+  probes.begin();
+  found = probes.getAddress(address, 0);
+  if (!found)
+  {
+    DEBUG_MSG("dallas: no probe on pin %d\n", DALLAS_ONE_WIRE_PIN);
+    return;
+  }
+  probes.setResolution(address, DALLAS_RESOLUTION);
+  probes.setWaitForConversion(false);
+}
+
+/**
+* Read the last conversion once complete, and start the next one
+* @param reading the temperature, invalid while no conversion succeeded
+* @param sample  the binary sample, the batch codec has no temperature field
+*/
+void DallasSensor::Sample(Reading& reading, L2MSample& sample)
+{
+  if (found)
+  {
+    if (requested && probes.isConversionComplete())
+    {
+      int16_t raw = probes.getTemp(address);
+      last.valid = (raw != DEVICE_DISCONNECTED_RAW);
+      // raw in 1/128 degree C
+      last.temperature = (int32_t)raw * 100 / 128;
+      requested = false;
+    }
+    if (!requested)
+    {
+      requested = probes.requestTemperaturesByAddress(address);
+    }
+  }
+  reading = last;
+  if (last.valid)
+  {
+    DEBUG_MSG("dallas: %.2f C\n", last.temperature / 100.0);
+  }
+}
+
+/**
+* Add the temperature to the JSON uplink, if any
+* @param reading the temperature
+* @param payload the JSON payload
+*/
+void DallasSensor::Encode(const Reading& reading, JsonDocument& payload)
+{
+  if (reading.valid)
+  {
+    payload["temperature"] = reading.temperature / 100.0;
+  }
+}
+
+/**
+* Find a resolution command in a downlink
+* @param  payload the JSON downlink
+* @param  value   the resolution, bits
+* @return         true if the downlink carries a valid resolution
+*/
+bool DallasSensor::Decode(JsonDocument& payload, int32_t& value)
+{
+  if (payload["temp_resolution"].isNull())
+  {
+    return false;
+  }
+  value = payload["temp_resolution"];
+  return (value >= 9) && (value <= 12);
+}
+
+/**
+* Change the resolution, a longer conversion for more bits (94 ms at 9 bits to 750 ms at 12 bits)
+* @param value the resolution, bits
+*/
+void DallasSensor::Run(int32_t value)
+{
+  if (found)
+  {
+    probes.setResolution(address, value);
+  }
+}
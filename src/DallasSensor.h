@@ -0,0 +1,47 @@
+#ifndef DALLASSENSOR_H
+#define DALLASSENSOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <L2MBatch.h>
+#include <OneWire.h>
+#include <DallasTemperature.h>
+
+// 1-Wire bus of the temperature probe, and default resolution (9 to 12 bits)
+#define DALLAS_ONE_WIRE_PIN 17
+#define DALLAS_RESOLUTION 12
+
+/**
+* Dallas DS18B20 temperature probe, first device of the 1-Wire bus. Conversions do not block:
+* each processing reads the conversion started by the previous one, and starts the next one.
+* Sensor of the node sensor list, see SensorList.
+* Uplink field "temperature" (degrees C, absent while no probe answers); downlink command
+* {"temp_resolution":9} to 12
+*/
+class DallasSensor
+{
+  public:
+    struct Reading
+    {
+      int16_t temperature;        // hundredths of degree C
+      bool valid;
+    };
+
+    DallasSensor();
+    static const char* Name();
+    void Setup();
+    void Sample(Reading& reading, L2MSample& sample);
+    static void Encode(const Reading& reading, JsonDocument& payload);
+    static bool Decode(JsonDocument& payload, int32_t& value);
+    void Run(int32_t value);
+
+  private:
+    OneWire oneWire;
+    DallasTemperature probes;
+    DeviceAddress address;
+    bool found;
+    bool requested;             // a conversion is running
+    Reading last;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#include <EepromLock.h>
+
+// guards the creation of the mutex, on the first lock from either core
+static portMUX_TYPE eepromLockMux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t eepromMutex = NULL;
+
+/**
+* Take the lock, blocks until the other task is done with the EEPROM
+*/
+EepromLock::EepromLock()
+{
+  if (eepromMutex == NULL)
+  {
+    SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+    portENTER_CRITICAL(&eepromLockMux);
+    if (eepromMutex == NULL)
+    {
+      eepromMutex = mutex;
+      mutex = NULL;
+    }
+    portEXIT_CRITICAL(&eepromLockMux);
+    if (mutex != NULL)
+    {
+      // created by the other core in the meantime
+      vSemaphoreDelete(mutex);
+    }
+  }
+  xSemaphoreTake(eepromMutex, portMAX_DELAY);
+}
+
+/**
+* Release the lock
+*/
+EepromLock::~EepromLock()
+{
+  xSemaphoreGive(eepromMutex);
+}
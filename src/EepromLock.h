@@ -0,0 +1,25 @@
+#ifndef EEPROMLOCK_H
+#define EEPROMLOCK_H
+
+#include <Arduino.h>
+
+/**
+* Scoped lock of the EEPROM emulation. The compass calibration (QMC5883L, app task on
+* core 1) and the node settings (NodeSettings, radio task on core 0) share one RAM
+* buffer, committed to flash as a whole: each begin/get/put/commit sequence holds the
+* lock for its whole duration.
+* A FreeRTOS mutex, not a spinlock: a commit erases and writes flash for milliseconds.
+* Not for interrupts.
+*/
+class EepromLock
+{
+  public:
+    EepromLock();
+    ~EepromLock();
+
+  private:
+    EepromLock(const EepromLock&);
+    EepromLock& operator=(const EepromLock&);
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include <LineDisplay.h>
+
+// bytes sent to the panel, counted in place of the u8x8 byte callback (one panel)
+static u8x8_msg_cb panelByteCallback = NULL;
+static unsigned long panelBytes = 0;
+
+static uint8_t countPanelBytes(u8x8_t* u8x8, uint8_t msg, uint8_t arg_int, void* arg_ptr)
+{
+  if (msg == U8X8_MSG_BYTE_SEND)
+  {
+    panelBytes += arg_int;
+  }
+  return panelByteCallback(u8x8, msg, arg_int, arg_ptr);
+}
+
+// u8x8 font layout: first and last character, glyph width and height in tiles, then 8 bytes per tile
+#define U8X8_FONT_HEADER_SIZE 4
+
+/**
+* LineDisplay Constructor
+* @param u8x8 the panel, started with begin()
+*/
+LineDisplay::LineDisplay(U8X8& u8x8) :
+  u8x8(u8x8),
+  font(NULL),
+  used(0),
+  dirty(0),
+  tilesDrawn(0)
+{
+  memset(text, ' ', sizeof(text));
+  memset(rendered, ' ', sizeof(rendered));
+}
+
+/**
+* Set the font and start counting the bytes sent to the panel. To be invoked once, after
+* u8x8.begin(), which clears the panel
+* @param font u8x8 font with glyphs of one tile (8x8)
+*/
+void LineDisplay::Begin(const uint8_t* font)
+{
+  this->font = font;
+  u8x8.setFont(font);
+  u8x8_t* u8x8_struct = u8x8.getU8x8();
+  if (u8x8_struct->byte_cb != countPanelBytes)
+  {
+    panelByteCallback = u8x8_struct->byte_cb;
+    u8x8_struct->byte_cb = countPanelBytes;
+  }
+}
+
+/**
+* Set the text of a row, drawn by the next Render if it changed
+* @param row  row, 0 to LINE_DISPLAY_ROWS - 1
+* @param text the text, cut to LINE_DISPLAY_COLUMNS characters, NULL for an empty row
+*/
+void LineDisplay::SetLine(uint8_t row, const char* text)
+{
+  if (row >= LINE_DISPLAY_ROWS)
+  {
+    return;
+  }
+  char line[LINE_DISPLAY_COLUMNS];
+  uint8_t i = 0;
+  for (; text && text[i] && (i < LINE_DISPLAY_COLUMNS); i++)
+  {
+    line[i] = text[i];
+  }
+  memset(line + i, ' ', LINE_DISPLAY_COLUMNS - i);
+  if (!(used & (1 << row)) || memcmp(line, this->text[row], LINE_DISPLAY_COLUMNS))
+  {
+    memcpy(this->text[row], line, LINE_DISPLAY_COLUMNS);
+    used |= (1 << row);
+    dirty |= (1 << row);
+  }
+}
+
+/**
+* Draw the rows set since the last Render, changed characters only
+*/
+void LineDisplay::Render()
+{
+  for (uint8_t row = 0; dirty; row++)
+  {
+    if (dirty & (1 << row))
+    {
+      dirty &= ~(1 << row);
+      RenderRow(row);
+    }
+  }
+}
+
+/**
+* Forget what the panel shows, e.g. after it was cleared: the next Render draws every row set
+*/
+void LineDisplay::Invalidate()
+{
+  memset(rendered, 0, sizeof(rendered));
+  dirty = used;
+}
+
+/**
+* Draw the runs of characters that differ from the panel on a row
+* @param row row
+*/
+void LineDisplay::RenderRow(uint8_t row)
+{
+  uint8_t tiles[LINE_DISPLAY_COLUMNS][8];
+  uint8_t column = 0;
+  while (column < LINE_DISPLAY_COLUMNS)
+  {
+    if (text[row][column] == rendered[row][column])
+    {
+      column++;
+      continue;
+    }
+    uint8_t start = column;
+    uint8_t length = 0;
+    while ((column < LINE_DISPLAY_COLUMNS) && (text[row][column] != rendered[row][column]))
+    {
+      GetGlyph(text[row][column], tiles[length++]);
+      rendered[row][column] = text[row][column];
+      column++;
+    }
+    u8x8.drawTile(start, row, length, tiles[0]);
+    tilesDrawn += length;
+  }
+}
+
+/**
+* Copy the glyph of a character from the font
+* @param c    the character, blank if the font does not have it
+* @param tile the 8 bytes of the tile
+*/
+void LineDisplay::GetGlyph(char c, uint8_t* tile)
+{
+  uint8_t first = pgm_read_byte(font);
+  uint8_t last = pgm_read_byte(font + 1);
+  uint8_t encoding = (uint8_t)c;
+  if ((encoding < first) || (encoding > last))
+  {
+    memset(tile, 0, 8);
+    return;
+  }
+  const uint8_t* glyph = font + U8X8_FONT_HEADER_SIZE + (encoding - first) * 8;
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    tile[i] = pgm_read_byte(glyph + i);
+  }
+}
+
+/**
+* Get the bytes sent to the panel since Begin, commands and tile data, by every drawing
+* function of the panel
+* @return the number of bytes
+*/
+unsigned long LineDisplay::GetBytesSent()
+{
+  return panelBytes;
+}
+
+/**
+* Get the tiles drawn by Render
+* @return the number of 8x8 tiles
+*/
+unsigned long LineDisplay::GetTilesDrawn()
+{
+  return tilesDrawn;
+}
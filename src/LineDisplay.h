@@ -0,0 +1,45 @@
+#ifndef LINEDISPLAY_H
+#define LINEDISPLAY_H
+
+#include <Arduino.h>
+#include <U8x8lib.h>
+
+// text grid of a 128x64 panel with an 8x8 font
+#define LINE_DISPLAY_ROWS 8
+#define LINE_DISPLAY_COLUMNS 16
+
+/**
+* Text display that redraws only what changed.
+* The text of each row is set with SetLine; Render then compares it with the text on the
+* panel, and draws the runs of changed characters only (a character is one 8x8 tile). Each
+* run goes to the panel as one page write: the glyphs are copied from the font into a tile
+* buffer, and the position is sent once per run instead of once per character.
+* Rows never set are left alone, e.g. a title printed before.
+* The bytes sent to the panel, commands included, are counted from the u8x8 byte layer.
+*/
+class LineDisplay
+{
+  public:
+    LineDisplay(U8X8& u8x8);
+    void Begin(const uint8_t* font);
+    void SetLine(uint8_t row, const char* text);
+    void Render();
+    void Invalidate();
+    unsigned long GetBytesSent();
+    unsigned long GetTilesDrawn();
+
+  private:
+    void RenderRow(uint8_t row);
+    void GetGlyph(char c, uint8_t* tile);
+
+  private:
+    U8X8& u8x8;
+    const uint8_t* font;      // u8x8 font of 1x1 tile glyphs
+    char text[LINE_DISPLAY_ROWS][LINE_DISPLAY_COLUMNS];       // to be displayed, space padded
+    char rendered[LINE_DISPLAY_ROWS][LINE_DISPLAY_COLUMNS];   // on the panel
+    uint8_t used;       // one bit per row set at least once
+    uint8_t dirty;      // one bit per row set since the last Render
+    unsigned long tilesDrawn;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <LoRaAdr.h>
+
+/**
+* LoRaAdr Constructor
+*/
+LoRaAdr::LoRaAdr()
+{
+  Reset();
+}
+
+/**
+* Forget the SNR history, e.g. after a data rate change
+*/
+void LoRaAdr::Reset()
+{
+  maxSnr = -100;
+  count = 0;
+  missed = 0;
+}
+
+/**
+* Record the SNR of an acknowledged uplink
+* @param snr SNR in dB
+*/
+void LoRaAdr::AddSnr(float snr)
+{
+  if (snr > maxSnr)
+  {
+    maxSnr = snr;
+  }
+  if (count < ADR_HISTORY)
+  {
+    count++;
+  }
+  missed = 0;
+}
+
+/**
+* Record an uplink that was never acknowledged
+*/
+void LoRaAdr::AckMissed()
+{
+  if (missed < ADR_MISSED_LIMIT)
+  {
+    missed++;
+  }
+}
+
+/**
+* Compute the next data rate and TX power
+* @param  spreadingFactor current spreading factor, updated
+* @param  txPower         current TX power in dBm, updated
+* @return                 true if a setting changed
+*/
+bool LoRaAdr::Adjust(uint8_t& spreadingFactor, int8_t& txPower)
+{
+  uint8_t sf = spreadingFactor;
+  int8_t power = txPower;
+
+  if (missed >= ADR_MISSED_LIMIT)
+  {
+    // the link got worse: back to full power first, then a more robust data rate
+    if (power < ADR_MAX_TX_POWER)
+    {
+      power = ADR_MAX_TX_POWER;
+    }
+    else if (sf < ADR_MAX_SPREADING_FACTOR)
+    {
+      sf++;
+    }
+  }
+  else if (count >= ADR_HISTORY)
+  {
+    int steps = (int)((maxSnr - RequiredSnr(sf) - ADR_INSTALLATION_MARGIN) / 3);
+    while (steps > 0 && sf > ADR_MIN_SPREADING_FACTOR)
+    {
+      sf--;
+      steps--;
+    }
+    while (steps > 0 && power > ADR_MIN_TX_POWER)
+    {
+      power = (power - 3 < ADR_MIN_TX_POWER) ? ADR_MIN_TX_POWER : power - 3;
+      steps--;
+    }
+    while (steps < 0 && power < ADR_MAX_TX_POWER)
+    {
+      power = (power + 3 > ADR_MAX_TX_POWER) ? ADR_MAX_TX_POWER : power + 3;
+      steps++;
+    }
+  }
+  else
+  {
+    return false;
+  }
+
+  Reset();
+  if (sf == spreadingFactor && power == txPower)
+  {
+    return false;
+  }
+  spreadingFactor = sf;
+  txPower = power;
+  return true;
+}
+
+/**
+* Demodulation floor
+* @param  spreadingFactor spreading factor, 7 to 12
+* @return                 the lowest SNR in dB a packet can be received at
+*/
+float LoRaAdr::RequiredSnr(uint8_t spreadingFactor)
+{
+  // SX1276 datasheet, table 13: -7.5 dB at SF7 down to -20 dB at SF12
+  return -5.0 - 2.5 * (spreadingFactor - 6);
+}
@@ -0,0 +1,41 @@
+#ifndef LORAADR_H
+#define LORAADR_H
+
+#include <Arduino.h>
+
+// acknowledged uplinks needed before the data rate is adjusted
+#define ADR_HISTORY 8
+// SNR margin kept above the demodulation floor, dB
+#define ADR_INSTALLATION_MARGIN 10.0
+// consecutive unacknowledged uplinks before the link budget is increased again
+#define ADR_MISSED_LIMIT 2
+#define ADR_MIN_SPREADING_FACTOR 7
+#define ADR_MAX_SPREADING_FACTOR 12
+#define ADR_MIN_TX_POWER 2
+#define ADR_MAX_TX_POWER 17
+
+/**
+* Node side adaptive data rate, along the lines of the LoRaWAN ADR.
+* The best SNR of the last ADR_HISTORY acknowledged uplinks (as reported by the gateway,
+* or measured on the ACK) gives the margin above the demodulation floor of the current
+* spreading factor. Each 3 dB of margin beyond ADR_INSTALLATION_MARGIN lowers the
+* spreading factor by one step, then the TX power by 3 dB. Missing ACKs raise the TX
+* power back to its maximum, then the spreading factor.
+*/
+class LoRaAdr
+{
+  public:
+    LoRaAdr();
+    void Reset();
+    void AddSnr(float snr);
+    void AckMissed();
+    bool Adjust(uint8_t& spreadingFactor, int8_t& txPower);
+    static float RequiredSnr(uint8_t spreadingFactor);
+
+  private:
+    float maxSnr;
+    uint8_t count;
+    uint8_t missed;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include <LoRaFrameWriter.h>
+
+/**
+* @param radio     where the frame goes, typically LoRa between beginPacket() and endPacket()
+* @param maxLength maximum frame length, CRC included
+* @param copy      where the frame is copied as it is sent, maxLength bytes, or NULL
+*/
+LoRaFrameWriter::LoRaFrameWriter(Print& radio, size_t maxLength, uint8_t* copy) :
+  radio(radio),
+  copy(copy),
+  maxPayloadLength(maxLength > 2 ? maxLength - 2 : 0),
+  payloadLength(0),
+  overflow(false),
+  chunkLength(0)
+{
+}
+
+/**
+* Start a new frame
+*/
+void LoRaFrameWriter::begin()
+{
+  payloadLength = 0;
+  overflow = false;
+  chunkLength = 0;
+  crc.begin();
+}
+
+/**
+* Add one payload byte
+* @param  byte the byte
+* @return      1, or 0 if the frame is full
+*/
+size_t LoRaFrameWriter::write(uint8_t byte)
+{
+  return write(&byte, 1);
+}
+
+/**
+* Add payload bytes
+* @param  buffer the bytes
+* @param  size   number of bytes
+* @return        number of bytes accepted, less than size if the frame is full
+*/
+size_t LoRaFrameWriter::write(const uint8_t* buffer, size_t size)
+{
+  if (payloadLength + size > maxPayloadLength)
+  {
+    overflow = true;
+    setWriteError();
+    size = maxPayloadLength - payloadLength;
+  }
+
+  if (copy != NULL)
+  {
+    memcpy(copy + payloadLength, buffer, size);
+  }
+  for (size_t i = 0; i < size; i++)
+  {
+    chunk[chunkLength++] = buffer[i];
+    if (chunkLength == sizeof(chunk))
+    {
+      flushChunk();
+    }
+  }
+  payloadLength += size;
+
+  return size;
+}
+
+/**
+* Send the pending payload bytes and append the CRC, least significant byte first
+* @return the frame length, CRC included, or 0 if the payload did not fit
+*/
+size_t LoRaFrameWriter::finish()
+{
+  flushChunk();
+  if (overflow)
+  {
+    return 0;
+  }
+
+  uint16_t crc16 = crc.value();
+  uint8_t crcBytes[2] = { (uint8_t)(crc16 & 0xff), (uint8_t)((crc16 >> 8) & 0xff) };
+  radio.write(crcBytes, sizeof(crcBytes));
+  if (copy != NULL)
+  {
+    memcpy(copy + payloadLength, crcBytes, sizeof(crcBytes));
+  }
+
+  return payloadLength + sizeof(crcBytes);
+}
+
+/**
+* @return number of payload bytes accepted so far
+*/
+size_t LoRaFrameWriter::length()
+{
+  return payloadLength;
+}
+
+/**
+* @return true if the payload exceeded the maximum frame length
+*/
+bool LoRaFrameWriter::overflowed()
+{
+  return overflow;
+}
+
+void LoRaFrameWriter::flushChunk()
+{
+  if (chunkLength > 0)
+  {
+    crc.update(chunk, chunkLength);
+    radio.write(chunk, chunkLength);
+    chunkLength = 0;
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef LORAFRAMEWRITER_H
+#define LORAFRAMEWRITER_H
+
+#include <Arduino.h>
+#include <L2MCrc16.h>
+
+// bytes staged before a burst to the radio
+#define LORA_FRAME_WRITER_CHUNK 32
+
+/**
+* Print adapter that streams a Lora2MQTT frame to the radio: the payload
+* serializer (e.g. serializeJson(doc, writer)) writes straight into it, bytes are
+* pushed to the radio FIFO in bursts while the CRC16 is updated, and finish()
+* appends the CRC. The frame, CRC included, never exceeds maxLength bytes: once
+* the payload does not fit, the writer stops accepting bytes and finish() fails.
+* With a copy buffer of maxLength bytes, the frame sent is also kept there.
+*/
+class LoRaFrameWriter : public Print
+{
+  public:
+    LoRaFrameWriter(Print& radio, size_t maxLength, uint8_t* copy = NULL);
+    void begin();
+    virtual size_t write(uint8_t byte);
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t finish();
+    size_t length();
+    bool overflowed();
+
+  private:
+    void flushChunk();
+
+  private:
+    Print& radio;
+    uint8_t* copy;
+    size_t maxPayloadLength;
+    size_t payloadLength;
+    bool overflow;
+    L2MCrc16 crc;
+    uint8_t chunk[LORA_FRAME_WRITER_CHUNK];
+    size_t chunkLength;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include <LoRaLink.h>
+#include <L2MCrc16.h>
+
+// the link the driver RX filter runs for, set by Begin()
+static LoRaLink* filterLink = NULL;
+
+/**
+* LoRaLink Constructor
+* @param radio     the LoRa driver
+* @param maxLength maximum frame length, header and CRC included, up to LORA_MAX_PACKET_LENGTH
+*/
+LoRaLink::LoRaLink(LoRaClass& radio, size_t maxLength) :
+  radio(radio),
+  writer(radio, (maxLength < LORA_MAX_PACKET_LENGTH) ? maxLength : LORA_MAX_PACKET_LENGTH, frame),
+  frameLength(0),
+  nodeAddress(L2M_ADDRESS_BROADCAST),
+  nodeGroup(L2M_ADDRESS_NO_GROUP),
+  crcErrors(0)
+{
+
+}
+
+/**
+* Install the RX filter and the RX queue, once the radio is initialized
+* @param nodeAddress the node id
+* @param nodeGroup   the node group, L2M_ADDRESS_NO_GROUP if none
+*/
+void LoRaLink::Begin(uint8_t nodeAddress, uint8_t nodeGroup)
+{
+  this->nodeAddress = nodeAddress;
+  this->nodeGroup = nodeGroup;
+  filterLink = this;
+  radio.setRxFilter(AcceptFrame, L2M_FRAME_HEADER_SIZE);
+  radio.enableRxQueue();
+}
+
+/**
+* RX filter, called by LoRa.handleInterrupt() in the radio task with the frame header only
+* Frames for other nodes are dropped before the payload is read from the FIFO
+* @param  header the first bytes of the frame
+* @param  length header length
+* @return        true to queue the frame: a downlink, ACK, fragment or fragment ACK for the
+*                node, its group or broadcast
+*/
+bool LoRaLink::Accept(const uint8_t* header, size_t length)
+{
+  L2MFrameHeader frameHeader;
+  if (!L2MDecodeHeader(header, length, frameHeader))
+  {
+    return false;
+  }
+  uint8_t kind = frameHeader.type & L2M_MSG_KIND_MASK;
+  return ((kind == L2M_MSG_DOWNLINK) || (kind == L2M_MSG_ACK) || (kind == L2M_MSG_FRAGMENT) || (kind == L2M_MSG_FRAGMENT_ACK))
+      && L2MIsAddressedTo(frameHeader.destination, nodeAddress, nodeGroup);
+}
+
+/**
+* Start a frame to the gateway: the radio leaves the receive settings (normal IQ, standby)
+* and the header is written
+* @param  header the frame header
+* @return        where the payload is written, e.g. serializeJson(doc, link.BeginFrame(header))
+*/
+Print& LoRaLink::BeginFrame(const L2MFrameHeader& header)
+{
+  BeginPacket();
+  writer.begin();
+  uint8_t headerBytes[L2M_FRAME_HEADER_SIZE];
+  writer.write(headerBytes, L2MEncodeHeader(header, headerBytes, sizeof(headerBytes)));
+  return writer;
+}
+
+/**
+* Append the CRC of the frame. A frame that does not fit in a packet is dropped and the radio sleeps
+* @return the frame length, CRC included, or 0 if the payload did not fit
+*/
+size_t LoRaLink::EndFrame()
+{
+  frameLength = writer.finish();
+  if (frameLength == 0)
+  {
+    radio.sleep();
+  }
+  return frameLength;
+}
+
+/**
+* Hand the frame to the radio, TxDone is reported through the driver callback
+* @return false if the duty cycle budget rejected it, the radio then sleeps
+*/
+bool LoRaLink::Send()
+{
+  if (!radio.endPacket(true))
+  {
+    radio.sleep();
+    return false;
+  }
+  return true;
+}
+
+/**
+* Send the last frame again, byte for byte: same header, sequence number and payload
+* @return false if there is none, or if the duty cycle budget rejected it, the radio then sleeps
+*/
+bool LoRaLink::Resend()
+{
+  if (frameLength == 0)
+  {
+    return false;
+  }
+  BeginPacket();
+  radio.write(frame, frameLength);
+  return Send();
+}
+
+/**
+* Next frame from the RX queue. Frames with a bad CRC16 are dropped and counted
+* @param  header  the frame header
+* @param  payload the payload, in the queued packet: valid until Release()
+* @param  length  payload length, header and CRC excluded
+* @return         the packet, to be released with Release() once processed, or NULL if none is queued
+*/
+LoRaPacket* LoRaLink::Receive(L2MFrameHeader& header, const uint8_t*& payload, size_t& length)
+{
+  LoRaPacket* packet;
+  while ((packet = radio.nextPacket()) != NULL)
+  {
+    if ((packet->length >= L2M_FRAME_HEADER_SIZE + 2) && L2MCrc16::check(packet->data, packet->length))
+    {
+      L2MDecodeHeader(packet->data, packet->length, header);
+      payload = packet->data + L2M_FRAME_HEADER_SIZE;
+      length = packet->length - L2M_FRAME_HEADER_SIZE - 2;
+      return packet;
+    }
+    crcErrors++;
+    radio.releasePacket();
+  }
+  return NULL;
+}
+
+/**
+* Release the frame returned by Receive()
+*/
+void LoRaLink::Release()
+{
+  radio.releasePacket();
+}
+
+/**
+* @return number of received frames dropped on a bad CRC16
+*/
+uint32_t LoRaLink::GetCrcErrors()
+{
+  return crcErrors;
+}
+
+/**
+* The radio leaves the receive settings (normal IQ, standby) for a new packet
+*/
+void LoRaLink::BeginPacket()
+{
+  radio.idle();
+  radio.disableInvertIQ();
+  radio.beginPacket();
+}
+
+bool LoRaLink::AcceptFrame(const uint8_t* header, size_t length)
+{
+  return (filterLink != NULL) && filterLink->Accept(header, length);
+}
@@ -0,0 +1,46 @@
+#ifndef LORALINK_H
+#define LORALINK_H
+
+#include <Arduino.h>
+#include <LoRa.h>
+#include <L2MFrame.h>
+#include <LoRaFrameWriter.h>
+
+/**
+* Lora2MQTT frames of the node over the LoRa driver, shared by the firmware and the host tests.
+* Send: the header and the payload are streamed to the radio FIFO through a LoRaFrameWriter,
+* which appends the CRC16, and the packet is handed to the radio without waiting for TxDone.
+* The last frame is kept, Resend() sends it again byte for byte.
+* Receive: the RX filter, run by LoRa.handleInterrupt() on the frame header only, queues the
+* gateway frames for the node, its group or broadcast; queued frames are CRC checked and split
+* into header and payload.
+*/
+class LoRaLink
+{
+  public:
+    LoRaLink(LoRaClass& radio, size_t maxLength);
+    void Begin(uint8_t nodeAddress, uint8_t nodeGroup);
+    bool Accept(const uint8_t* header, size_t length);
+    Print& BeginFrame(const L2MFrameHeader& header);
+    size_t EndFrame();
+    bool Send();
+    bool Resend();
+    LoRaPacket* Receive(L2MFrameHeader& header, const uint8_t*& payload, size_t& length);
+    void Release();
+    uint32_t GetCrcErrors();
+
+  private:
+    void BeginPacket();
+    static bool AcceptFrame(const uint8_t* header, size_t length);
+
+  private:
+    LoRaClass& radio;
+    LoRaFrameWriter writer;
+    uint8_t frame[LORA_MAX_PACKET_LENGTH]; // last frame sent, CRC included
+    size_t frameLength;     // 0 if none, or if it did not fit
+    uint8_t nodeAddress;    // radio task only, read by the RX filter
+    uint8_t nodeGroup;
+    uint32_t crcErrors;     // received frames dropped on a bad CRC16
+};
+
+#endif
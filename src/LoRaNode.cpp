@@ -1,6 +1,7 @@
 #include <LoRaNode.h>
-#include <Wire.h>
-#include <QMC5883L.h>
+#include <esp_timer.h>
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
 
 
 #define DEBUG_ESP_PORT Serial
@@ -10,15 +11,23 @@
 #define DEBUG_MSG(...)
 #endif
 
-volatile bool displayNeedRefresh = false;
+// called from the interrupts when the node state changes, see SetEventCallback
+void (*eventCallback)() = NULL;
 
 // -------------------------------------------------------
 // NODE USER CONFIGURATION
 // -------------------------------------------------------
 // Node name displayed on the screen
 const char* LORA_NODE_NAME = "NODE_01";
-// node data transmission interval in ms
+// Node id used by the binary codecs in place of the name, unique per gateway
+const uint8_t LORA_NODE_ID = 1;
+// Group the node belongs to (0xF0-0xFE) for group downlinks, L2M_ADDRESS_NO_GROUP if none
+const uint8_t LORA_NODE_GROUP = 0xF0;
+// node data transmission interval in ms: minimum time between two uplinks,
+// and reporting period against which suppressed uplinks are counted
 const int transmissionTimeInterval = 10000;
+// unchanged state is sent at least every heartbeatTimeInterval ms, can be changed by downlink
+const unsigned long heartbeatTimeInterval = 600000;
 // node processing time interval
 const int processingTimeInterval = 5000;
 
@@ -27,41 +36,96 @@ const int processingTimeInterval = 5000;
 // NODE SPECIFIC USER CONFIGURATION
 // -------------------------------------------------------
 
-QMC5883L compass;
 // reed swich management
 const int reedSwitchPin = 13;
-unsigned long lastChangeTime = 0;
-unsigned long debounceDelay = 50;
-bool reedSwitchState = false;
-// mail avaialble ?
-bool mail = false;
-
-portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+// a reed switch level is taken once no edge came for debounceDelay ms
+const unsigned long debounceDelay = 50;
 
 /**
-* LoRaNode Constructor. Empty
+* LoRaNode Constructor. Intervals start with the user defined values
 */
-LoRaNode::LoRaNode()
+LoRaNode::LoRaNode() :
+  processingInterval(processingTimeInterval),
+  txInterval(transmissionTimeInterval),
+  heartbeatInterval(heartbeatTimeInterval)
 {
 
 }
 
 /**
 * Get transmission time interval
-* @return transmission time interval in ms. User defined parameter.
+* @return transmission time interval in ms. User defined parameter, can be changed by downlink.
 */
 int LoRaNode::GetTransmissionTimeInterval()
 {
-  return (transmissionTimeInterval);
+  return (txInterval);
 }
 
 /**
 * Get processing time interval
-* @return processing time interval in ms. User defined paramater.
+* @return processing time interval in ms. User defined paramater, can be changed by downlink.
 */
 int LoRaNode::GetProcessingTimeInterval()
 {
-  return (processingTimeInterval);
+  return (processingInterval);
+}
+
+/**
+* Set transmission time interval
+* @param interval transmission time interval in ms
+*/
+void LoRaNode::SetTransmissionTimeInterval(int interval)
+{
+  txInterval = interval;
+}
+
+/**
+* Get heartbeat time interval
+* @return time in ms after which an unchanged state is sent again. User defined parameter, can be changed by downlink.
+*/
+unsigned long LoRaNode::GetHeartbeatTimeInterval()
+{
+  return (heartbeatInterval);
+}
+
+/**
+* Set heartbeat time interval
+* @param interval heartbeat time interval in ms
+*/
+void LoRaNode::SetHeartbeatTimeInterval(unsigned long interval)
+{
+  heartbeatInterval = interval;
+}
+
+/**
+* Set processing time interval
+* @param interval processing time interval in ms
+*/
+void LoRaNode::SetProcessingTimeInterval(int interval)
+{
+  processingInterval = interval;
+}
+
+/**
+* Get batch size
+* @return number of samples sent per uplink with the batch codec, 0 if not used
+*/
+size_t LoRaNode::GetBatchSize()
+{
+  return batchSize;
+}
+
+/**
+* Set batch size, chosen by the node from the airtime budget
+* @param size number of samples sent per uplink with the batch codec, 0 to stop buffering samples
+*/
+void LoRaNode::SetBatchSize(size_t size)
+{
+  batchSize = (size > L2M_BATCH_MAX_SAMPLES) ? L2M_BATCH_MAX_SAMPLES : size;
+  if (batchSize == 0)
+  {
+    samples.clear();
+  }
 }
 
 /**
@@ -74,78 +138,158 @@ char* LoRaNode::GetNodeName()
 }
 
 /**
-* Method invoke by the node to get the information to display.
-* Lines 1, 2 and 3 are used upon Tx
-* Lines 4, 5 and used upon Rx
+* Get Node Id
+* @return the node id. User defined parameter
+*/
+uint8_t LoRaNode::GetNodeId()
+{
+  return LORA_NODE_ID;
+}
+
+/**
+* Get Node Group
+* @return the group address of the node. User defined parameter
+*/
+uint8_t LoRaNode::GetNodeGroup()
+{
+  return LORA_NODE_GROUP;
+}
+
+/**
+* Length written by snprintf into a buffer, output cut to the buffer included
+* @param  written snprintf result
+* @param  size    buffer size
+* @return         the length of the string in the buffer
+*/
+static size_t formattedLength(int written, size_t size)
+{
+  if ((written < 0) || (size == 0))
+  {
+    return 0;
+  }
+  return ((size_t)written < size) ? written : size - 1;
+}
+
+/**
+* Method invoke by the node to get the information to display, formatted in a buffer of the
+* caller: no allocation. Lines 1, 2 and 3 are used upon Tx, lines 4, 5 and 6 upon Rx
+* The line is no longer dirty once formatted, see GetDirtyLines
 * @param  lineNumber the line number where the messge will be displayed
-* @return            the messsage to be displayed
+* @param  buffer     where the message is written, NUL terminated; LORA_NODE_LINE_SIZE fits any line
+* @param  size       buffer size, the message is cut to fit
+* @return            the message length
 */
-char* LoRaNode::GetLineToDisplay(byte lineNumber)
+size_t LoRaNode::FormatLineToDisplay(byte lineNumber, char* buffer, size_t size)
 {
-  String msg;
+  if ((lineNumber >= 1) && (lineNumber <= LORA_NODE_DISPLAY_LINES))
+  {
+    dirtyLines &= ~(1 << (lineNumber - 1));
+  }
   switch(lineNumber)
   {
     // Tx Line 1
     case 1:
-      msg = "*Heading ";
-      msg += lastHeading;
-    break;
+      return FormatHeadingLine(buffer, size);
     case 2:
-      msg = "*Reed switch ";
-      msg += (reedSwitchState == true) ? "ON " : "OFF";
-    break;
+      return FormatReedSwitchLine(buffer, size);
     case 3:
       // user custom message or by default the number of message sent
-      msg = "*TxCounter ";
-      msg += TxCounter;
-    break;
-    case 4 :
-      break;
+      return FormatTxCounterLine(buffer, size);
     case 5:
-      if (calibrating)
-      {
-        msg = "calibrating";
-      }
-      else
-      {
-        msg = "";
-      }
-    break;
-    case 6:
-      break;
+      return formattedLength(snprintf(buffer, size, "%s", calibrating ? "calibrating" : ""), size);
     default:
-      break;
+      return formattedLength(snprintf(buffer, size, "%s", ""), size);
   }
-  return (char*) msg.c_str();
 }
 
+/**
+* Format the heading line
+* @param  buffer destination buffer
+* @param  size   buffer size
+* @return        the line length
+*/
+size_t LoRaNode::FormatHeadingLine(char* buffer, size_t size)
+{
+  return formattedLength(snprintf(buffer, size, "*Heading %s", L2MHeadingName(lastHeadingSector)), size);
+}
+
+/**
+* Format the reed switch line, from the status of the radio task
+* @param  buffer destination buffer
+* @param  size   buffer size
+* @return        the line length
+*/
+size_t LoRaNode::FormatReedSwitchLine(char* buffer, size_t size)
+{
+  return formattedLength(snprintf(buffer, size, "*Reed switch %s", status.reedSwitch ? "ON " : "OFF"), size);
+}
+
+/**
+* Format the TX counter line, from the status of the radio task
+* @param  buffer destination buffer
+* @param  size   buffer size
+* @return        the line length
+*/
+size_t LoRaNode::FormatTxCounterLine(char* buffer, size_t size)
+{
+  return formattedLength(snprintf(buffer, size, "*TxCounter %d", status.txCounter), size);
+}
+
+/**
+* Level of the reed switch pin, read from the GPIO input registers: digitalRead is not in IRAM
+* @return HIGH or LOW
+*/
+static inline __attribute__((always_inline)) int readReedSwitchPin()
+{
+  return (reedSwitchPin < 32) ? ((REG_READ(GPIO_IN_REG) >> reedSwitchPin) & 1)
+                              : ((REG_READ(GPIO_IN1_REG) >> (reedSwitchPin - 32)) & 1);
+}
+
+/**
+* Reed switch interrupt, on each edge, bounces included: queues the edge with its time and the
+* level read, and wakes the radio task up. The radio task debounces, see ReceiveAppUpdates
+* Runs from IRAM with the flash cache possibly disabled: the queue push is inlined here,
+* the level is read from the GPIO registers and the callback must be IRAM_ATTR
+*/
 void IRAM_ATTR __ISR_reedSwitch()
 {
-  const boolean readState = !digitalRead(reedSwitchPin);
-  // debounce interrupt
-  if (readState != reedSwitchState)
+  LoRaNodeEvent event = { esp_timer_get_time(), !readReedSwitchPin() };
+  // a full queue drops the edge, counted; the level is read again once the edges settle
+  Node.events.Push(event);
+  if (eventCallback)
   {
-    if (millis() > lastChangeTime + debounceDelay)
-    {
-      portENTER_CRITICAL(&mux);
-      reedSwitchState = readState;
-      portEXIT_CRITICAL_ISR(&mux);
-      //changeFlag = true;
-      if (reedSwitchState)
-      {
-        DEBUG_MSG("Reed Active\n");
-        reedSwitchState = true;
-        // reed becomes active ... means that letters box has been open / close
-        mail = true;
-      }
-      else
-      {
-        DEBUG_MSG("Reed Not Active\n");
-        reedSwitchState = false;
-      }
-      displayNeedRefresh = true;
-    }
-    lastChangeTime = millis();
+    eventCallback();
+  }
+}
+
+/**
+* Get the lines changed since they were last formatted with FormatLineToDisplay. Application task side
+* @return one bit per line, bit 0 for line 1
+*/
+uint8_t LoRaNode::GetDirtyLines()
+{
+  return dirtyLines;
+}
+
+/**
+* Set the function called when a line of the display changes, application task side
+* @param callback the function, called with the bit of the line (bit 0 for line 1), NULL for none
+*/
+void LoRaNode::SetDisplayCallback(void (*callback)(uint8_t lines))
+{
+  displayCallback = callback;
+}
+
+/**
+* Mark a line as changed, and notify the display
+* @param lineNumber the line number, from 1
+*/
+void LoRaNode::SetLineDirty(byte lineNumber)
+{
+  dirtyLines |= (1 << (lineNumber - 1));
+  if (displayCallback)
+  {
+    displayCallback(1 << (lineNumber - 1));
   }
 }
 
@@ -155,93 +299,506 @@ void IRAM_ATTR __ISR_reedSwitch()
 */
 void LoRaNode::AppSetup()
 {
-  Wire.begin();
-  compass.init();
-  compass.setSamplingRate(50);
+  sensors.Setup();
   pinMode(reedSwitchPin, INPUT_PULLUP);
-  reedSwitchState = !digitalRead(reedSwitchPin);
+  reedSwitch = !digitalRead(reedSwitchPin);
+  status.reedSwitch = reedSwitch;
   attachInterrupt(digitalPinToInterrupt(reedSwitchPin), __ISR_reedSwitch, CHANGE);
 }
 
 /**
 * App processing of the node.
-* Invoke every loop of the nodes before Rx and Tx
-* One should benefit from using processingTimeInterval to avoid overloading the node
+* Invoked by the application task every processing time interval. The state read is sent
+* to the radio task, which decides on the uplinks (see ReceiveAppUpdates)
 */
 void LoRaNode::AppProcessing()
 {
-  static int calibCounter = 0;
-
-  int16_t x,y,z,t;
-  compass.readRaw(&x,&y,&z,&t);
-  DEBUG_MSG("x: %i",x);
-  DEBUG_MSG("    y: %i",y);
-  DEBUG_MSG("    z: %i",z);
-  int heading = 0;
-  if (calibrating)
-  {
-    DEBUG_MSG(" calibrating ... ");
-    calibCounter++;
-    heading = compass.readHeadingAndCalibrate();
-    // if more than 20 calibration cycles, stop calibration
-    if (calibCounter > 20)
+  LoRaNodeState state;
+  state.sample.time = millis();
+  state.sample.heading = -1;    // no heading unless a sensor gives one
+  state.sample.x = 0;
+  state.sample.y = 0;
+  state.sample.z = 0;
+  sensors.Sample(state.readings, state.sample);
+
+  uint8_t sector = (state.sample.heading < 0) ? L2M_HEADING_UNKNOWN : L2MHeadingSector(state.sample.heading);
+  if (sector != lastHeadingSector)
+  {
+    lastHeadingSector = sector;
+    SetLineDirty(1);
+  }
+  UpdateCalibrationLine();
+  DEBUG_MSG(" * %s\n", L2MHeadingName(lastHeadingSector));
+  state.headingSector = lastHeadingSector;
+  state.sample.reedSwitch = false;
+  state.sample.mail = false;
+  if (!states.Push(state))
+  {
+    DEBUG_MSG("state queue full, %lu states dropped\n", states.GetDropped());
+  }
+}
+
+/**
+* Take the application states and the reed switch edges, radio task side. To be invoked
+* before each uplink decision, and again after GetReedSwitchSettleDelay while edges settle.
+* The edges closer than debounceDelay to each other are one burst: the reed switch takes the
+* level of its last edge once no edge came for debounceDelay, the time of its first edge
+*/
+void LoRaNode::ReceiveAppUpdates()
+{
+  LoRaNodeEvent event;
+  while (events.Pop(event))
+  {
+    if (reedSettling && ((event.time - reedEdgeTime) >= (int64_t)debounceDelay * 1000))
+    {
+      // the previous burst settled before this edge
+      SettleReedSwitch(reedEdgeLevel);
+    }
+    if (!reedSettling)
+    {
+      reedSettling = true;
+      reedBurstTime = event.time;
+    }
+    reedEdgeTime = event.time;
+    reedEdgeLevel = event.reedSwitch;
+    ReedStats.edges++;
+  }
+  if (reedSettling && ((esp_timer_get_time() - reedEdgeTime) >= (int64_t)debounceDelay * 1000))
+  {
+    // stable since the last edge: the pin level stands even if edges were dropped
+    SettleReedSwitch(!digitalRead(reedSwitchPin));
+  }
+
+  LoRaNodeState state;
+  while (states.Pop(state))
+  {
+    headingSector = state.headingSector;
+    readings = state.readings;
+    lastSample = state.sample;
+    lastSample.reedSwitch = reedSwitch;
+    lastSample.mail = mail;
+    lastSample.closes = ReedStats.closes;
+    if ((batchSize > 0) && !samples.add(lastSample))
     {
-      calibCounter = 0;
-      calibrating = false;
-      compass.saveCalibrationSettings();
+      DEBUG_MSG("batch full, %u samples dropped\n", samples.droppedCount());
     }
   }
+}
+
+/**
+* End of a burst of reed switch edges, radio task side: count the change if the level differs
+* @param level the level the burst settled to, true when the switch is closed
+*/
+void LoRaNode::SettleReedSwitch(bool level)
+{
+  reedSettling = false;
+  if (level == reedSwitch)
+  {
+    // bounces back to the same level
+    return;
+  }
+  reedSwitch = level;
+  if (reedSwitch)
+  {
+    // reed becomes active ... means that letters box has been open / close
+    mail = true;
+    ReedStats.closes++;
+    reedCloseTime = reedBurstTime;
+  }
   else
   {
-    DEBUG_MSG(" ... ");
-    heading = compass.readHeading();
+    ReedStats.opens++;
+    if (reedCloseTime != 0)
+    {
+      unsigned long duration = (reedBurstTime - reedCloseTime) / 1000;
+      ReedStats.lastClosedTime = duration;
+      ReedStats.totalClosedTime += duration;
+      if (duration > ReedStats.maxClosedTime)
+      {
+        ReedStats.maxClosedTime = duration;
+      }
+    }
+  }
+  if (reedEventTime == 0)
+  {
+    reedEventTime = reedBurstTime;
+  }
+  DEBUG_MSG("reed switch %s, %lu closes, %lu opens, %lu edges\n", reedSwitch ? "closed" : "open",
+    ReedStats.closes, ReedStats.opens, ReedStats.edges);
+}
+
+/**
+* Get the time until the reed switch edges received settle, radio task side: ReceiveAppUpdates
+* is due again then
+* @return the delay in ms, 0 if no edge waits
+*/
+unsigned long LoRaNode::GetReedSwitchSettleDelay()
+{
+  if (!reedSettling)
+  {
+    return 0;
   }
-  if ((heading >=340)or (heading <= 23)) { DEBUG_MSG (" * North\n");lastHeading="N"; }
-  if ((heading >=24) and (heading <= 68)) { DEBUG_MSG (" * North-East\n");lastHeading="NE"; }
-  if ((heading >=69) and (heading <= 113)) { DEBUG_MSG (" * East\n");lastHeading="E"; }
-  if ((heading >=114)and (heading <= 158)) { DEBUG_MSG (" * South-East\n");lastHeading="SE"; }
-  if ((heading >=159)and (heading <= 203)) { DEBUG_MSG (" * South\n");lastHeading="S"; }
-  if ((heading >=204)and (heading <= 248)) { DEBUG_MSG (" * South-West\n");lastHeading="SW"; }
-  if ((heading >=249)and (heading <= 293)) { DEBUG_MSG (" * West\n");lastHeading="W"; }
-  if ((heading >=294)and (heading <= 339)) { DEBUG_MSG (" * North-West\n");lastHeading="NW"; }
-  displayNeedRefresh = true;
+  int64_t elapsed = (esp_timer_get_time() - reedEdgeTime) / 1000;
+  return (elapsed >= (int64_t)debounceDelay) ? 1 : debounceDelay - elapsed;
 }
 
-bool LoRaNode::NeedDisplayUpdate()
+/**
+* Send the uplink side state to the application task when it changed, radio task side
+* @return true if a new status is queued
+*/
+bool LoRaNode::PublishStatus()
 {
-  if (displayNeedRefresh)
+  if ((publishedStatus.txCounter == TxCounter) && (publishedStatus.reedSwitch == reedSwitch)
+    && (publishedStatus.mail == mail))
   {
-    displayNeedRefresh = false;
+    return false;
+  }
+  LoRaNodeStatus update = { TxCounter, reedSwitch, mail };
+  if (!statuses.Push(update))
+  {
+    // tried again on the next call
+    return false;
+  }
+  publishedStatus = update;
+  return true;
+}
+
+/**
+* Send a command to the application task, radio task side
+* @param  type   NODE_COMMAND_SENSOR (a command found by the sensor Decode) or
+*                NODE_COMMAND_PROCESSING_INTERVAL (value: ms)
+* @param  value  command argument
+* @param  sensor NODE_COMMAND_SENSOR: sensor index
+* @return        false if the command queue is full
+*/
+bool LoRaNode::PostCommand(uint8_t type, int32_t value, uint8_t sensor)
+{
+  LoRaNodeCommand command = { type, sensor, value };
+  return commands.Push(command);
+}
+
+/**
+* @return true if commands or a status wait for the application task. Either side
+*/
+bool LoRaNode::RadioUpdatesPending()
+{
+  return (commands.Depth() > 0) || (statuses.Depth() > 0);
+}
+
+/**
+* Run the commands and take the status sent by the radio task, application task side
+* The lines of the display they change are notified, see SetDisplayCallback
+*/
+void LoRaNode::ReceiveRadioUpdates()
+{
+  LoRaNodeCommand command;
+  while (commands.Pop(command))
+  {
+    switch (command.type)
+    {
+      case NODE_COMMAND_SENSOR:
+        sensors.Run(command.sensor, command.value);
+        UpdateCalibrationLine();
+        break;
+      case NODE_COMMAND_PROCESSING_INTERVAL:
+        SetProcessingTimeInterval(command.value);
+        break;
+      default:
+        break;
+    }
+  }
+  LoRaNodeStatus update;
+  while (statuses.Pop(update))
+  {
+    if (update.reedSwitch != status.reedSwitch)
+    {
+      SetLineDirty(2);
+    }
+    if (update.txCounter != status.txCounter)
+    {
+      SetLineDirty(3);
+    }
+    status = update;
+  }
+}
+
+/**
+* Get the name of a sensor
+* @param  index sensor index in NodeSensors
+* @return       the name, NULL past the last sensor
+*/
+const char* LoRaNode::GetSensorName(uint8_t index)
+{
+  return sensors.GetName(index);
+}
+
+/**
+* Get the time spent in the sample (application task) and encode (radio task) hooks of a sensor
+* Each task reads and resets its own timing
+* @param  index sensor index in NodeSensors
+* @return       the timings, NULL past the last sensor
+*/
+SensorStats* LoRaNode::GetSensorStats(uint8_t index)
+{
+  return sensors.GetStats(index);
+}
+
+/**
+* Follow the calibration of the compass on the display
+*/
+void LoRaNode::UpdateCalibrationLine()
+{
+  bool running = sensors.Get<CompassSensor>().IsCalibrating();
+  if (running != calibrating)
+  {
+    calibrating = running;
+    SetLineDirty(5);
+  }
+}
+
+/**
+* Get the statistics of the queues between the application and the radio tasks
+* @param  index queue index, from 0
+* @param  stats the queue statistics
+* @return       false past the last queue
+*/
+bool LoRaNode::GetQueueStats(uint8_t index, LoRaNodeQueueStats& stats)
+{
+  switch (index)
+  {
+    case 0:
+      stats = { "states", states.Depth(), states.GetMaxDepth(), states.Capacity(), states.GetDropped() };
+      break;
+    case 1:
+      stats = { "events", events.Depth(), events.GetMaxDepth(), events.Capacity(), events.GetDropped() };
+      break;
+    case 2:
+      stats = { "commands", commands.Depth(), commands.GetMaxDepth(), commands.Capacity(), commands.GetDropped() };
+      break;
+    case 3:
+      stats = { "status", statuses.Depth(), statuses.GetMaxDepth(), statuses.Capacity(), statuses.GetDropped() };
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+/**
+* Send-on-change policy, invoked by the node before each uplink opportunity.
+* An uplink is due when the state differs from the last one sent (mail notification,
+* heading sector, reed switch changes), or when the heartbeat interval elapsed.
+* Each reporting period (transmissionTimeInterval) without uplink counts as suppressed
+* @param  now current time, ms
+* @return     true if an uplink must be sent
+*/
+bool LoRaNode::NeedUplink(unsigned long now)
+{
+  bool changed = mail || (reedSwitch != sentReedSwitch) || (reedEventTime != 0) || firstUplink
+    || (headingSector != sentHeadingSector);
+  // with the batch codec, a full batch is due as well
+  changed = changed || ((batchSize > 0) && (samples.count() >= batchSize));
+
+  if (changed)
+  {
+    heartbeat = false;
     return true;
   }
+  if ((now - lastUplinkTime) >= heartbeatInterval)
+  {
+    heartbeat = true;
+    return true;
+  }
+  if ((now - lastSlotTime) >= (unsigned long)txInterval)
+  {
+    lastSlotTime = now;
+    UplinksSuppressed++;
+  }
   return false;
 }
 
+/**
+* To be invoked by the node once an uplink went out, or for confirmed uplinks once
+* the gateway acknowledged it. The state it carried becomes the reference for the
+* change detection, and the mail notification it carried is cancelled
+* @param now current time, ms
+*/
+void LoRaNode::UplinkSent(unsigned long now)
+{
+  if (pendingEventTime != 0)
+  {
+    // from the first reed switch edge of the oldest change carried
+    unsigned long latency = (esp_timer_get_time() - pendingEventTime) / 1000;
+    ReedStats.uplinks++;
+    ReedStats.lastLatency = latency;
+    ReedStats.totalLatency += latency;
+    if (latency > ReedStats.maxLatency)
+    {
+      ReedStats.maxLatency = latency;
+    }
+  }
+  CommitUplink(now);
+
+  if (heartbeat)
+  {
+    UplinksOnHeartbeat++;
+  }
+  else
+  {
+    UplinksOnChange++;
+  }
+  DEBUG_MSG("uplinks: %lu on change, %lu on heartbeat, %lu suppressed\n",
+    UplinksOnChange, UplinksOnHeartbeat, UplinksSuppressed);
+}
+
+/**
+* To be invoked by the node when an uplink that could not be delivered was logged for replay.
+* The logged record carries the change: it is committed as if it had been sent
+* @param now current time, ms
+*/
+void LoRaNode::UplinkStored(unsigned long now)
+{
+  CommitUplink(now);
+  UplinksStored++;
+  DEBUG_MSG("uplinks: %lu stored for replay\n", UplinksStored);
+}
+
+/**
+* Get the uplink in flight, as captured by the last AddJSON_TxPayload or AddBinary_TxPayload
+* @param payload the uplink fields
+*/
+void LoRaNode::GetPendingUplink(L2MUplink& payload)
+{
+  payload.nodeId = LORA_NODE_ID;
+  payload.counter = pendingCounter;
+  payload.closes = pendingCloses;
+  payload.heading = pendingHeadingSector;
+  payload.reedSwitch = pendingReedSwitch;
+  payload.mail = pendingMail;
+}
+
+/**
+* Commit the snapshot of the uplink in flight as the state known by the gateway
+* @param now current time, ms
+*/
+void LoRaNode::CommitUplink(unsigned long now)
+{
+  sentHeadingSector = pendingHeadingSector;
+  sentReedSwitch = pendingReedSwitch;
+  if (pendingMail) { mail = false; } // mail notification delivered. We cancel it.
+  pendingMail = false;
+  if (reedEventTime == pendingEventTime) { reedEventTime = 0; } // no change since the capture
+  pendingEventTime = 0;
+  samples.release();
+
+  firstUplink = false;
+  lastUplinkTime = now;
+  lastSlotTime = now;
+}
+
+/**
+* To be invoked by the node when a confirmed uplink was never acknowledged.
+* Nothing is cancelled: the change is still pending and goes out with the next uplink
+*/
+void LoRaNode::UplinkFailed()
+{
+  pendingMail = false;
+  pendingEventTime = 0;
+  UplinksFailed++;
+}
+
+/**
+* Set the function called, from the interrupt, when the node state changes between two
+* processings (e.g. reed switch): the radio task runs its uplink decision then
+* @param callback the function, must be in IRAM, NULL for none
+*/
+void LoRaNode::SetEventCallback(void (*callback)())
+{
+  eventCallback = callback;
+}
+
 /**
 * Add JSON Tx payload messages
 * @param payload the JSON payload to be completed as per application needs
 */
-void LoRaNode::AddJSON_TxPayload(JsonDocument payload)
+void LoRaNode::AddJSON_TxPayload(JsonDocument& payload)
 {
-  payload["pulse_counter"] = TxCounter;
-  payload["heading"] = lastHeading;
-  portENTER_CRITICAL(&mux);
+  payload["tx_counter"] = TxCounter;
+  payload["pulse_counter"] = ReedStats.closes;
+  payload["closed_time"] = ReedStats.lastClosedTime;
+  sensors.Encode(readings, payload);
+  pendingCounter = TxCounter;
+  pendingCloses = ReedStats.closes;
+  pendingHeadingSector = headingSector;
+  pendingReedSwitch = reedSwitch;
+  pendingEventTime = reedEventTime;
   payload["mail"] = mail;
-  if (true == mail) { mail = false;} // mail notification sent. We cancel it.
-  portEXIT_CRITICAL(&mux);
+  pendingMail = mail; // cancelled once the uplink is sent (or acknowledged), see UplinkSent
+}
+
+/**
+* Add binary Tx payload for the compact codec: counters, heading sector and flags
+* @param payload the uplink fields to be completed as per application needs
+*/
+void LoRaNode::AddBinary_TxPayload(L2MUplink& payload)
+{
+  payload.nodeId = LORA_NODE_ID;
+  payload.counter = TxCounter;
+  payload.closes = ReedStats.closes;
+  payload.heading = headingSector;
+  pendingCounter = TxCounter;
+  pendingCloses = ReedStats.closes;
+  pendingHeadingSector = headingSector;
+  payload.reedSwitch = reedSwitch;
+  pendingReedSwitch = reedSwitch;
+  pendingEventTime = reedEventTime;
+  payload.mail = mail;
+  pendingMail = mail; // cancelled once the uplink is sent (or acknowledged), see UplinkSent
+}
+
+/**
+* Add batch Tx payload: the buffered samples, oldest first, as many as fit
+* Samples are released once the uplink is sent (or acknowledged), see UplinkSent
+* @param  buffer destination buffer
+* @param  size   buffer size
+* @return        the payload length, 0 if no sample is buffered
+*/
+size_t LoRaNode::AddBatch_TxPayload(uint8_t* buffer, size_t size)
+{
+  pendingCounter = TxCounter;
+  pendingCloses = ReedStats.closes;
+  pendingHeadingSector = headingSector;
+  pendingReedSwitch = reedSwitch;
+  pendingEventTime = reedEventTime;
+  pendingMail = mail; // cancelled once the uplink is sent (or acknowledged), see UplinkSent
+  // the batch must end with the state the uplink reports: a reed switch event since the
+  // last sample, or an uplink before the first one, adds a sample with the last readings
+  if ((samples.count() == 0)
+    || (samples.sample(samples.count() - 1).mail != pendingMail)
+    || (samples.sample(samples.count() - 1).reedSwitch != pendingReedSwitch)
+    || (samples.sample(samples.count() - 1).closes != pendingCloses))
+  {
+    lastSample.time = millis();
+    lastSample.reedSwitch = pendingReedSwitch;
+    lastSample.mail = pendingMail;
+    lastSample.closes = pendingCloses;
+    samples.add(lastSample);
+  }
+  return samples.encode(LORA_NODE_ID, TxCounter, millis(), buffer, size);
 }
 
 /**
 * Parse JSON Rx payload
-* One should avoid any long processing in this routine. LoraNode::AppProcessing is the one to be used for this purpose
-* Limit the processing to parsing the payload and retrieving the expected attributes
+* Invoked by the radio task: limit the processing to parsing the payload and retrieving the
+* expected attributes. Work on the sensors goes to the application task with PostCommand
 * @param payload the JSON payload received by the node
 */
-void LoRaNode::ParseJSON_RxPayload(JsonDocument payload)
+void LoRaNode::ParseJSON_RxPayload(JsonDocument& payload)
 {
-  calibrating = payload["calibration"];
-  compass.resetCalibration();
-  return;
+  sensors.Decode(payload, [this](uint8_t sensor, int32_t value)
+  {
+    PostCommand(NODE_COMMAND_SENSOR, value, sensor);
+  });
 }
 
 
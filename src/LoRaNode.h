@@ -3,7 +3,86 @@
 
 #include <ArduinoJson.h>
 #include <Arduino.h>
+#include <L2MCodec.h>
+#include <L2MFrame.h>
+#include <L2MBatch.h>
+#include <SpscQueue.h>
+#include <SensorList.h>
+#include <CompassSensor.h>
+#include <DallasSensor.h>
 
+// -------------------------------------------------------
+// NODE SENSORS
+// -------------------------------------------------------
+// sampled each processing, in this order; their JSON uplink fields and downlink commands
+// are added to the node ones
+typedef SensorList<CompassSensor, DallasSensor> NodeSensors;
+
+// lines of text shown by the node, and buffer size for the longest one, see FormatLineToDisplay
+#define LORA_NODE_DISPLAY_LINES 6
+#define LORA_NODE_LINE_SIZE 17
+
+// depth of the queues between the application and the radio tasks
+#define LORA_NODE_QUEUE_SIZE 8
+// depth of the reed switch edge queue, deep enough for a burst of contact bounces
+#define LORA_NODE_EDGE_QUEUE_SIZE 32
+
+// node state read by the application task, sent to the radio task after each processing
+struct LoRaNodeState
+{
+  uint8_t headingSector;
+  L2MSample sample;             // reed switch and mail are filled in by the radio task
+  NodeSensors::Readings readings;
+};
+
+// reed switch edge, sent by the interrupt to the radio task which debounces the edges
+struct LoRaNodeEvent
+{
+  int64_t time;                 // us, esp_timer_get_time()
+  bool reedSwitch;              // level read by the interrupt, true when the switch is closed
+};
+
+// reed switch statistics since the start, debounced changes; radio task side
+struct LoRaNodeReedStats
+{
+  unsigned long edges;          // edges taken by the interrupt, bounces included
+  unsigned long closes;         // the switch closed (magnet near), the pulses counted
+  unsigned long opens;
+  unsigned long lastClosedTime; // ms the switch stayed closed, last time
+  unsigned long maxClosedTime;
+  unsigned long totalClosedTime;
+  unsigned long uplinks;        // uplinks sent carrying a change
+  unsigned long lastLatency;    // ms from the first change carried by an uplink to its sending
+  unsigned long maxLatency;
+  unsigned long totalLatency;
+};
+
+// downlink command for the application task, sent by the radio task
+enum LoRaNodeCommandType { NODE_COMMAND_SENSOR, NODE_COMMAND_PROCESSING_INTERVAL };
+struct LoRaNodeCommand
+{
+  uint8_t type;
+  uint8_t sensor;               // NODE_COMMAND_SENSOR: sensor index in NodeSensors
+  int32_t value;
+};
+
+// uplink side state displayed by the application task, sent by the radio task when it changes
+struct LoRaNodeStatus
+{
+  int txCounter;
+  bool reedSwitch;
+  bool mail;
+};
+
+// queue statistics, see GetQueueStats
+struct LoRaNodeQueueStats
+{
+  const char* name;
+  size_t depth;
+  size_t maxDepth;
+  size_t capacity;
+  unsigned long dropped;
+};
 
 class LoRaNode
 {
@@ -11,20 +90,105 @@ class LoRaNode
     LoRaNode();
     void AppSetup();
     void AppProcessing();
-    void AddJSON_TxPayload(JsonDocument payload);
-    void ParseJSON_RxPayload(JsonDocument payload);
+    void AddJSON_TxPayload(JsonDocument& payload);
+    void ParseJSON_RxPayload(JsonDocument& payload);
+    void AddBinary_TxPayload(L2MUplink& payload);
+    size_t AddBatch_TxPayload(uint8_t* buffer, size_t size);
     char* GetNodeName();
-    char* GetLineToDisplay(byte lineNumber);
+    uint8_t GetNodeId();
+    uint8_t GetNodeGroup();
+    size_t FormatLineToDisplay(byte lineNumber, char* buffer, size_t size);
+    uint8_t GetDirtyLines();
+    void SetDisplayCallback(void (*callback)(uint8_t lines));
     int GetTransmissionTimeInterval();
     int GetProcessingTimeInterval();
-    bool NeedDisplayUpdate();
+    void SetTransmissionTimeInterval(int interval);
+    unsigned long GetHeartbeatTimeInterval();
+    void SetHeartbeatTimeInterval(unsigned long interval);
+    void SetProcessingTimeInterval(int interval);
+    size_t GetBatchSize();
+    void SetBatchSize(size_t size);
+    void SetEventCallback(void (*callback)());
+    void ReceiveAppUpdates();
+    bool PublishStatus();
+    bool PostCommand(uint8_t type, int32_t value, uint8_t sensor = 0);
+    bool RadioUpdatesPending();
+    void ReceiveRadioUpdates();
+    bool GetQueueStats(uint8_t index, LoRaNodeQueueStats& stats);
+    const char* GetSensorName(uint8_t index);
+    SensorStats* GetSensorStats(uint8_t index);
+    bool NeedUplink(unsigned long now);
+    void UplinkSent(unsigned long now);
+    void UplinkFailed();
+    void UplinkStored(unsigned long now);
+    void GetPendingUplink(L2MUplink& payload);
+    unsigned long GetReedSwitchSettleDelay();
   public:
     int TxCounter = 0;
+    // send-on-change statistics
+    unsigned long UplinksOnChange = 0;
+    unsigned long UplinksOnHeartbeat = 0;
+    unsigned long UplinksSuppressed = 0;
+    unsigned long UplinksFailed = 0;
+    unsigned long UplinksStored = 0;
+    LoRaNodeReedStats ReedStats = {};
 
   private:
-    String lastHeading;
+    void CommitUplink(unsigned long now);
+    void SettleReedSwitch(bool level);
+    void SetLineDirty(byte lineNumber);
+    void UpdateCalibrationLine();
+    size_t FormatHeadingLine(char* buffer, size_t size);
+    size_t FormatReedSwitchLine(char* buffer, size_t size);
+    size_t FormatTxCounterLine(char* buffer, size_t size);
+  private:
+    // application task state
+    NodeSensors sensors;
+    uint8_t lastHeadingSector = L2M_HEADING_UNKNOWN;
     bool calibrating = false;
+    int processingInterval;
+    LoRaNodeStatus status = {};
+    uint8_t dirtyLines = (1 << LORA_NODE_DISPLAY_LINES) - 1;   // one bit per display line
+    void (*displayCallback)(uint8_t lines) = NULL;
+    // radio task state: the last application state received, reed switch and mail
+    int txInterval;
+    unsigned long heartbeatInterval;
+    uint8_t headingSector = L2M_HEADING_UNKNOWN;
+    bool reedSwitch = false;
+    bool mail = false;
+    NodeSensors::Readings readings = {};
+    // reed switch debounce: edges of the burst being settled, and the change times
+    bool reedSettling = false;
+    int64_t reedBurstTime = 0;      // first edge of the burst, us
+    int64_t reedEdgeTime = 0;       // last edge of the burst, us
+    bool reedEdgeLevel = false;
+    int64_t reedCloseTime = 0;      // when the switch closed, 0 if unknown
+    int64_t reedEventTime = 0;      // first change not carried by an uplink yet, 0 if none
+    LoRaNodeStatus publishedStatus = { -1, false, false };
+    // state carried by the last uplink, by the uplink in flight, and send-on-change timing
+    uint8_t sentHeadingSector = L2M_HEADING_UNKNOWN;
+    bool sentReedSwitch = false;
+    int pendingCounter = 0;
+    unsigned long pendingCloses = 0;
+    uint8_t pendingHeadingSector = L2M_HEADING_UNKNOWN;
+    bool pendingReedSwitch = false;
+    bool pendingMail = false;
+    int64_t pendingEventTime = 0;
+    bool firstUplink = true;
+    bool heartbeat = false;
+    unsigned long lastUplinkTime = 0;
+    unsigned long lastSlotTime = 0;
+    // samples buffered for the batch codec, batchSize 0 when the codec is not used
+    L2MBatch samples;
+    size_t batchSize = 0;
+    L2MSample lastSample = {};
+    // application -> radio: states and reed switch edges; radio -> application: commands and status
+    SpscQueue<LoRaNodeState, LORA_NODE_QUEUE_SIZE> states;
+    SpscQueue<LoRaNodeEvent, LORA_NODE_EDGE_QUEUE_SIZE> events;
+    SpscQueue<LoRaNodeCommand, LORA_NODE_QUEUE_SIZE> commands;
+    SpscQueue<LoRaNodeStatus, LORA_NODE_QUEUE_SIZE> statuses;
 
+  friend void __ISR_reedSwitch();
 };
 
 extern LoRaNode Node;
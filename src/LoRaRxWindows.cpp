@@ -0,0 +1,175 @@
+#include <LoRaRxWindows.h>
+
+/**
+* LoRaRxWindows Constructor
+* @param radio the LoRa driver
+*/
+LoRaRxWindows::LoRaRxWindows(LoRaClass& radio) :
+  radio(radio),
+  state(RX_OFF),
+  txEndTime(0),
+  closeTime(0),
+  headerDetected(false),
+  symbols(LORA_RX_MIN_SYMBOLS),
+  length(0),
+  downlinkTime(0),
+  downlinkReceived(false),
+  jitter(0)
+{
+
+}
+
+/**
+* Compute the windows timing from the current modem settings
+*/
+void LoRaRxWindows::Configure()
+{
+  uint32_t symbolTime = radio.symbolTime();
+  symbols = LORA_RX_MIN_SYMBOLS + (2000UL * LORA_RX_WINDOW_MARGIN + symbolTime - 1) / symbolTime;
+  // a preamble detected at the end of the symbol timeout, then the rest of the preamble and the header
+  length = (symbols * symbolTime + radio.timeOnAir(0)) / 1000 + 1;
+  downlinkTime = radio.timeOnAir(LORA_DOWNLINK_MAX_SIZE) / 1000 + 1;
+}
+
+/**
+* Start the windows of an uplink
+* @param txEndTime millis() at TxDone
+*/
+void LoRaRxWindows::Start(unsigned long txEndTime)
+{
+  this->txEndTime = txEndTime;
+  downlinkReceived = false;
+  state = RX1_WAIT;
+}
+
+/**
+* Open each window LORA_RX_WINDOW_MARGIN ms ahead of its nominal time with active invert IQ,
+* and put the radio back to sleep once it is over: on RxTimeout, once a downlink is in, when no
+* valid header came in GetLength() ms after the window opened, or GetDownlinkTime() ms after the
+* header. LoraWan principle to avoid node talking to
+* each other: a gateway only reads messages from nodes, and a node only from gateways
+* @param now millis()
+*/
+void LoRaRxWindows::Service(unsigned long now)
+{
+  switch (state)
+  {
+    case RX1_WAIT:
+    case RX2_WAIT:
+    {
+      unsigned long delay = (state == RX1_WAIT) ? LORA_RX1_DELAY : LORA_RX2_DELAY;
+      if ((now - txEndTime) >= (delay - LORA_RX_WINDOW_MARGIN))
+      {
+        radio.enableInvertIQ();
+        radio.receiveSingle(symbols);
+        closeTime = now + length;
+        headerDetected = false;
+        state = (state == RX1_WAIT) ? RX1_OPEN : RX2_OPEN;
+      }
+      break;
+    }
+    case RX1_OPEN:
+    case RX2_OPEN:
+    {
+      int status = radio.receiveSingleStatus();
+      if ((status == LORA_RX_HEADER) && !headerDetected)
+      {
+        // a packet is on air, keep listening until it is in
+        headerDetected = true;
+        closeTime = now + downlinkTime;
+      }
+      // a single window is over once a downlink is in, the radio is back to standby
+      bool downlink = downlinkReceived || (radio.rxQueueDepth() > 0);
+      if ((status == LORA_RX_TIMEOUT) || downlink || ((long)(now - closeTime) >= 0))
+      {
+        // the wideband RSSI is only noisy while receiving, sample the jitter now
+        jitter = radio.random();
+        // a packet completed since the start of this run is queued before the radio sleeps
+        radio.handleInterrupt();
+        radio.sleep();
+        downlink = downlinkReceived || (radio.rxQueueDepth() > 0);
+        state = ((state == RX1_OPEN) && !downlink) ? RX2_WAIT : RX_OFF;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/**
+* A frame for the node came in the current windows: RX2 is skipped
+*/
+void LoRaRxWindows::SetDownlinkReceived()
+{
+  downlinkReceived = true;
+}
+
+/**
+* @param  now millis()
+* @return     millis() of the next window edge, or of the next RX queue poll while a window is
+*             open; now if the windows are off
+*/
+unsigned long LoRaRxWindows::GetNextRun(unsigned long now)
+{
+  switch (state)
+  {
+    case RX1_WAIT:
+      return txEndTime + LORA_RX1_DELAY - LORA_RX_WINDOW_MARGIN;
+    case RX2_WAIT:
+      return txEndTime + LORA_RX2_DELAY - LORA_RX_WINDOW_MARGIN;
+    case RX1_OPEN:
+    case RX2_OPEN:
+      return now + LORA_RX_POLL_INTERVAL;
+    default:
+      return now;
+  }
+}
+
+/**
+* @return the windows state
+*/
+LoRaRxWindowState LoRaRxWindows::GetState()
+{
+  return state;
+}
+
+/**
+* @return true once the windows of the last uplink are over
+*/
+bool LoRaRxWindows::IsOff()
+{
+  return state == RX_OFF;
+}
+
+/**
+* @return window length in symbols, the preamble must be detected by then
+*/
+uint16_t LoRaRxWindows::GetSymbols()
+{
+  return symbols;
+}
+
+/**
+* @return window length in ms when no valid header comes in
+*/
+unsigned long LoRaRxWindows::GetLength()
+{
+  return length;
+}
+
+/**
+* @return ms a window stays open after a valid header
+*/
+unsigned long LoRaRxWindows::GetDownlinkTime()
+{
+  return downlinkTime;
+}
+
+/**
+* @return a random byte sampled from the wideband RSSI at the end of the last window
+*/
+uint8_t LoRaRxWindows::GetJitter()
+{
+  return jitter;
+}
@@ -0,0 +1,73 @@
+#ifndef LORARXWINDOWS_H
+#define LORARXWINDOWS_H
+
+#include <Arduino.h>
+#include <LoRa.h>
+
+// Class A receive windows: the radio sleeps, except for two short receive windows opened
+// LORA_RX1_DELAY and LORA_RX2_DELAY ms after the end of each uplink (TxDone).
+// The gateway must start its downlink preamble at these offsets from the end of the uplink.
+// Windows open LORA_RX_WINDOW_MARGIN ms early and detect a preamble up to LORA_RX_WINDOW_MARGIN
+// ms late (at least LORA_RX_MIN_SYMBOLS symbols). A window closes on RxTimeout, or when no valid
+// header came in by the end of the symbol timeout; once a header is detected it stays open for
+// the time on air of a downlink of up to LORA_DOWNLINK_MAX_SIZE bytes. RX2 is skipped when a
+// downlink came in RX1.
+#ifndef LORA_RX1_DELAY
+#define LORA_RX1_DELAY 1000
+#endif
+#ifndef LORA_RX2_DELAY
+#define LORA_RX2_DELAY 2000
+#endif
+#ifndef LORA_RX_WINDOW_MARGIN
+#define LORA_RX_WINDOW_MARGIN 20
+#endif
+#ifndef LORA_RX_MIN_SYMBOLS
+#define LORA_RX_MIN_SYMBOLS 6
+#endif
+#ifndef LORA_DOWNLINK_MAX_SIZE
+#define LORA_DOWNLINK_MAX_SIZE 64
+#endif
+// the RX queue is polled every LORA_RX_POLL_INTERVAL ms while a window is open
+#ifndef LORA_RX_POLL_INTERVAL
+#define LORA_RX_POLL_INTERVAL 5
+#endif
+
+// RX_OFF -> RX1_WAIT at TxDone -> RX1_OPEN -> RX2_WAIT -> RX2_OPEN -> RX_OFF
+enum LoRaRxWindowState { RX_OFF, RX1_WAIT, RX1_OPEN, RX2_WAIT, RX2_OPEN };
+
+/**
+* Receive windows after each uplink, shared by the firmware radio task and the host tests.
+* The timing is computed from the modem settings by Configure(); Service() opens and closes the
+* windows, and GetNextRun() tells when it must run next. Frames received in a window are
+* queued by the driver, the owner reports them with SetDownlinkReceived().
+*/
+class LoRaRxWindows
+{
+  public:
+    LoRaRxWindows(LoRaClass& radio);
+    void Configure();
+    void Start(unsigned long txEndTime);
+    void Service(unsigned long now);
+    void SetDownlinkReceived();
+    unsigned long GetNextRun(unsigned long now);
+    LoRaRxWindowState GetState();
+    bool IsOff();
+    uint16_t GetSymbols();
+    unsigned long GetLength();
+    unsigned long GetDownlinkTime();
+    uint8_t GetJitter();
+
+  private:
+    LoRaClass& radio;
+    LoRaRxWindowState state;
+    unsigned long txEndTime;        // millis() at TxDone, reference of the windows
+    unsigned long closeTime;        // millis() when the current window closes
+    bool headerDetected;            // a valid header came in the current window
+    uint16_t symbols;               // symbol timeout, computed from the modem settings
+    unsigned long length;           // ms, until the header of a preamble detected at the end of the symbol timeout is in
+    unsigned long downlinkTime;     // ms, from a valid header until a downlink of the largest size is in
+    bool downlinkReceived;          // a frame for the node came in the current windows
+    uint8_t jitter;                 // radio.random() sampled while receiving
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include <NodeSettings.h>
+#include <stddef.h>
+#include <EEPROM.h>
+#include <EepromLock.h>
+#include <L2MCrc16.h>
+
+#define DEBUG_ESP_PORT Serial
+#ifdef DEBUG_ESP_PORT
+#define DEBUG_MSG(...) DEBUG_ESP_PORT.printf( __VA_ARGS__ )
+#else
+#define DEBUG_MSG(...)
+#endif
+
+/**
+* NodeSettings Constructor. The owner sets the defaults before Load()
+*/
+NodeSettings::NodeSettings() :
+  spreadingFactor(7),
+  signalBandwidth(125E3),
+  codingRate(5),
+  txPower(17),
+  transmissionTimeInterval(10000),
+  processingTimeInterval(5000),
+  heartbeatTimeInterval(600000),
+  adr(false)
+{
+
+}
+
+/**
+* Read the settings saved in EEPROM. Settings stay unchanged if none were saved
+* or if the record is corrupted
+* @return true if settings were read
+*/
+bool NodeSettings::Load()
+{
+  Record record;
+  {
+    EepromLock lock;
+    EEPROM.begin(NODE_SETTINGS_EEPROM_SIZE);
+    EEPROM.get(NODE_SETTINGS_EEPROM_ADDRESS, record);
+  }
+  if ((record.version != NODE_SETTINGS_VERSION)
+    || (record.crc != L2MCrc16::compute((const uint8_t*)&record, offsetof(Record, crc))))
+  {
+    DEBUG_MSG("settings: none saved, defaults used\n");
+    return false;
+  }
+  // values are checked again, as if they came from a downlink
+  if (!SetSpreadingFactor(record.spreadingFactor)
+    || !SetSignalBandwidth(record.signalBandwidth)
+    || !SetCodingRate(record.codingRate)
+    || !SetTxPower(record.txPower)
+    || !SetTransmissionTimeInterval(record.transmissionTimeInterval)
+    || !SetProcessingTimeInterval(record.processingTimeInterval)
+    || !SetHeartbeatTimeInterval(record.heartbeatTimeInterval))
+  {
+    DEBUG_MSG("settings: invalid value saved\n");
+  }
+  adr = (record.adr != 0);
+  DEBUG_MSG("settings: SF%u, BW %ld, CR 4/%u, %d dBm, intervals %ld / %ld / %ld ms, ADR %d\n",
+    spreadingFactor, signalBandwidth, codingRate, txPower, transmissionTimeInterval, processingTimeInterval,
+    heartbeatTimeInterval, adr);
+  return true;
+}
+
+/**
+* Save the settings in EEPROM, from the radio task while the app task may save the
+* compass calibration
+*/
+void NodeSettings::Save()
+{
+  Record record;
+  memset(&record, 0, sizeof(record));
+  record.version = NODE_SETTINGS_VERSION;
+  record.spreadingFactor = spreadingFactor;
+  record.codingRate = codingRate;
+  record.txPower = txPower;
+  record.signalBandwidth = signalBandwidth;
+  record.transmissionTimeInterval = transmissionTimeInterval;
+  record.processingTimeInterval = processingTimeInterval;
+  record.heartbeatTimeInterval = heartbeatTimeInterval;
+  record.adr = adr;
+  record.crc = L2MCrc16::compute((const uint8_t*)&record, offsetof(Record, crc));
+  {
+    EepromLock lock;
+    EEPROM.begin(NODE_SETTINGS_EEPROM_SIZE);
+    EEPROM.put(NODE_SETTINGS_EEPROM_ADDRESS, record);
+    EEPROM.commit();
+  }
+  DEBUG_MSG("settings: saved\n");
+}
+
+/**
+* @param  sf spreading factor, 7 to 12
+* @return    false if out of range, the setting is then unchanged
+*/
+bool NodeSettings::SetSpreadingFactor(int sf)
+{
+  if (sf < 7 || sf > 12)
+  {
+    return false;
+  }
+  spreadingFactor = sf;
+  return true;
+}
+
+/**
+* @param  sbw signal bandwidth in Hz, one of the SX1276 bandwidths from 7.8 kHz to 500 kHz
+* @return     false if not supported, the setting is then unchanged
+*/
+bool NodeSettings::SetSignalBandwidth(long sbw)
+{
+  static const long bandwidths[] = { 7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000 };
+  for (unsigned int i = 0; i < sizeof(bandwidths) / sizeof(bandwidths[0]); i++)
+  {
+    if (sbw == bandwidths[i])
+    {
+      signalBandwidth = sbw;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* @param  denominator coding rate 4/denominator, 5 to 8
+* @return             false if out of range, the setting is then unchanged
+*/
+bool NodeSettings::SetCodingRate(int denominator)
+{
+  if (denominator < 5 || denominator > 8)
+  {
+    return false;
+  }
+  codingRate = denominator;
+  return true;
+}
+
+/**
+* @param  level TX power in dBm on PA_BOOST, 2 to 20
+* @return       false if out of range, the setting is then unchanged
+*/
+bool NodeSettings::SetTxPower(int level)
+{
+  if (level < 2 || level > 20)
+  {
+    return false;
+  }
+  txPower = level;
+  return true;
+}
+
+/**
+* @param  interval minimum time between two uplinks in ms, 1 s to 1 day
+* @return          false if out of range, the setting is then unchanged
+*/
+bool NodeSettings::SetTransmissionTimeInterval(long interval)
+{
+  if (interval < 1000 || interval > 86400000L)
+  {
+    return false;
+  }
+  transmissionTimeInterval = interval;
+  return true;
+}
+
+/**
+* @param  interval processing interval in ms, 100 ms to 1 hour
+* @return          false if out of range, the setting is then unchanged
+*/
+bool NodeSettings::SetProcessingTimeInterval(long interval)
+{
+  if (interval < 100 || interval > 3600000L)
+  {
+    return false;
+  }
+  processingTimeInterval = interval;
+  return true;
+}
+
+/**
+* @param  interval time after which an unchanged state is sent again in ms, 1 min to 1 day
+* @return          false if out of range, the setting is then unchanged
+*/
+bool NodeSettings::SetHeartbeatTimeInterval(long interval)
+{
+  if (interval < 60000L || interval > 86400000L)
+  {
+    return false;
+  }
+  heartbeatTimeInterval = interval;
+  return true;
+}
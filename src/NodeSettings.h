@@ -0,0 +1,54 @@
+#ifndef NODESETTINGS_H
+#define NODESETTINGS_H
+
+#include <Arduino.h>
+
+// EEPROM layout: 0-7 compass calibration (QMC5883L), then the node settings
+#define NODE_SETTINGS_EEPROM_ADDRESS 8
+#define NODE_SETTINGS_EEPROM_SIZE 64
+#define NODE_SETTINGS_VERSION 2
+
+/**
+* Node settings changed at runtime by downlink commands or by the ADR, and kept
+* in EEPROM across reboots. Defaults are the compile time settings.
+*/
+class NodeSettings
+{
+  public:
+    NodeSettings();
+    bool Load();
+    void Save();
+    bool SetSpreadingFactor(int sf);
+    bool SetSignalBandwidth(long sbw);
+    bool SetCodingRate(int denominator);
+    bool SetTxPower(int level);
+    bool SetTransmissionTimeInterval(long interval);
+    bool SetProcessingTimeInterval(long interval);
+    bool SetHeartbeatTimeInterval(long interval);
+  public:
+    uint8_t spreadingFactor;
+    long signalBandwidth;
+    uint8_t codingRate;
+    int8_t txPower;
+    long transmissionTimeInterval;
+    long processingTimeInterval;
+    long heartbeatTimeInterval;
+    bool adr;
+
+  private:
+    struct Record
+    {
+      uint8_t version;
+      uint8_t spreadingFactor;
+      uint8_t codingRate;
+      int8_t txPower;
+      int32_t signalBandwidth;
+      int32_t transmissionTimeInterval;
+      int32_t processingTimeInterval;
+      int32_t heartbeatTimeInterval;
+      uint8_t adr;
+      uint16_t crc;
+    };
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include <PartitionFlash.h>
+
+#define DEBUG_ESP_PORT Serial
+#ifdef DEBUG_ESP_PORT
+#define DEBUG_MSG(...) DEBUG_ESP_PORT.printf( __VA_ARGS__ )
+#else
+#define DEBUG_MSG(...)
+#endif
+
+/**
+* @param sectors number of 4 KB sectors used
+* @param subtype data partition subtype
+*/
+PartitionFlash::PartitionFlash(size_t sectors, esp_partition_subtype_t subtype) :
+  partition(NULL),
+  subtype(subtype),
+  sectors(sectors)
+{
+
+}
+
+/**
+* Find the partition
+* @return false if there is none, or if it is too small
+*/
+bool PartitionFlash::begin()
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, subtype, NULL);
+  if (partition == NULL)
+  {
+    DEBUG_MSG("PartitionFlash: no partition\n");
+    return false;
+  }
+  if (partition->size < sectors * SPI_FLASH_SEC_SIZE)
+  {
+    sectors = partition->size / SPI_FLASH_SEC_SIZE;
+  }
+  DEBUG_MSG("PartitionFlash: %s at 0x%x, %u sectors used\n", partition->label, partition->address, sectors);
+  return sectors > 0;
+}
+
+size_t PartitionFlash::sectorSize()
+{
+  return SPI_FLASH_SEC_SIZE;
+}
+
+size_t PartitionFlash::sectorCount()
+{
+  return partition ? sectors : 0;
+}
+
+bool PartitionFlash::read(uint32_t address, uint8_t* buffer, size_t size)
+{
+  return partition && esp_partition_read(partition, address, buffer, size) == ESP_OK;
+}
+
+bool PartitionFlash::program(uint32_t address, const uint8_t* buffer, size_t size)
+{
+  return partition && esp_partition_write(partition, address, buffer, size) == ESP_OK;
+}
+
+bool PartitionFlash::erase(uint32_t sector)
+{
+  return partition && esp_partition_erase_range(partition, sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) == ESP_OK;
+}
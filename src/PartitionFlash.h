@@ -0,0 +1,29 @@
+#ifndef PARTITIONFLASH_H
+#define PARTITIONFLASH_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <L2MFlash.h>
+
+/**
+* L2MFlash over the first sectors of an ESP32 data partition, by default the
+* spiffs partition of the standard partition tables (SPIFFS must not be mounted).
+*/
+class PartitionFlash : public L2MFlash
+{
+  public:
+    PartitionFlash(size_t sectors, esp_partition_subtype_t subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS);
+    bool begin();
+    virtual size_t sectorSize();
+    virtual size_t sectorCount();
+    virtual bool read(uint32_t address, uint8_t* buffer, size_t size);
+    virtual bool program(uint32_t address, const uint8_t* buffer, size_t size);
+    virtual bool erase(uint32_t sector);
+
+  private:
+    const esp_partition_t* partition;
+    esp_partition_subtype_t subtype;
+    size_t sectors;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include <math.h>
 #include "QMC5883L.h"
 #include <EEPROM.h>
+#include <EepromLock.h>
 
 /*
  * QMC5883L
@@ -66,8 +67,8 @@
 #define M_PI 3.14159265358979323846264338327950288
 #endif
 
-/* EEPROM configuration */
-#define EEPROM_SIZE 8
+/* EEPROM configuration: calibration at 0-7, the node settings follow (NodeSettings.h) */
+#define EEPROM_SIZE 64
 
 
 static void write_register( int addr, int reg, int value )
@@ -172,6 +173,7 @@ void QMC5883L::init() {
 
   DEBUG_MSG("read settings from E2PROM ...");
   // retrieve calibration settings from EEPROM
+  EepromLock lock;
   EEPROM.begin(EEPROM_SIZE);
   // xhigh
   EEPROM.get(0, xhigh);
@@ -278,6 +280,8 @@ void QMC5883L::saveCalibrationSettings()
   DEBUG_MSG("xlow = %d, ", xlow);
   DEBUG_MSG("yhigh = %d, ", yhigh);
   DEBUG_MSG("ylow = %d\n", ylow);
+  // the node settings share the buffer, saved from the radio task
+  EepromLock lock;
   // x_high
   EEPROM.put(0, xhigh);
   // x_low
@@ -0,0 +1,300 @@
+#include <Scheduler.h>
+#include <limits.h>
+
+// protects the posted events, shared with the interrupts
+static portMUX_TYPE schedulerMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+* Scheduler Constructor
+*/
+Scheduler::Scheduler() :
+  taskCount(0),
+  posted(0),
+  idleHook(NULL),
+  loopTask(NULL),
+  statsStart(0)
+{
+
+}
+
+/**
+* Add a task, not armed: see SetPeriod, RunAt, RunIn and Post
+* @param  name   task name, for the statistics
+* @param  task   the task function
+* @param  period ms between two runs of a periodic task, 0 for a task run on demand
+* @return        the task id, SCHEDULER_NO_TASK if the task table is full
+*/
+uint8_t Scheduler::Add(const char* name, SchedulerTask task, unsigned long period)
+{
+  if (taskCount >= SCHEDULER_MAX_TASKS)
+  {
+    return SCHEDULER_NO_TASK;
+  }
+  Task& t = tasks[taskCount];
+  memset(&t, 0, sizeof(t));
+  t.name = name;
+  t.task = task;
+  t.period = period;
+  if (period > 0)
+  {
+    t.deadline = millis() + period;
+    t.armed = true;
+  }
+  return taskCount++;
+}
+
+/**
+* Change the period of a task, the next run is one period from now
+* @param id     task id
+* @param period ms, 0 to stop a periodic task
+*/
+void Scheduler::SetPeriod(uint8_t id, unsigned long period)
+{
+  tasks[id].period = period;
+  tasks[id].deadline = millis() + period;
+  tasks[id].armed = (period > 0);
+}
+
+/**
+* Run a task at a given time, in place of its next deadline
+* @param id   task id
+* @param time millis()
+*/
+void Scheduler::RunAt(uint8_t id, unsigned long time)
+{
+  tasks[id].deadline = time;
+  tasks[id].armed = true;
+}
+
+/**
+* Run a task after a delay, in place of its next deadline
+* @param id    task id
+* @param delay ms
+*/
+void Scheduler::RunIn(uint8_t id, unsigned long delay)
+{
+  RunAt(id, millis() + delay);
+}
+
+/**
+* Cancel the next deadline of a task, pending events are kept
+* @param id task id
+*/
+void Scheduler::Cancel(uint8_t id)
+{
+  tasks[id].armed = false;
+}
+
+/**
+* Post an event: the task runs as soon as the running task returns. Several events posted
+* before the task runs make a single run. Safe from an interrupt and from other FreeRTOS
+* tasks, on either core
+* @param id task id
+*/
+void IRAM_ATTR Scheduler::Post(uint8_t id)
+{
+  if (id >= taskCount)
+  {
+    return;
+  }
+  bool isr = xPortInIsrContext();
+  if (isr)
+  {
+    portENTER_CRITICAL_ISR(&schedulerMux);
+  }
+  else
+  {
+    portENTER_CRITICAL(&schedulerMux);
+  }
+  if (!(posted & (1UL << id)))
+  {
+    tasks[id].postTime = micros();
+    posted |= (1UL << id);
+  }
+  if (isr)
+  {
+    portEXIT_CRITICAL_ISR(&schedulerMux);
+  }
+  else
+  {
+    portEXIT_CRITICAL(&schedulerMux);
+  }
+
+  // wake the scheduler task up if it waits in Wait()
+  if (loopTask == NULL)
+  {
+    return;
+  }
+  if (isr)
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(loopTask, &woken);
+    if (woken)
+    {
+      portYIELD_FROM_ISR();
+    }
+  }
+  else
+  {
+    xTaskNotifyGive(loopTask);
+  }
+}
+
+/**
+* Set the idle hook, called when nothing is due
+* @param hook function called with the ms left until the next deadline (ULONG_MAX if none),
+*             typically Wait(). Without hook, RunOnce returns at once
+*/
+void Scheduler::SetIdleHook(void (*hook)(unsigned long timeout))
+{
+  idleHook = hook;
+}
+
+/**
+* Run the next task due: events first, then the earliest deadline. To be invoked in a loop,
+* always from the same FreeRTOS task
+*/
+void Scheduler::RunOnce()
+{
+  if (loopTask == NULL)
+  {
+    loopTask = xTaskGetCurrentTaskHandle();
+  }
+
+  // events, in task order
+  if (posted)
+  {
+    for (uint8_t id = 0; id < taskCount; id++)
+    {
+      if (posted & (1UL << id))
+      {
+        portENTER_CRITICAL(&schedulerMux);
+        posted &= ~(1UL << id);
+        unsigned long postTime = tasks[id].postTime;
+        portEXIT_CRITICAL(&schedulerMux);
+        Run(id, micros() - postTime);
+        return;
+      }
+    }
+  }
+
+  // earliest deadline
+  unsigned long now = millis();
+  uint8_t next = SCHEDULER_NO_TASK;
+  for (uint8_t id = 0; id < taskCount; id++)
+  {
+    if (tasks[id].armed && ((next == SCHEDULER_NO_TASK) || ((long)(tasks[id].deadline - tasks[next].deadline) < 0)))
+    {
+      next = id;
+    }
+  }
+  if ((next != SCHEDULER_NO_TASK) && ((long)(now - tasks[next].deadline) >= 0))
+  {
+    Task& t = tasks[next];
+    unsigned long lateness = now - t.deadline;
+    if (t.period > 0)
+    {
+      // next period, without catching up on the periods missed
+      t.deadline += t.period;
+      if ((long)(now - t.deadline) >= 0)
+      {
+        t.deadline = now + t.period;
+      }
+    }
+    else
+    {
+      t.armed = false;
+    }
+    Run(next, lateness * 1000);
+    return;
+  }
+
+  if (idleHook)
+  {
+    idleHook((next == SCHEDULER_NO_TASK) ? ULONG_MAX : tasks[next].deadline - now);
+  }
+}
+
+/**
+* Block the scheduler task until an event is posted, or for timeout ms. Meant for the idle hook
+* @param timeout ms
+*/
+void Scheduler::Wait(unsigned long timeout)
+{
+  ulTaskNotifyTake(pdTRUE, (timeout == ULONG_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(timeout));
+}
+
+/**
+* Run a task and update its statistics
+* @param id       task id
+* @param lateness us, from the deadline or the event
+*/
+void Scheduler::Run(uint8_t id, unsigned long lateness)
+{
+  Task& t = tasks[id];
+  unsigned long start = micros();
+  t.task();
+  unsigned long duration = micros() - start;
+
+  t.stats.runs++;
+  t.stats.totalDuration += duration;
+  t.stats.totalLateness += lateness;
+  if (lateness > t.stats.maxLateness)
+  {
+    t.stats.maxLateness = lateness;
+  }
+  if (duration > t.stats.maxDuration)
+  {
+    t.stats.maxDuration = duration;
+  }
+}
+
+/**
+* Get the timing statistics of a task
+* @param  id task id
+* @return    the statistics since the last ResetStats
+*/
+const SchedulerTaskStats& Scheduler::GetStats(uint8_t id)
+{
+  return tasks[id].stats;
+}
+
+/**
+* Get the name of a task
+* @param  id task id
+* @return    the name given to Add
+*/
+const char* Scheduler::GetName(uint8_t id)
+{
+  return tasks[id].name;
+}
+
+/**
+* Get the number of tasks
+* @return task ids range from 0 to the number of tasks - 1
+*/
+uint8_t Scheduler::GetTaskCount()
+{
+  return taskCount;
+}
+
+/**
+* Get the time covered by the statistics
+* @return ms since the last ResetStats (since the start if none)
+*/
+unsigned long Scheduler::GetStatsTime()
+{
+  return millis() - statsStart;
+}
+
+/**
+* Start the statistics over
+*/
+void Scheduler::ResetStats()
+{
+  statsStart = millis();
+  for (uint8_t id = 0; id < taskCount; id++)
+  {
+    memset(&tasks[id].stats, 0, sizeof(tasks[id].stats));
+  }
+}
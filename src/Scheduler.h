@@ -0,0 +1,72 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+#define SCHEDULER_MAX_TASKS 8
+#define SCHEDULER_NO_TASK 0xFF
+
+typedef void (*SchedulerTask)();
+
+// timing statistics of a task
+struct SchedulerTaskStats
+{
+  unsigned long runs;
+  unsigned long maxLateness;    // us, from the deadline (or from the event post) to the start of the task
+  unsigned long totalLateness;  // us
+  unsigned long maxDuration;    // us
+  unsigned long totalDuration;  // us, CPU time of the task
+};
+
+/**
+* Cooperative scheduler for a FreeRTOS task (the Arduino loop task, or a task of its own).
+* Tasks run to completion, one at a time, in the FreeRTOS task calling RunOnce. A task is run
+* at a deadline (one-shot or periodic, earliest deadline first), or as soon as possible once
+* an event was posted for it, from an interrupt or from another task, on either core: events
+* go before deadlines. When nothing is due, the idle hook gets the time left until the next
+* deadline; Wait() blocks the FreeRTOS task until then or until the next event, which lets
+* the CPU sleep.
+* Only Post may be called from outside the FreeRTOS task running the scheduler.
+*/
+class Scheduler
+{
+  public:
+    Scheduler();
+    uint8_t Add(const char* name, SchedulerTask task, unsigned long period = 0);
+    void SetPeriod(uint8_t id, unsigned long period);
+    void RunAt(uint8_t id, unsigned long time);
+    void RunIn(uint8_t id, unsigned long delay);
+    void Cancel(uint8_t id);
+    void Post(uint8_t id);
+    void SetIdleHook(void (*hook)(unsigned long timeout));
+    void RunOnce();
+    void Wait(unsigned long timeout);
+    const SchedulerTaskStats& GetStats(uint8_t id);
+    const char* GetName(uint8_t id);
+    uint8_t GetTaskCount();
+    unsigned long GetStatsTime();
+    void ResetStats();
+
+  private:
+    void Run(uint8_t id, unsigned long lateness);
+
+  private:
+    struct Task
+    {
+      const char* name;
+      SchedulerTask task;
+      unsigned long period;     // ms, 0 for one-shot tasks
+      unsigned long deadline;   // millis()
+      bool armed;
+      unsigned long postTime;   // micros() of the first pending event
+      SchedulerTaskStats stats;
+    };
+    Task tasks[SCHEDULER_MAX_TASKS];
+    uint8_t taskCount;
+    volatile uint32_t posted;   // one bit per task with a pending event
+    void (*idleHook)(unsigned long);
+    TaskHandle_t loopTask;        // the FreeRTOS task running the scheduler
+    unsigned long statsStart;     // millis() of the last ResetStats
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef SENSORLIST_H
+#define SENSORLIST_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <L2MBatch.h>
+#include <type_traits>
+
+// time spent in a hook of a sensor, since the last reset
+struct SensorTiming
+{
+  unsigned long runs;
+  unsigned long totalTime;    // us
+  unsigned long maxTime;      // us
+};
+
+// sample is updated by the application task, encode by the radio task
+struct SensorStats
+{
+  SensorTiming sample;
+  SensorTiming encode;
+};
+
+/**
+* Sensors of a node, composed at compile time from a list of sensor types: each hook of the
+* list calls the hook of every sensor in turn, with no virtual call and no allocation.
+*
+* A sensor type provides:
+*   struct Reading                    what the sensor read, copied from the application task
+*                                     to the radio task
+*   static const char* Name()
+*   void Setup()                      application task, from LoRaNode::AppSetup
+*   void Sample(Reading& reading, L2MSample& sample)
+*                                     application task, each processing: reads the sensor, and
+*                                     may fill in the fields of the binary sample it knows
+*   static void Encode(const Reading& reading, JsonDocument& payload)
+*                                     radio task: adds its fields to the JSON uplink
+*   static bool Decode(JsonDocument& payload, int32_t& value)
+*                                     radio task: true if the downlink carries a command for
+*                                     the sensor, with its argument
+*   void Run(int32_t value)           application task: runs the command
+* Encode and Decode are static: they run in the radio task, and must not use the sensor state.
+* The time spent in Sample and Encode is measured per sensor.
+*/
+template <typename... Sensors>
+class SensorList;
+
+template <>
+class SensorList<>
+{
+  public:
+    struct Readings {};
+    static const uint8_t COUNT = 0;
+    void Setup() {}
+    void Sample(Readings& readings, L2MSample& sample) {}
+    void Encode(const Readings& readings, JsonDocument& payload) {}
+    template <typename Post>
+    void Decode(JsonDocument& payload, Post post, uint8_t index = 0) {}
+    void Run(uint8_t index, int32_t value) {}
+    const char* GetName(uint8_t index) { return NULL; }
+    SensorStats* GetStats(uint8_t index) { return NULL; }
+};
+
+template <typename Head, typename... Tail>
+class SensorList<Head, Tail...>
+{
+  public:
+    struct Readings
+    {
+      typename Head::Reading head;
+      typename SensorList<Tail...>::Readings tail;
+    };
+    static const uint8_t COUNT = 1 + SensorList<Tail...>::COUNT;
+
+    SensorList() : stats() {}
+
+    /**
+    * Setup every sensor
+    */
+    void Setup()
+    {
+      head.Setup();
+      tail.Setup();
+    }
+
+    /**
+    * Read every sensor
+    * @param readings the readings of the sensors
+    * @param sample   the binary sample, completed by the sensors
+    */
+    void Sample(Readings& readings, L2MSample& sample)
+    {
+      unsigned long start = micros();
+      head.Sample(readings.head, sample);
+      Account(stats.sample, micros() - start);
+      tail.Sample(readings.tail, sample);
+    }
+
+    /**
+    * Add the fields of every sensor to a JSON uplink
+    * @param readings the readings of the sensors
+    * @param payload  the JSON payload
+    */
+    void Encode(const Readings& readings, JsonDocument& payload)
+    {
+      unsigned long start = micros();
+      Head::Encode(readings.head, payload);
+      Account(stats.encode, micros() - start);
+      tail.Encode(readings.tail, payload);
+    }
+
+    /**
+    * Find the commands of the sensors in a downlink
+    * @param payload the JSON downlink
+    * @param post    called with the sensor index and the command argument, for each command
+    * @param index   index of the first sensor of the list
+    */
+    template <typename Post>
+    void Decode(JsonDocument& payload, Post post, uint8_t index = 0)
+    {
+      int32_t value;
+      if (Head::Decode(payload, value))
+      {
+        post(index, value);
+      }
+      tail.Decode(payload, post, index + 1);
+    }
+
+    /**
+    * Run a command found by Decode
+    * @param index sensor index
+    * @param value command argument
+    */
+    void Run(uint8_t index, int32_t value)
+    {
+      if (index == 0)
+      {
+        head.Run(value);
+      }
+      else
+      {
+        tail.Run(index - 1, value);
+      }
+    }
+
+    /**
+    * @param  index sensor index
+    * @return       the sensor name, NULL past the last sensor
+    */
+    const char* GetName(uint8_t index)
+    {
+      return (index == 0) ? Head::Name() : tail.GetName(index - 1);
+    }
+
+    /**
+    * @param  index sensor index
+    * @return       the sensor timings, NULL past the last sensor
+    */
+    SensorStats* GetStats(uint8_t index)
+    {
+      return (index == 0) ? &stats : tail.GetStats(index - 1);
+    }
+
+    /**
+    * @return the sensor of a type of the list
+    */
+    template <typename Sensor>
+    Sensor& Get()
+    {
+      return Find<Sensor>(std::is_same<Sensor, Head>());
+    }
+
+  private:
+    template <typename Sensor>
+    Sensor& Find(std::true_type)
+    {
+      return head;
+    }
+
+    template <typename Sensor>
+    Sensor& Find(std::false_type)
+    {
+      return tail.template Get<Sensor>();
+    }
+
+    static void Account(SensorTiming& timing, unsigned long duration)
+    {
+      timing.runs++;
+      timing.totalTime += duration;
+      if (duration > timing.maxTime)
+      {
+        timing.maxTime = duration;
+      }
+    }
+
+  private:
+    Head head;
+    SensorList<Tail...> tail;
+    SensorStats stats;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+/**
+* Lock-free queue between one producer and one consumer, which may run on different cores
+* or in an interrupt. Items are copied in and out; the producer publishes an item by moving
+* the head once the item is written, the consumer releases it by moving the tail once it is
+* read. Push and Pop never block: a full queue drops the item and counts it.
+* Depth, maximum depth and drops may be read from anywhere, for the statistics.
+* Push is always inlined, so that an IRAM_ATTR interrupt handler never calls into flash:
+* an instantiated template member has no IRAM placement of its own.
+*/
+template <typename T, size_t N>
+class SpscQueue
+{
+  static_assert((N > 0) && ((N & (N - 1)) == 0), "SpscQueue size must be a power of 2");
+
+  public:
+    SpscQueue() :
+      head(0),
+      tail(0),
+      maxDepth(0),
+      dropped(0)
+    {
+
+    }
+
+    /**
+    * Add an item, producer side
+    * @param  item the item, copied
+    * @return      false if the queue is full, the item is dropped
+    */
+    inline __attribute__((always_inline)) bool Push(const T& item)
+    {
+      uint32_t h = head.load(std::memory_order_relaxed);
+      uint32_t depth = h - tail.load(std::memory_order_acquire);
+      if (depth >= N)
+      {
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+      }
+      items[h & (N - 1)] = item;
+      head.store(h + 1, std::memory_order_release);
+      if (depth + 1 > maxDepth.load(std::memory_order_relaxed))
+      {
+        maxDepth.store(depth + 1, std::memory_order_relaxed);
+      }
+      return true;
+    }
+
+    /**
+    * Take the oldest item, consumer side
+    * @param  item where the item is copied
+    * @return      false if the queue is empty
+    */
+    bool Pop(T& item)
+    {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      if (head.load(std::memory_order_acquire) == t)
+      {
+        return false;
+      }
+      item = items[t & (N - 1)];
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+    * @return the number of items waiting
+    */
+    size_t Depth() const
+    {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    /**
+    * @return the highest number of items waiting since the start
+    */
+    size_t GetMaxDepth() const
+    {
+      return maxDepth.load(std::memory_order_relaxed);
+    }
+
+    /**
+    * @return the number of items dropped on a full queue since the start
+    */
+    unsigned long GetDropped() const
+    {
+      return dropped.load(std::memory_order_relaxed);
+    }
+
+    size_t Capacity() const
+    {
+      return N;
+    }
+
+  private:
+    T items[N];
+    std::atomic<uint32_t> head;       // items pushed, written by the producer only
+    std::atomic<uint32_t> tail;       // items popped, written by the consumer only
+    std::atomic<uint32_t> maxDepth;   // written by the producer only
+    std::atomic<uint32_t> dropped;    // written by the producer only
+};
+
+#endif
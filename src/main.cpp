@@ -1,9 +1,24 @@
 #include <Arduino.h>
+#include <esp_timer.h>
 #include <SPI.h>
+#include <Wire.h>
 #include <LoRa.h>
 #include <U8x8lib.h>
 #include <ArduinoJson.h>
 #include <LoRaNode.h>
+#include <L2MCodec.h>
+#include <L2MCrc16.h>
+#include <L2MFrame.h>
+#include <L2MBatch.h>
+#include <L2MFragment.h>
+#include <LoRaLink.h>
+#include <LoRaRxWindows.h>
+#include <NodeSettings.h>
+#include <LoRaAdr.h>
+#include <L2MRingLog.h>
+#include <PartitionFlash.h>
+#include <Scheduler.h>
+#include <LineDisplay.h>
 
 #define DEBUG_ESP_PORT Serial
 #ifdef DEBUG_ESP_PORT
@@ -22,6 +37,8 @@
 // -------------------------------------------------------
 // LoRa MODEM SETTINGS
 // -------------------------------------------------------
+// spreading factor, bandwidth, coding rate and TX power below are the defaults: they can be
+// changed by downlink commands or by the ADR, and are then kept in EEPROM (NodeSettings)
 // The sync word assures you don't get LoRa messages from other LoRa transceivers
 // ranges from 0-0xFF - make sure that the node is using the same sync word
 #define LORA_SYNC_WORD 0xB2
@@ -47,75 +64,465 @@
 // However, the rise in CR value will also increase the duration for the transmission
 // Supported values are between 5 and 8, these correspond to coding rates of 4/5 and 4/8. The coding rate numerator is fixed at 4
 #define LORA_CODING_RATE_DENOMINATOR 5
+// TX power in dBm on PA_BOOST, 2 to 20
+#define LORA_TX_POWER 17
+// Adaptive data rate, see LoRaAdr. The gateway must follow the node data rate
+// (e.g. a multi spreading factor gateway), and report the uplink SNR in its ACKs
+#define LORA_ADR false
+// Duty cycle
+// ETSI EN 300 220 / ERC 70-03: 865-868 MHz band limited to 1% duty cycle for non specific short range devices.
+// Airtime is accounted over a sliding window of one hour, transmissions exceeding the budget are deferred.
+#define LORA_DUTY_CYCLE_MIN_FREQUENCY 865E6
+#define LORA_DUTY_CYCLE_MAX_FREQUENCY 868E6
+#define LORA_DUTY_CYCLE_PERCENT 1.0
 // -------------------------------------------------------
 // LoRa DATA MODEL CONFIGURATION
 // -------------------------------------------------------
 const char* L2M_NODE_NAME = "node";
 #define LORA_MSG_MAX_SIZE 255
+// Uplink codec
+// L2M_CODEC_JSON: JSON text, e.g. {"node":"NODE_01","pulse_counter":12,"heading":"NE","mail":false} (~70 bytes)
+// L2M_CODEC_MSGPACK: same document serialized with MessagePack (~55 bytes)
+// L2M_CODEC_COMPACT: fixed binary schema, node id, varint counter, heading sector, flags and reed switch closes (~6 bytes)
+// L2M_CODEC_BATCH: samples of each processing interval, heading, raw field and flags, delta encoded
+// several per frame (~7 bytes per sample), see L2MBatch
+// the gateway tells them apart from the message type of the frame header
+#define L2M_UPLINK_CODEC L2M_CODEC_COMPACT
+// Batch codec: a batch is sent once it holds enough samples for its airtime, spread over the
+// samples it carries, to fit in LORA_BATCH_AIRTIME_SHARE % of the duty cycle budget
+#define LORA_BATCH_AIRTIME_SHARE 50
+// Class A receive windows, LORA_RX1_DELAY and LORA_RX2_DELAY ms after the end of each uplink:
+// timing and largest downlink (LORA_DOWNLINK_MAX_SIZE) in LoRaRxWindows.h
+// Confirmed uplinks: the gateway acknowledges each uplink in one of the receive windows,
+// otherwise the uplink is sent again, up to LORA_MAX_RETRIES times, after an exponential backoff
+// (LORA_BACKOFF_BASE ms doubled at each retry, plus up to 100% random jitter)
+#define LORA_CONFIRMED_UPLINKS true
+#define LORA_MAX_RETRIES 3
+#define LORA_BACKOFF_BASE 2000
+// Store-and-forward: a confirmed uplink never acknowledged (e.g. gateway down) is logged in
+// LORA_LOG_SECTORS flash sectors (4 KB, 256 records each) of the spiffs partition, and kept
+// across resets. Once an uplink is acknowledged again, logged records are replayed oldest first,
+// up to LORA_LOG_BATCH records per frame, at most one frame per LORA_LOG_REPLAY_INTERVAL ms
+#define LORA_LOG_SECTORS 8
+#define LORA_LOG_BATCH 16
+#define LORA_LOG_REPLAY_INTERVAL 10000
+// Fragmentation: messages longer than a packet, e.g. the diagnostic snapshot sent on a {"diag":true}
+// downlink, go out in fragments of LORA_FRAGMENT_SIZE bytes. The gateway acknowledges the fragments
+// it holds after the last one of each round, and the missing ones only are sent again (see L2MFragment).
+// Downlinks can be fragmented the same way, in fragments that fit in LORA_DOWNLINK_MAX_SIZE
+#define LORA_FRAGMENT_SIZE 200
+// The radio task tries frames deferred by the duty cycle budget again after LORA_DEFERRED_RETRY ms
+#define LORA_DEFERRED_RETRY 1000
+// A packet whose TxDone did not come LORA_TX_TIMEOUT_MARGIN ms after its time on air is given up
+#define LORA_TX_TIMEOUT_MARGIN 100
+// scheduler statistics (task runs, lateness, duration, CPU time) and queue depths are printed
+// every SCHEDULER_STATS_INTERVAL ms
+#define SCHEDULER_STATS_INTERVAL 60000
+// The radio stack runs in a task of its own, pinned to RADIO_TASK_CORE with a priority above the
+// application (the Arduino loop task runs on the other core at priority 1). The DIO0 interrupt
+// is attached from that task and only wakes it up: all the SPI accesses are made by the task
+#define RADIO_TASK_CORE 0
+#define RADIO_TASK_PRIORITY 3
+#define RADIO_TASK_STACK 8192
+// JSON documents too large for the radio task stack are static: the diagnostic snapshot, and
+// the long downlinks, parsed in place in the reassembly buffer. The parsed strings stay in that
+// buffer, the document only holds the values: a downlink has at most one value every two bytes
+#define DIAG_JSON_CAPACITY 1536
+#define DOWNLINK_JSON_CAPACITY JSON_ARRAY_SIZE(L2M_FRAGMENT_MAX_MESSAGE / 2)
+// The display is drawn by a task of its own, on the application core below the loop task
+// priority. The application sends it the lines that changed through a queue of
+// DISPLAY_QUEUE_SIZE lines, and never waits for the panel; when the queue has no room for
+// the lines changed, it tries again after DISPLAY_RETRY ms
+#define DISPLAY_TASK_CORE 1
+#define DISPLAY_TASK_PRIORITY 0
+#define DISPLAY_TASK_STACK 4096
+#define DISPLAY_QUEUE_SIZE 8
+#define DISPLAY_RETRY 50
 
-// the OLED used
-U8X8_SSD1306_128X64_NONAME_SW_I2C u8x8(/* clock=*/ 15, /* data=*/ 4, /* reset=*/ 16);
+// the OLED used, on the second hardware I2C controller (the compass is on the first one)
+#define OLED_SDA 4
+#define OLED_SCL 15
+#define OLED_RST 16
+U8X8_SSD1306_128X64_NONAME_2ND_HW_I2C u8x8(/* reset=*/ OLED_RST);
+// the node lines, under the node name: changed characters only are drawn
+LineDisplay display(u8x8);
+unsigned long lastDisplayBytes = 0;   // bytes sent to the panel at the last statistics
+
+// display task: draws the lines sent by the application task
+struct DisplayLine
+{
+  uint8_t row;
+  char text[LINE_DISPLAY_COLUMNS + 1];
+  unsigned long time;             // micros() when the line was sent
+};
+SpscQueue<DisplayLine, DISPLAY_QUEUE_SIZE> displayLines;
+// render statistics, since the last report
+struct DisplayStats {
+  unsigned long lines;            // lines drawn
+  unsigned long maxLatency;       // us, from the line sent to the panel written
+  unsigned long totalLatency;     // us
+};
+DisplayStats displayStats = { 0, 0, 0 };
+Scheduler displayScheduler;
+uint8_t renderTask;
+uint8_t displayStatsTask;
+TaskHandle_t displayTaskHandle = NULL;
+void runRender();
+void printDisplayStats();
+void displayIdle(unsigned long timeout);
 
 // White LED management
 #define LED_WHITE 25
 
 // sampling management
-long lastSendTime = 0;    // last send time
-long lastProcessTime = 0; // last processing time
+unsigned long lastSendTime = 0;   // last send time
+
+// application core: the loop task runs the sensor processing, the radio updates (commands and
+// status from the radio task), the display and statistics tasks
+Scheduler scheduler;
+uint8_t processingTask;
+uint8_t messageTask;
+uint8_t displayTask;
+uint8_t statsTask;
+void runProcessing();
+void runMessages();
+void runDisplay();
+void printAppStats();
+void onDisplayChange(uint8_t lines);
+void idle(unsigned long timeout);
+// radio core: the radio task runs the radio stack and its statistics. Both sides exchange the
+// node state through the LoRaNode queues, and wake each other up with Post
+Scheduler radioScheduler;
+uint8_t radioTask;
+uint8_t radioStatsTask;
+TaskHandle_t radioTaskHandle = NULL;
+void runRadio();
+void printRadioStats();
+void onNodeEvent();
+void radioIdle(unsigned long timeout);
+
+// non blocking send pipeline
+// TX_IDLE -> TX_BUSY on sendToLora2MQTTGateway, TX_BUSY -> TX_DONE from the TxDone callback,
+// TX_DONE -> TX_IDLE once the radio task has completed the send
+// confirmed uplinks: TX_DONE -> TX_WAIT_ACK until the ACK (-> TX_IDLE) or the end of the receive windows
+// (-> TX_BACKOFF -> TX_BUSY on retransmission, or -> TX_IDLE once the retries are exhausted)
+enum TxState { TX_IDLE, TX_BUSY, TX_DONE, TX_WAIT_ACK, TX_BACKOFF };
+TxState txState = TX_IDLE;
+unsigned long txStartTime = 0;    // micros() when the packet was handed to the radio
+unsigned long txBusyDeadline = 0; // millis() when the packet is given up without TxDone
+uint8_t txSequence = 0;           // sequence number of the uplink in flight
+uint8_t txRetries = 0;            // retransmissions of the uplink in flight
+unsigned long txFirstTime = 0;    // millis() of the first transmission of the uplink in flight
+unsigned long txDeadline = 0;     // millis() when the backoff ends
+unsigned long txEndTime = 0;      // millis() at TxDone, reference of the receive windows
+volatile int64_t loraInterruptTime = 0; // us, esp_timer_get_time() at the last DIO0 rise
+// what the frame in flight carries
+enum TxFrame { FRAME_UPLINK, FRAME_REPLAY, FRAME_FRAGMENT, FRAME_FRAGMENT_ACK };
+TxFrame txFrame = FRAME_UPLINK;
+
+// receive windows after each uplink
+LoRaRxWindows rxWindows(LoRa);
+
+// confirmed uplink statistics
+struct UplinkStats {
+  unsigned long acknowledged;     // uplinks acknowledged
+  unsigned long retransmissions;  // frames sent again after a missing ACK
+  unsigned long failed;           // uplinks never acknowledged
+  unsigned long lastLatency;      // ms from the first transmission to the ACK
+  unsigned long maxLatency;
+  unsigned long totalLatency;
+  unsigned long replayFrames;     // replay batches acknowledged
+  unsigned long replayRecords;    // logged records delivered by these batches
+  unsigned long oversized;        // frames dropped, payload longer than a packet
+  unsigned long txTimeouts;       // packets given up without TxDone
+};
+UplinkStats uplinkStats = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// store-and-forward log
+PartitionFlash logFlash(LORA_LOG_SECTORS);
+L2MRingLog uplinkLog(logFlash);
+bool logReady = false;            // the log partition is usable
+bool linkUp = true;               // the last confirmed frame was acknowledged, replay is worth a try
+uint32_t txReplayLast = 0;        // sequence number of the last record in the replay batch in flight
+unsigned long lastReplayTime = 0; // millis() of the last replay batch
+
+// long messages
+L2MFragmenter fragmenter;         // uplink message in flight
+L2MReassembler reassembler;       // downlink message being received
+uint8_t fragmentMessageId = 0;    // id of the last uplink message
+uint8_t txFragmentIndex = 0;      // fragment in flight
+bool txFragmentAckRequest = false; // the fragment in flight ends its round
+bool fragmentAckPending = false;  // the gateway requested the acknowledgement of its fragments
+int lastDownlinkMessage = -1;     // id of the last downlink message delivered
+bool diagnosticRequested = false;
+
+// frames to and from the gateway, and the RX filter
+LoRaLink loraLink(LoRa, LORA_MSG_MAX_SIZE);
+
+// runtime settings, and adaptive data rate
+NodeSettings settings;
+LoRaAdr adr;
+bool radioConfigPending = false;  // new modem settings, applied once the radio is idle
+size_t lastTxLength = 0;          // length of the last packet sent, used to estimate the next one
+
+// SPI instrumentation
+unsigned long loopCounter = 0;      // loop task iterations since the last statistics
+unsigned long radioLoopCounter = 0; // radio task iterations since the last statistics
+uint32_t lastSpiSaved = 0;          // LoRa register cache hits at the last statistics
 
 
 /**
-* Set Node in Rx Mode with active invert IQ
-* LoraWan principle to avoid node talking to each other
-* This way a Gateway only reads messages from Nodes and never reads messages from other Gateway, and Node never reads messages from other Node.
+* DIO0 interrupt (TxDone, RxDone): records the time and wakes the radio task up, which serves
+* the radio with LoRa.handleInterrupt(). No SPI here, the bus transactions take a mutex
 */
-void LoRa_rxMode()
+void IRAM_ATTR onLoRaInterrupt()
 {
-  LoRa.enableInvertIQ();                // active invert I and Q signals
-  LoRa.receive();                       // set receive mode
+  loraInterruptTime = esp_timer_get_time();
+  radioScheduler.Post(radioTask);
 }
 
+
 /**
-* Set Node in Tx Mode with active invert IQ
-* LoraWan principle to avoid node talking to each other
-* This way a Gateway only reads messages from Nodes and never reads messages from other Gateway, and Node never reads messages from other Node.
+* TxDone callback, from LoRa.handleInterrupt() in the radio task: the packet is on air.
+* The receive windows are timed from the interrupt, not from the task wake-up
 */
-void LoRa_txMode()
+void onLoRaTxDone()
 {
-  LoRa.idle();                          // set standby mode
-  LoRa.disableInvertIQ();               // normal mode
+  if (txState != TX_BUSY)
+  {
+    // late, the packet was already given up
+    return;
+  }
+  txEndTime = (unsigned long)(loraInterruptTime / 1000);
+  txState = TX_DONE;
 }
 
 
+/**
+* Choose the number of samples per batch from the airtime budget: the smallest batch whose
+* time on air fits in its share of the budget over the sampling periods it covers, and
+* covering at least one transmission interval. Depends on the modem settings and intervals
+*/
+void updateBatchSize()
+{
+#if L2M_UPLINK_CODEC == L2M_CODEC_BATCH
+  // the settings hold the processing interval on the radio side
+  unsigned long period = settings.processingTimeInterval;
+  size_t maxSize = (LORA_MSG_MAX_SIZE - L2M_FRAME_HEADER_SIZE - 2 - L2M_BATCH_HEADER_MAX_SIZE) / L2M_BATCH_RECORD_TYPICAL_SIZE;
+  if (maxSize > L2M_BATCH_MAX_SAMPLES)
+  {
+    maxSize = L2M_BATCH_MAX_SAMPLES;
+  }
+  size_t size = (Node.GetTransmissionTimeInterval() + period - 1) / period;
+  if (size < 1)
+  {
+    size = 1;
+  }
+  for (; size < maxSize; size++)
+  {
+    size_t length = L2M_FRAME_HEADER_SIZE + L2M_BATCH_HEADER_MAX_SIZE + size * L2M_BATCH_RECORD_TYPICAL_SIZE + 2;
+    // time on air against the budget of size sampling periods, us
+    float budget = size * period * 1000.0 * LORA_DUTY_CYCLE_PERCENT / 100 * LORA_BATCH_AIRTIME_SHARE / 100;
+    if (LoRa.timeOnAir(length) <= budget)
+    {
+      break;
+    }
+  }
+  if (size > maxSize)
+  {
+    size = maxSize;
+  }
+  Node.SetBatchSize(size);
+  DEBUG_MSG("batch: %u samples per uplink, one every %lu ms\n", size, size * period);
+#endif
+}
+
+/**
+* Apply the modem settings and compute the receive windows timing from them
+* The radio must not be transmitting nor receiving
+*/
+void LoRa_configure()
+{
+  LoRa.setSpreadingFactor(settings.spreadingFactor);
+  LoRa.setSignalBandwidth(settings.signalBandwidth);
+  LoRa.setCodingRate4(settings.codingRate);
+  LoRa.setTxPower(settings.txPower);
+  radioConfigPending = false;
+  // receive windows timing
+  rxWindows.Configure();
+  DEBUG_MSG("LoRa: SF%u, BW %ld, CR 4/%u, %d dBm, RX windows: %u symbols of %u us, %lu ms, %lu ms after a header\n",
+    settings.spreadingFactor, settings.signalBandwidth, settings.codingRate, settings.txPower,
+    rxWindows.GetSymbols(), LoRa.symbolTime(), rxWindows.GetLength(), rxWindows.GetDownlinkTime());
+  updateBatchSize();
+}
+
+/**
+* Let the ADR adjust the data rate after an ACK or a failed uplink
+* New settings are applied before the next uplink, once the receive windows are over
+*/
+void runAdr()
+{
+  if (settings.adr && adr.Adjust(settings.spreadingFactor, settings.txPower))
+  {
+    DEBUG_MSG("ADR: SF%u, %d dBm\n", settings.spreadingFactor, settings.txPower);
+    radioConfigPending = true;
+    settings.Save();
+  }
+}
+
+/**
+* Downlink commands handled by the node platform, the application ones go to
+* LoRaNode::ParseJSON_RxPayload
+* {"sf":9, "bw":125000, "cr":5, "power":14, "adr":true, "tx_interval":60000, "processing_interval":5000}
+* {"diag":true} requests a diagnostic snapshot, sent as a fragmented message
+* Settings are checked, saved in EEPROM, and modem settings are applied once the receive windows are over
+* @param payload the JSON downlink
+*/
+void applyDownlinkCommands(JsonDocument& payload)
+{
+  bool changed = false;
+  bool radio = false;
+
+  if (payload.containsKey("sf"))
+  {
+    radio |= settings.SetSpreadingFactor(payload["sf"]);
+  }
+  if (payload.containsKey("bw"))
+  {
+    radio |= settings.SetSignalBandwidth(payload["bw"]);
+  }
+  if (payload.containsKey("cr"))
+  {
+    radio |= settings.SetCodingRate(payload["cr"]);
+  }
+  if (payload.containsKey("power"))
+  {
+    radio |= settings.SetTxPower(payload["power"]);
+  }
+  if (payload.containsKey("adr"))
+  {
+    settings.adr = payload["adr"];
+    changed = true;
+  }
+  if (payload.containsKey("tx_interval") && settings.SetTransmissionTimeInterval(payload["tx_interval"]))
+  {
+    Node.SetTransmissionTimeInterval(settings.transmissionTimeInterval);
+    changed = true;
+  }
+  if (payload.containsKey("heartbeat_interval") && settings.SetHeartbeatTimeInterval(payload["heartbeat_interval"]))
+  {
+    Node.SetHeartbeatTimeInterval(settings.heartbeatTimeInterval);
+    changed = true;
+  }
+  if (payload.containsKey("processing_interval") && settings.SetProcessingTimeInterval(payload["processing_interval"]))
+  {
+    // the application task applies it, see runMessages
+    Node.PostCommand(NODE_COMMAND_PROCESSING_INTERVAL, settings.processingTimeInterval);
+    changed = true;
+  }
+  if (payload["diag"] == true)
+  {
+    diagnosticRequested = true;
+  }
+
+  if (radio)
+  {
+    // the gateway chose the data rate, the ADR starts over from there
+    adr.Reset();
+    radioConfigPending = true;
+  }
+  if (radio || changed)
+  {
+    settings.Save();
+  }
+  if (changed && !radio)
+  {
+    // intervals may have changed, LoRa_configure takes care of it otherwise
+    updateBatchSize();
+  }
+}
+
 
 /**
 * initialize LoRa communication with #define settings (pins, SD, bandwidth, coding rate, frequency, sync word)
 * CRC is enabled
+* received packets are queued by the radio task when DIO0 rises
 * set in Rx Mode by default
 */
 void LoRa_initialize()
 {
   //setup LoRa transceiver module
   LoRa.setPins(SS, RST, DIO0);
-  LoRa.setSpreadingFactor(LORA_SPREADING_FACTOR);
-  LoRa.setSignalBandwidth(LORA_SIGNAL_BANDWIDTH);
-  LoRa.setCodingRate4(LORA_CODING_RATE_DENOMINATOR);
+  while (!LoRa.begin(LORA_FREQUENCY)) {
+    DEBUG_MSG(".\n");
+    delay(500);
+  }
+  // modem settings must follow begin(), which resets the radio
+  LoRa_configure();
   // Change sync word (0xF3) to match the receiver
   // The sync word assures you don't get LoRa messages from other LoRa transceivers
   // ranges from 0-0xFF
   LoRa.setSyncWord(LORA_SYNC_WORD);
   LoRa.enableCrc();
+  LoRa.setDutyCycle(LORA_DUTY_CYCLE_MIN_FREQUENCY, LORA_DUTY_CYCLE_MAX_FREQUENCY, LORA_DUTY_CYCLE_PERCENT);
 
-  while (!LoRa.begin(LORA_FREQUENCY)) {
-    DEBUG_MSG(".\n");
-    delay(500);
-  }
-  // set in rx mode.
-  LoRa_rxMode();
+  // DIO0 wakes the radio task up, which pushes received packets into the driver queue
+  // (RxDone), unless the frame header shows they are meant for another node
+  LoRa.onInterrupt(onLoRaInterrupt);
+  loraLink.Begin(Node.GetNodeId(), Node.GetNodeGroup());
+  // transmissions are non blocking, the radio task completes them on TxDone
+  LoRa.onTxDone(onLoRaTxDone);
+  // sleep until the first uplink
+  LoRa.sleep();
+}
+
+/**
+* Read the runtime settings, defaults are the #define settings and the node intervals
+*/
+void loadSettings()
+{
+  settings.SetSpreadingFactor(LORA_SPREADING_FACTOR);
+  settings.SetSignalBandwidth(LORA_SIGNAL_BANDWIDTH);
+  settings.SetCodingRate(LORA_CODING_RATE_DENOMINATOR);
+  settings.SetTxPower(LORA_TX_POWER);
+  settings.SetTransmissionTimeInterval(Node.GetTransmissionTimeInterval());
+  settings.SetProcessingTimeInterval(Node.GetProcessingTimeInterval());
+  settings.SetHeartbeatTimeInterval(Node.GetHeartbeatTimeInterval());
+  settings.adr = LORA_ADR;
+  settings.Load();
+  Node.SetTransmissionTimeInterval(settings.transmissionTimeInterval);
+  Node.SetProcessingTimeInterval(settings.processingTimeInterval);
+  Node.SetHeartbeatTimeInterval(settings.heartbeatTimeInterval);
 }
 
 
 
+/**
+* Radio task: initializes the radio, then runs the radio scheduler on RADIO_TASK_CORE
+* @param parameter unused
+*/
+void radioMain(void* parameter)
+{
+  LoRa_initialize();
+  for (;;)
+  {
+    radioLoopCounter++;
+    radioScheduler.RunOnce();
+  }
+}
+
+/**
+* Display task: runs the display scheduler on DISPLAY_TASK_CORE
+* @param parameter unused
+*/
+void displayMain(void* parameter)
+{
+  for (;;)
+  {
+    displayScheduler.RunOnce();
+  }
+}
+
 void setup()
 {
   //initialize Serial Monitor
@@ -126,145 +533,1067 @@ void setup()
 
   // initilize screen library
   SPI.begin(5, 19, 27, 18);
+  Wire1.begin(OLED_SDA, OLED_SCL);
   u8x8.begin();
-  //u8x8.setFont(u8x8_font_artossans8_r);
-  u8x8.setFont(u8x8_font_5x7_f);
+  //display.Begin(u8x8_font_artossans8_r);
+  display.Begin(u8x8_font_5x7_f);
   u8x8.println(Node.GetNodeName());
-  // initialize LoRa
-  LoRa_initialize();
+  // runtime settings, the radio itself is initialized by the radio task
+  loadSettings();
+  // store-and-forward log, records left by the previous boots are replayed first
+  logReady = logFlash.begin() && uplinkLog.begin();
+  DEBUG_MSG("uplink log: %s, %u records pending, capacity %u\n",
+    logReady ? "ready" : "unavailable", logReady ? uplinkLog.pending() : 0, logReady ? uplinkLog.capacity() : 0);
 
   pinMode(LED_WHITE, OUTPUT);
 
   // call node specific configuration (end user)
   Node.AppSetup();
-}
 
-uint16_t crc16_ccitt(char* data, unsigned int data_len) {
-    uint16_t crc = 0xFFFF;
+  // application tasks, in the loop task
+  processingTask = scheduler.Add("processing", runProcessing, Node.GetProcessingTimeInterval());
+  messageTask = scheduler.Add("messages", runMessages);
+  displayTask = scheduler.Add("display", runDisplay);
+  statsTask = scheduler.Add("stats", printAppStats, SCHEDULER_STATS_INTERVAL);
+  scheduler.SetIdleHook(idle);
+  scheduler.ResetStats();
+  Node.SetDisplayCallback(onDisplayChange);
+  scheduler.Post(displayTask);
 
-    if (data_len == 0)
-        return 0;
+  // radio tasks, the radio task schedules itself from its state
+  radioTask = radioScheduler.Add("radio", runRadio);
+  radioStatsTask = radioScheduler.Add("stats", printRadioStats, SCHEDULER_STATS_INTERVAL);
+  radioScheduler.SetIdleHook(radioIdle);
+  radioScheduler.ResetStats();
+  Node.SetEventCallback(onNodeEvent);
+  radioScheduler.Post(radioTask);
+  xTaskCreatePinnedToCore(radioMain, "radio", RADIO_TASK_STACK, NULL, RADIO_TASK_PRIORITY,
+    &radioTaskHandle, RADIO_TASK_CORE);
 
-    for (unsigned int i = 0; i < data_len; ++i) {
-        uint16_t dbyte = data[i];
-        crc ^= dbyte << 8;
-        
-        for (unsigned char j = 0; j < 8; ++j) {
-            uint16_t mix = crc & 0x8000;
-            crc = (crc << 1);
-            if (mix)
-                crc = crc ^ 0x1021;
-        }
-    }
-
-    return crc;
+  // display tasks, the panel belongs to the display task from now on
+  renderTask = displayScheduler.Add("render", runRender);
+  displayStatsTask = displayScheduler.Add("stats", printDisplayStats, SCHEDULER_STATS_INTERVAL);
+  displayScheduler.SetIdleHook(displayIdle);
+  displayScheduler.ResetStats();
+  xTaskCreatePinnedToCore(displayMain, "display", DISPLAY_TASK_STACK, NULL, DISPLAY_TASK_PRIORITY,
+    &displayTaskHandle, DISPLAY_TASK_CORE);
 }
 
-
 /**
-* [sendToLora2MQTTGateway description]
+* Encode the node uplink with the L2M_UPLINK_CODEC codec
+* @param  out where the payload is written, the frame writer
+* @return     the encoded length
 */
-void sendToLora2MQTTGateway()
+size_t encodeUplink(Print& out)
 {
-  digitalWrite(LED_WHITE, HIGH);
+  size_t length;
+#if L2M_UPLINK_CODEC == L2M_CODEC_COMPACT
+  L2MUplink uplink;
+  uint8_t compact[L2M_COMPACT_MAX_SIZE];
+  Node.AddBinary_TxPayload(uplink);
+  length = out.write(compact, L2MEncodeCompact(uplink, compact, sizeof(compact)));
+  DEBUG_MSG("sendToLora2MQTTGateway: compact payload, %u bytes\n", length);
+#elif L2M_UPLINK_CODEC == L2M_CODEC_BATCH
+  uint8_t batch[LORA_MSG_MAX_SIZE - L2M_FRAME_HEADER_SIZE - 2];
+  length = out.write(batch, Node.AddBatch_TxPayload(batch, sizeof(batch)));
+  DEBUG_MSG("sendToLora2MQTTGateway: batch payload, %u bytes\n", length);
+#else
   StaticJsonDocument<255> payload;
   // preparing JSON payload
   payload[L2M_NODE_NAME] = Node.GetNodeName();
   Node.AddJSON_TxPayload(payload);
-  LoRa_txMode();
-  LoRa.beginPacket();
-  char TXBuffer[LORA_MSG_MAX_SIZE];
-  unsigned int crc16;
-  serializeJson(payload, TXBuffer);
-  DEBUG_MSG("sendToLora2MQTTGateway: payload = %s\n", TXBuffer);
-  crc16 = crc16_ccitt(TXBuffer, strlen(TXBuffer));
-  // serialize json payload
-  //serializeJson(payload, LoRa);
-  LoRa.print(TXBuffer);
-  // add crc after the json payload
-  LoRa.write((uint8_t)(crc16 & 0xff));
-  LoRa.write((uint8_t)((crc16 >> 8) & 0xff));
-  DEBUG_MSG("sendToLora2MQTTGateway: CRC = %x\n", crc16);
-  LoRa.endPacket();
-  LoRa_rxMode();
-  // increment TxCounter
-  Node.TxCounter++;
+#if L2M_UPLINK_CODEC == L2M_CODEC_MSGPACK
+  length = serializeMsgPack(payload, out);
+  DEBUG_MSG("sendToLora2MQTTGateway: MessagePack payload, %u bytes\n", length);
+#else
+  length = serializeJson(payload, out);
+  DEBUG_MSG("sendToLora2MQTTGateway: JSON payload, %u bytes\n", length);
+#endif
+#endif
+  return length;
+}
+
+/**
+* Encode the oldest logged records into a replay batch, see L2MEncodeLogBatch
+* txReplayLast is set to the sequence number of the last record in the batch
+* @param  out where the payload is written, the frame writer
+* @return     the encoded length
+*/
+size_t encodeReplayBatch(Print& out)
+{
+  L2MLogRecord records[LORA_LOG_BATCH];
+  uint8_t batch[LORA_MSG_MAX_SIZE - L2M_FRAME_HEADER_SIZE - 2];
+  size_t count = uplinkLog.peek(records, LORA_LOG_BATCH);
+  size_t encoded;
+  size_t length = L2MEncodeLogBatch(records, count, uplinkLog.boot(), millis() / 1000, batch, sizeof(batch), encoded);
+  if (encoded > 0)
+  {
+    txReplayLast = records[encoded - 1].sequence;
+  }
+  length = out.write(batch, length);
+  DEBUG_MSG("sendToLora2MQTTGateway: replay batch, %u records, %u bytes\n", encoded, length);
+  return length;
+}
+
+/**
+* The frame just built was not sent, oversized or rejected by the duty cycle budget
+* Building an uplink captured the node state: the change is still pending
+*/
+void dropFrame()
+{
+  txState = TX_IDLE;
+  digitalWrite(LED_WHITE, LOW);
+  if (txFrame == FRAME_UPLINK)
+  {
+    Node.UplinkFailed();
+  }
+}
+
+/**
+* [sendToLora2MQTTGateway description]
+* The payload is serialized straight into the radio FIFO, CRC appended on the fly
+* @return false if the message was not sent: deferred because the duty cycle budget is exhausted,
+*         or dropped because it does not fit in a packet (counted in uplinkStats.oversized)
+*/
+bool sendToLora2MQTTGateway()
+{
+  // payloads hardly change in size: check the budget against the last one before
+  // building the payload, which consumes the node events (e.g. mail notification)
+  if (!LoRa.canTransmit(lastTxLength))
+  {
+    DEBUG_MSG("sendToLora2MQTTGateway: deferred, airtime used %u us, available %u us\n",
+      LoRa.airtimeUsed(), LoRa.airtimeAvailable());
+    return false;
+  }
+  digitalWrite(LED_WHITE, HIGH);
+  LoRa.resetSpiTransactionCount();
+  uint8_t type;
+  switch (txFrame)
+  {
+    case FRAME_REPLAY:
+      type = L2M_MSG_LOG | L2M_CODEC_COMPACT;
+      break;
+    case FRAME_FRAGMENT:
+      type = L2M_MSG_FRAGMENT | L2M_CODEC_JSON;
+      break;
+    case FRAME_FRAGMENT_ACK:
+      type = L2M_MSG_FRAGMENT_ACK;
+      break;
+    default:
+      type = (LORA_CONFIRMED_UPLINKS ? L2M_MSG_CONFIRMED : L2M_MSG_UPLINK) | L2M_UPLINK_CODEC;
+      break;
+  }
+  L2MFrameHeader header = { L2M_ADDRESS_GATEWAY, Node.GetNodeId(), type, txSequence };
+  Print& frame = loraLink.BeginFrame(header);
+  uint8_t payload[LORA_MSG_MAX_SIZE - L2M_FRAME_HEADER_SIZE - 2];
+  switch (txFrame)
+  {
+    case FRAME_REPLAY:
+      encodeReplayBatch(frame);
+      break;
+    case FRAME_FRAGMENT:
+      frame.write(payload, fragmenter.encode(txFragmentIndex, txFragmentAckRequest, payload, sizeof(payload)));
+      break;
+    case FRAME_FRAGMENT_ACK:
+      frame.write(payload, reassembler.encodeAck(payload, sizeof(payload)));
+      break;
+    default:
+      encodeUplink(frame);
+      break;
+  }
+  size_t frameLength = loraLink.EndFrame();
+  if (frameLength == 0)
+  {
+    // the payload does not fit in LORA_MSG_MAX_SIZE, the partial packet is dropped
+    uplinkStats.oversized++;
+    DEBUG_MSG("sendToLora2MQTTGateway: payload too long, dropped, %lu so far\n", uplinkStats.oversized);
+    dropFrame();
+    return false;
+  }
+  lastTxLength = frameLength;
+  // hand the packet to the radio and return, the radio task puts it to sleep on TxDone
+  txState = TX_BUSY;
+  txStartTime = micros();
+  txBusyDeadline = millis() + LoRa.timeOnAir(lastTxLength) / 1000 + LORA_TX_TIMEOUT_MARGIN;
+  if (!loraLink.Send())
+  {
+    // rejected by the duty cycle budget
+    DEBUG_MSG("sendToLora2MQTTGateway: rejected, %u rejections so far\n", LoRa.dutyCycleRejectedCount());
+    dropFrame();
+    return false;
+  }
+  DEBUG_MSG("sendToLora2MQTTGateway: SPI transactions = %u\n", LoRa.spiTransactionCount());
+  DEBUG_MSG("sendToLora2MQTTGateway: type %02x, %u bytes on air, time on air %u us, airtime used %u us, available %u us\n",
+    type, lastTxLength, LoRa.timeOnAir(lastTxLength), LoRa.airtimeUsed(), LoRa.airtimeAvailable());
+  return true;
+}
+
+/**
+* Send the frame in flight again, byte for byte: same sequence number and payload, nothing is
+* encoded again
+* @return false if deferred or rejected by the duty cycle budget
+*/
+bool resendToLora2MQTTGateway()
+{
+  if (!LoRa.canTransmit(lastTxLength))
+  {
+    DEBUG_MSG("resendToLora2MQTTGateway: deferred, airtime used %u us, available %u us\n",
+      LoRa.airtimeUsed(), LoRa.airtimeAvailable());
+    return false;
+  }
+  digitalWrite(LED_WHITE, HIGH);
+  txState = TX_BUSY;
+  txStartTime = micros();
+  txBusyDeadline = millis() + LoRa.timeOnAir(lastTxLength) / 1000 + LORA_TX_TIMEOUT_MARGIN;
+  if (!loraLink.Resend())
+  {
+    DEBUG_MSG("resendToLora2MQTTGateway: rejected, %u rejections so far\n", LoRa.dutyCycleRejectedCount());
+    txState = TX_IDLE;
+    digitalWrite(LED_WHITE, LOW);
+    return false;
+  }
+  DEBUG_MSG("resendToLora2MQTTGateway: sequence %u, %u bytes on air\n", txSequence, lastTxLength);
+  return true;
+}
+
+/**
+* Start a new uplink, sent as a new sequence number
+*/
+void startUplink()
+{
+  txFrame = FRAME_UPLINK;
+  txSequence++;
+  txRetries = 0;
+  txFirstTime = millis();
+  // when deferred by the duty cycle budget or dropped as too long, the change is still pending
+  // for the next interval
+  if (sendToLora2MQTTGateway())
+  {
+    // counts uplinks, not transmissions: retransmissions send the same bytes
+    Node.TxCounter++;
+  }
+}
+
+/**
+* Start sending the oldest logged records, as a new sequence number
+* Replay batches are always confirmed: records are acknowledged in the log by the ACK
+*/
+void startReplay()
+{
+  txFrame = FRAME_REPLAY;
+  txSequence++;
+  txRetries = 0;
+  txFirstTime = millis();
+  lastReplayTime = txFirstTime;
+  // when deferred by the duty cycle budget, the records are still pending for the next replay
+  sendToLora2MQTTGateway();
+}
+
+/**
+* Send the next fragment of the uplink message, as a new sequence number
+* The last fragment of a round requests the acknowledgement, and is sent again like a
+* confirmed uplink until the gateway answers
+*/
+void startFragment()
+{
+  int index = fragmenter.nextFragment();
+  if (index < 0)
+  {
+    return;
+  }
+  txFrame = FRAME_FRAGMENT;
+  txFragmentIndex = index;
+  txFragmentAckRequest = fragmenter.isLastOfRound(index);
+  txSequence++;
+  txRetries = 0;
+  txFirstTime = millis();
+  sendToLora2MQTTGateway();
+  if (txState != TX_IDLE)
+  {
+    fragmenter.sent(index);
+  }
+}
+
+/**
+* Tell the gateway which fragments of its downlink message are in, as a new sequence number
+* The receive windows that follow let the gateway send the missing ones
+*/
+void startFragmentAck()
+{
+  txFrame = FRAME_FRAGMENT_ACK;
+  txSequence++;
+  txRetries = 0;
+  txFirstTime = millis();
+  sendToLora2MQTTGateway();
+  if (txState != TX_IDLE)
+  {
+    fragmentAckPending = false;
+  }
+}
+
+/**
+* Snapshot of the node statistics and settings, longer than a packet: sent as a fragmented
+* JSON message, on a {"diag":true} downlink
+*/
+void startDiagnostic()
+{
+  static StaticJsonDocument<DIAG_JSON_CAPACITY> diag;
+  diag.clear();
+  diag[L2M_NODE_NAME] = Node.GetNodeName();
+  diag["uptime"] = millis() / 1000;
+
+  JsonObject radio = diag.createNestedObject("radio");
+  radio["sf"] = settings.spreadingFactor;
+  radio["bw"] = settings.signalBandwidth;
+  radio["cr"] = settings.codingRate;
+  radio["power"] = settings.txPower;
+  radio["adr"] = settings.adr;
+  radio["airtime_used"] = LoRa.airtimeUsed();
+  radio["airtime_available"] = LoRa.airtimeAvailable();
+  radio["duty_cycle_rejected"] = LoRa.dutyCycleRejectedCount();
+  radio["rx_overflows"] = LoRa.rxOverflowCount();
+  radio["rx_crc_errors"] = LoRa.rxCrcErrorCount();
+  radio["rx_filtered"] = LoRa.rxFilteredCount();
+  radio["frame_crc_errors"] = loraLink.GetCrcErrors();
+  radio["stack_free"] = uxTaskGetStackHighWaterMark(radioTaskHandle);
+
+  JsonObject uplinks = diag.createNestedObject("uplinks");
+  uplinks["tx_interval"] = Node.GetTransmissionTimeInterval();
+  uplinks["processing_interval"] = settings.processingTimeInterval;
+  uplinks["heartbeat_interval"] = Node.GetHeartbeatTimeInterval();
+  uplinks["batch_size"] = Node.GetBatchSize();
+  uplinks["sent"] = Node.TxCounter;
+  uplinks["on_change"] = Node.UplinksOnChange;
+  uplinks["on_heartbeat"] = Node.UplinksOnHeartbeat;
+  uplinks["suppressed"] = Node.UplinksSuppressed;
+  uplinks["failed"] = Node.UplinksFailed;
+  uplinks["stored"] = Node.UplinksStored;
+  uplinks["acknowledged"] = uplinkStats.acknowledged;
+  uplinks["retransmissions"] = uplinkStats.retransmissions;
+  uplinks["oversized"] = uplinkStats.oversized;
+  uplinks["tx_timeouts"] = uplinkStats.txTimeouts;
+  uplinks["max_latency"] = uplinkStats.maxLatency;
+  uplinks["avg_latency"] = uplinkStats.acknowledged ? uplinkStats.totalLatency / uplinkStats.acknowledged : 0;
+
+  JsonObject log = diag.createNestedObject("log");
+  log["ready"] = logReady;
+  if (logReady)
+  {
+    log["boot"] = uplinkLog.boot();
+    log["capacity"] = uplinkLog.capacity();
+    log["pending"] = uplinkLog.pending();
+    log["appended"] = uplinkLog.appendedCount();
+    log["dropped"] = uplinkLog.droppedCount();
+  }
+  log["replay_frames"] = uplinkStats.replayFrames;
+  log["replay_records"] = uplinkStats.replayRecords;
+
+  JsonObject reed = diag.createNestedObject("reed");
+  reed["closes"] = Node.ReedStats.closes;
+  reed["opens"] = Node.ReedStats.opens;
+  reed["edges"] = Node.ReedStats.edges;
+  reed["max_closed"] = Node.ReedStats.maxClosedTime;
+  reed["max_latency"] = Node.ReedStats.maxLatency;
+  reed["avg_latency"] = Node.ReedStats.uplinks ? Node.ReedStats.totalLatency / Node.ReedStats.uplinks : 0;
+
+  JsonObject queues = diag.createNestedObject("queues");
+  LoRaNodeQueueStats queue;
+  for (uint8_t i = 0; Node.GetQueueStats(i, queue); i++)
+  {
+    JsonObject q = queues.createNestedObject(queue.name);
+    q["max"] = queue.maxDepth;
+    q["dropped"] = queue.dropped;
+  }
+
+  size_t length = serializeJson(diag, (char*)fragmenter.buffer(), fragmenter.capacity());
+  if (fragmenter.begin(++fragmentMessageId, length, LORA_FRAGMENT_SIZE))
+  {
+    DEBUG_MSG("diagnostic: %u bytes in %u fragments\n", length, fragmenter.fragmentCount());
+  }
+}
+
+/**
+* Complete a send once the radio reported TxDone. Invoked from the radio task
+* The radio sleeps until the first receive window, confirmed uplinks wait for the gateway ACK in there
+*/
+void completeLoRaTransmission()
+{
+  LoRa.sleep();
+  DEBUG_MSG("sendToLora2MQTTGateway: time on air = %lu us\n", micros() - txStartTime);
   digitalWrite(LED_WHITE, LOW);
+  if ((txFrame == FRAME_FRAGMENT) && !txFragmentAckRequest)
+  {
+    // no downlink expected in the middle of a round, the next fragment can go at once
+    txState = TX_IDLE;
+    return;
+  }
+  rxWindows.Start(txEndTime);
+  if (txFrame == FRAME_FRAGMENT_ACK)
+  {
+    txState = TX_IDLE;
+  }
+  else if (LORA_CONFIRMED_UPLINKS || (txFrame != FRAME_UPLINK))
+  {
+    txState = TX_WAIT_ACK;
+  }
+  else
+  {
+    Node.UplinkSent(millis());
+    txState = TX_IDLE;
+  }
+}
+
+/**
+* The gateway acknowledged an uplink
+* @param sequence the sequence number acknowledged
+* @param snr      SNR of the uplink at the gateway, or of the ACK at the node, dB
+*/
+void handleAck(uint8_t sequence, float snr)
+{
+  if ((txState != TX_WAIT_ACK) || (sequence != txSequence) || (txFrame == FRAME_FRAGMENT))
+  {
+    DEBUG_MSG("ACK %u ignored, waiting for %u\n", sequence, txSequence);
+    return;
+  }
+  unsigned long latency = millis() - txFirstTime;
+  uplinkStats.acknowledged++;
+  uplinkStats.lastLatency = latency;
+  uplinkStats.totalLatency += latency;
+  if (latency > uplinkStats.maxLatency)
+  {
+    uplinkStats.maxLatency = latency;
+  }
+  DEBUG_MSG("ACK %u after %u retries, latency %lu ms (max %lu, avg %lu), %lu retransmissions, %lu failed\n",
+    sequence, txRetries, latency, uplinkStats.maxLatency, uplinkStats.totalLatency / uplinkStats.acknowledged,
+    uplinkStats.retransmissions, uplinkStats.failed);
+  adr.AddSnr(snr);
+  runAdr();
+  linkUp = true;
+  if (txFrame == FRAME_REPLAY)
+  {
+    size_t records = uplinkLog.acknowledge(txReplayLast);
+    uplinkStats.replayFrames++;
+    uplinkStats.replayRecords += records;
+    DEBUG_MSG("replay: %u records delivered, %u pending, %lu records in %lu frames so far, %lu dropped\n",
+      records, uplinkLog.pending(), uplinkStats.replayRecords, uplinkStats.replayFrames, uplinkLog.droppedCount());
+  }
+  else
+  {
+    Node.UplinkSent(millis());
+  }
+  txState = TX_IDLE;
+}
+
+/**
+* Log the uplink in flight for replay, the node commits it as if it had been sent
+* Without the log, the change is still pending for the next uplink
+*/
+void storeUplink()
+{
+  L2MUplink uplink;
+  Node.GetPendingUplink(uplink);
+  if (logReady && uplinkLog.append(txFirstTime / 1000, uplink.counter, L2MEncodeFlags(uplink)))
+  {
+    Node.UplinkStored(millis());
+    DEBUG_MSG("uplink log: %u records pending, %lu dropped\n", uplinkLog.pending(), uplinkLog.droppedCount());
+    return;
+  }
+  Node.UplinkFailed();
+}
+
+/**
+* No ACK within the window: schedule a retransmission after an exponential backoff
+* with random jitter, so that nodes which collided do not collide again, or give up
+*/
+void handleAckTimeout()
+{
+  if (txRetries >= LORA_MAX_RETRIES)
+  {
+    uplinkStats.failed++;
+    DEBUG_MSG("uplink %u not acknowledged, %lu failed\n", txSequence, uplinkStats.failed);
+    // stop replaying until the gateway acknowledges again, the batch stays in the log
+    linkUp = false;
+    if (txFrame == FRAME_UPLINK)
+    {
+      storeUplink();
+    }
+    else if (txFrame == FRAME_FRAGMENT)
+    {
+      DEBUG_MSG("fragments: message %u given up\n", fragmenter.messageId());
+      fragmenter.abort();
+    }
+    adr.AckMissed();
+    runAdr();
+    txState = TX_IDLE;
+    return;
+  }
+  unsigned long backoff = (unsigned long)LORA_BACKOFF_BASE << txRetries;
+  backoff += backoff * rxWindows.GetJitter() / 256;
+  txRetries++;
+  txDeadline = millis() + backoff;
+  txState = TX_BACKOFF;
+  DEBUG_MSG("uplink %u not acknowledged, retry %u in %lu ms\n", txSequence, txRetries, backoff);
+}
+
+/**
+* TxDone did not come within the time on air of the packet plus LORA_TX_TIMEOUT_MARGIN: the
+* radio sleeps and the frame is lost, a confirmed one is sent again after the backoff
+*/
+void handleTxTimeout()
+{
+  LoRa.sleep();
+  digitalWrite(LED_WHITE, LOW);
+  uplinkStats.txTimeouts++;
+  DEBUG_MSG("sendToLora2MQTTGateway: no TxDone, %lu timeouts so far\n", uplinkStats.txTimeouts);
+  if ((txFrame == FRAME_FRAGMENT_ACK) || ((txFrame == FRAME_FRAGMENT) && !txFragmentAckRequest))
+  {
+    txState = TX_IDLE;
+  }
+  else if (LORA_CONFIRMED_UPLINKS || (txFrame != FRAME_UPLINK))
+  {
+    // as if the ACK was missing: backoff, or give up once the retries are exhausted
+    handleAckTimeout();
+  }
+  else
+  {
+    Node.UplinkFailed();
+    txState = TX_IDLE;
+  }
+}
+
+/**
+* Send the uplink in flight again once the backoff elapsed, same sequence number and bytes
+*/
+void retransmitUplink()
+{
+  if (resendToLora2MQTTGateway())
+  {
+    uplinkStats.retransmissions++;
+    return;
+  }
+  // deferred by the duty cycle budget, try again after another backoff period
+  txDeadline = millis() + LORA_BACKOFF_BASE;
+  txState = TX_BACKOFF;
+}
+
+/**
+* The gateway acknowledged the fragments it holds: the message is delivered, or the
+* next round carries the missing fragments
+* @param ack    the acknowledgement, frame header excluded
+* @param length acknowledgement length
+*/
+void handleFragmentAck(const uint8_t* ack, size_t length)
+{
+  if ((txState != TX_WAIT_ACK) || (txFrame != FRAME_FRAGMENT) || !fragmenter.acknowledge(ack, length))
+  {
+    DEBUG_MSG("fragment ACK ignored\n");
+    return;
+  }
+  linkUp = true;
+  if (fragmenter.complete())
+  {
+    DEBUG_MSG("fragments: message %u delivered, %u fragments sent for %u in %u rounds, %lu ms\n",
+      fragmenter.messageId(), fragmenter.fragmentsSent(), fragmenter.fragmentCount(), fragmenter.rounds(),
+      millis() - txFirstTime);
+  }
+  else
+  {
+    DEBUG_MSG("fragments: round %u, missing fragments sent again\n", fragmenter.rounds());
+  }
+  txState = TX_IDLE;
+}
+
+/**
+* A fragment of a long downlink message: the message is processed like a downlink once
+* complete, and the fragments received are acknowledged when the gateway asks for it
+* @param header the frame header
+* @param frame  the fragment, frame header excluded
+* @param length fragment length
+*/
+void handleDownlinkFragment(const L2MFrameHeader& header, const uint8_t* frame, size_t length)
+{
+  int result = reassembler.add(frame, length);
+  if (result == L2M_FRAGMENT_INVALID)
+  {
+    DEBUG_MSG("fragments: invalid downlink fragment\n");
+    return;
+  }
+  if (reassembler.ackRequested())
+  {
+    fragmentAckPending = true;
+  }
+  // repeated fragments of a message already delivered are only acknowledged again
+  if ((result != L2M_FRAGMENT_COMPLETE) || (lastDownlinkMessage == reassembler.messageId()))
+  {
+    return;
+  }
+  lastDownlinkMessage = reassembler.messageId();
+  DEBUG_MSG("fragments: downlink message %u, %u bytes\n", reassembler.messageId(), reassembler.length());
+  if ((header.type & L2M_MSG_CODEC_MASK) != L2M_CODEC_JSON)
+  {
+    DEBUG_MSG("unsupported downlink codec\n");
+    return;
+  }
+  // zero-copy: strings are parsed in place, the reassembly buffer is not needed afterwards
+  static StaticJsonDocument<DOWNLINK_JSON_CAPACITY> payload;
+  if (deserializeJson(payload, (char*)reassembler.data(), reassembler.length()))
+  {
+    DEBUG_MSG("deserializeJson error\n");
+    return;
+  }
+  applyDownlinkCommands(payload);
+  Node.ParseJSON_RxPayload(payload);
 }
 
 /**
 * [receiveLoraMessage description]
+* Packets are queued by LoRa.handleInterrupt(), no radio access is needed here
 */
 void receiveLoraMessage()
 {
-  //try to parse packet
-  int packetSize = LoRa.parsePacket();
+  L2MFrameHeader header;
+  const uint8_t* frame;
+  size_t frameLength;
+  // the driver filter already dropped the frames for other nodes, the link the corrupted ones
+  LoRaPacket* packet = loraLink.Receive(header, frame, frameLength);
   // if any packet available
-  if (packetSize)
+  if (packet)
   {
     // received a packet
-    DEBUG_MSG("Packet received: %d\n", packetSize);
+    DEBUG_MSG("Packet received: %d, RSSI %d, queue %d, overflows %u, CRC errors %u / %u\n",
+      packet->length, packet->rssi, LoRa.rxQueueDepth(), LoRa.rxOverflowCount(), LoRa.rxCrcErrorCount(),
+      loraLink.GetCrcErrors());
+    DEBUG_MSG("-tonode %02x from %02x, type %02x, seq %u, %u frames filtered\n",
+      header.destination, header.source, header.type, header.sequence, LoRa.rxFilteredCount());
+
+    rxWindows.SetDownlinkReceived();
+    if ((header.type & L2M_MSG_KIND_MASK) == L2M_MSG_ACK)
+    {
+      // the gateway may report the uplink SNR (quarter dB), otherwise the link is assumed symmetric
+      handleAck(header.sequence, (frameLength >= 1) ? (int8_t)frame[0] / 4.0 : packet->snr());
+      loraLink.Release();
+      return;
+    }
+    if ((header.type & L2M_MSG_KIND_MASK) == L2M_MSG_FRAGMENT_ACK)
+    {
+      handleFragmentAck(frame, frameLength);
+      loraLink.Release();
+      return;
+    }
+    if ((header.type & L2M_MSG_KIND_MASK) == L2M_MSG_FRAGMENT)
+    {
+      handleDownlinkFragment(header, frame, frameLength);
+      loraLink.Release();
+      return;
+    }
 
     // activate LED to show incoming message
     digitalWrite(LED_WHITE, HIGH);
 
-    // parse JSON message
+    // parse JSON message from the queued packet, header and CRC excluded
     StaticJsonDocument<255> payload;
-    DeserializationError error = deserializeJson(payload, LoRa);
+    DeserializationError error = deserializeJson(payload, (char*)frame, frameLength);
+    // only JSON downlinks are supported
+    if ((header.type & L2M_MSG_CODEC_MASK) != L2M_CODEC_JSON)
+    {
+      DEBUG_MSG("unsupported downlink codec\n");
+    }
     // deserializeJson error
-    if (error || (payload[L2M_NODE_NAME].isNull() == true))
+    else if (error)
     {
       DEBUG_MSG("deserializeJson error\n");
       //u8x8.drawString(0, 2, "Rx Error");
-      while(LoRa.read() != -1){}; // flush Rx Buffer
-      return;
     }
     // no error we can process the message
     else
     {
-      String nodeInvoked = payload[L2M_NODE_NAME];
-      // Am I the node invoked for this messages
-      if (nodeInvoked.compareTo(Node.GetNodeName()) == 0)
-      {
-        // I am the one!
-        DEBUG_MSG("-tonode %s\n", nodeInvoked.c_str());
-        Node.ParseJSON_RxPayload(payload);
-      }
+      applyDownlinkCommands(payload);
+      Node.ParseJSON_RxPayload(payload);
     }
-    //}
+    // the payload strings point into the packet, release it only now
+    loraLink.Release();
     digitalWrite(LED_WHITE, LOW);
   }
 }
 
+/**
+* Send the lines the node changed to the display task, from row 2. The lines go out together,
+* or wait until the display task made room for them
+*/
 void refreshDisplay()
 {
-  // display line by line
-  for (int i =2; i < 8; i++)
+  uint8_t dirty = Node.GetDirtyLines();
+  size_t count = 0;
+  for (int i = 1; i <= LORA_NODE_DISPLAY_LINES; i++)
+  {
+    if (dirty & (1 << (i-1)))
+    {
+      count++;
+    }
+  }
+  if (displayLines.Depth() + count > displayLines.Capacity())
+  {
+    scheduler.RunIn(displayTask, DISPLAY_RETRY);
+    return;
+  }
+  for (int i = 1; i <= LORA_NODE_DISPLAY_LINES; i++)
+  {
+    if (dirty & (1 << (i-1)))
+    {
+      DisplayLine line;
+      line.row = i+1;
+      Node.FormatLineToDisplay(i, line.text, sizeof(line.text));
+      line.time = micros();
+      displayLines.Push(line);
+    }
+  }
+  displayScheduler.Post(renderTask);
+}
+
+/**
+* Render task, posted by the application task: takes the lines sent, and draws what changed
+* on the panel. Several changes of a line in the queue make a single drawing
+*/
+void runRender()
+{
+  unsigned long sent[DISPLAY_QUEUE_SIZE];
+  size_t count = 0;
+  DisplayLine line;
+  while ((count < DISPLAY_QUEUE_SIZE) && displayLines.Pop(line))
+  {
+    display.SetLine(line.row, line.text);
+    sent[count++] = line.time;
+  }
+  display.Render();
+
+  unsigned long now = micros();
+  for (size_t i = 0; i < count; i++)
   {
-    u8x8.clearLine(i);
-    u8x8.drawString(0, i, Node.GetLineToDisplay(i-1));
+    unsigned long latency = now - sent[i];
+    displayStats.lines++;
+    displayStats.totalLatency += latency;
+    if (latency > displayStats.maxLatency)
+    {
+      displayStats.maxLatency = latency;
+    }
+  }
+  if (displayLines.Depth() > 0)
+  {
+    displayScheduler.Post(renderTask);
   }
 }
 
 /**
-* Main loop of the LoRa Node
-* Constantly try to receive JSON LoRa message
-* Every transmissionTimeInterval send JSON LoRa messages
+* Sensor processing task, every processing time interval
 */
-void loop() {
-  if ( (millis() - lastProcessTime) > Node.GetProcessingTimeInterval() )
+void runProcessing()
+{
+  Node.AppProcessing();
+  // the node state may have changed, the display is notified by the node
+  radioScheduler.Post(radioTask);
+}
+
+/**
+* Radio updates task, posted by the radio task: downlink commands and uplink status for the
+* application side
+*/
+void runMessages()
+{
+  static int processingPeriod = Node.GetProcessingTimeInterval();
+  Node.ReceiveRadioUpdates();
+  if (Node.GetProcessingTimeInterval() != processingPeriod)
+  {
+    processingPeriod = Node.GetProcessingTimeInterval();
+    scheduler.SetPeriod(processingTask, processingPeriod);
+  }
+}
+
+/**
+* @return the earliest of two millis() times, across the millis() wrap around
+*/
+unsigned long earliest(unsigned long a, unsigned long b)
+{
+  return ((long)(a - b) < 0) ? a : b;
+}
+
+/**
+* Next run of the radio task: the next receive window edge (polling the RX queue while a
+* window is open), the end of the backoff, the next transmission opportunity, or the end of
+* the reed switch debounce. The DIO0 interrupt and the node events post the task in between
+*/
+void scheduleRadio()
+{
+  unsigned long now = millis();
+  unsigned long next;
+  switch (rxWindows.GetState())
+  {
+    case RX1_WAIT:
+    case RX2_WAIT:
+    case RX1_OPEN:
+    case RX2_OPEN:
+      next = rxWindows.GetNextRun(now);
+      break;
+    default:
+      if (txState == TX_BUSY)
+      {
+        // until TxDone, or until the packet is given up
+        next = txBusyDeadline;
+        break;
+      }
+      if (txState == TX_BACKOFF)
+      {
+        next = txDeadline;
+        break;
+      }
+      // the next uplink opportunity, or the next reporting period for the heartbeat
+      next = lastSendTime + Node.GetTransmissionTimeInterval() + 1;
+      if ((long)(next - now) <= 0)
+      {
+        next = now + Node.GetTransmissionTimeInterval();
+      }
+      // long messages and replay, when deferred by the duty cycle budget
+      if (fragmenter.active() || fragmentAckPending)
+      {
+        next = earliest(next, now + LORA_DEFERRED_RETRY);
+      }
+      if (logReady && linkUp && (uplinkLog.pending() > 0))
+      {
+        unsigned long replay = lastReplayTime + LORA_LOG_REPLAY_INTERVAL + 1;
+        next = earliest(next, ((long)(replay - now) <= 0) ? now + LORA_DEFERRED_RETRY : replay);
+      }
+      break;
+  }
+  unsigned long settle = Node.GetReedSwitchSettleDelay();
+  if (settle > 0)
+  {
+    next = earliest(next, now + settle);
+  }
+  radioScheduler.RunAt(radioTask, next);
+}
+
+/**
+* Radio task: completes transmissions, runs the receive windows, processes the received
+* frames, and starts the next frame when one is due
+*/
+void runRadio()
+{
+  // node state from the application task and the reed switch interrupt
+  Node.ReceiveAppUpdates();
+  // TxDone and RxDone raised since the last run
+  LoRa.handleInterrupt();
+  if (txState == TX_DONE)
+  {
+    completeLoRaTransmission();
+  }
+  if ( (txState == TX_BUSY) && ((long)(millis() - txBusyDeadline) >= 0) )
+  {
+    handleTxTimeout();
+  }
+  rxWindows.Service(millis());
+  while (LoRa.rxQueueDepth() > 0)
+  {
+    receiveLoraMessage();
+  }
+  if ( (txState == TX_WAIT_ACK) && rxWindows.IsOff() )
   {
-    Node.AppProcessing();
-    lastProcessTime = millis();
+    handleAckTimeout();
   }
-  if ( (millis() - lastSendTime) > Node.GetTransmissionTimeInterval() )
+  if ( (txState == TX_BACKOFF) && ((long)(millis() - txDeadline) >= 0) )
   {
-    sendToLora2MQTTGateway();
+    retransmitUplink();
+  }
+  if ( radioConfigPending && rxWindows.IsOff() && ((txState == TX_IDLE) || (txState == TX_BACKOFF)) )
+  {
+    LoRa_configure();
+  }
+  // send on change or heartbeat, at most once per transmission interval
+  // a deferred message is retried at the next transmission interval
+  if ( (txState == TX_IDLE) && rxWindows.IsOff()
+    && ((millis() - lastSendTime) > (unsigned long)Node.GetTransmissionTimeInterval()) && Node.NeedUplink(millis()) )
+  {
+    startUplink();
     lastSendTime = millis();            // timestamp the message
   }
-  receiveLoraMessage();
-  if (Node.NeedDisplayUpdate())
+  // long messages, after the live uplinks
+  if ( fragmentAckPending && (txState == TX_IDLE) && rxWindows.IsOff() )
+  {
+    startFragmentAck();
+  }
+  if ( diagnosticRequested && !fragmenter.active() )
+  {
+    diagnosticRequested = false;
+    startDiagnostic();
+  }
+  if ( fragmenter.active() && (txState == TX_IDLE) && rxWindows.IsOff() )
+  {
+    startFragment();
+  }
+  // replay the log while the gateway answers, live uplinks first
+  if ( logReady && linkUp && (txState == TX_IDLE) && rxWindows.IsOff() && (uplinkLog.pending() > 0)
+    && ((millis() - lastReplayTime) > LORA_LOG_REPLAY_INTERVAL) )
+  {
+    startReplay();
+  }
+  // uplink status and downlink commands for the application task
+  Node.PublishStatus();
+  if (Node.RadioUpdatesPending())
+  {
+    scheduler.Post(messageTask);
+  }
+  scheduleRadio();
+}
+
+/**
+* Display task, posted when a line of the node changed: sends the lines changed to the display task
+*/
+void runDisplay()
+{
+  if (Node.GetDirtyLines())
   {
     refreshDisplay();
   }
 }
+
+/**
+* Print the statistics of a scheduler since the last report: runs, lateness (wake-up latency
+* for the posted tasks, jitter for the periodic ones), duration and CPU time of each task
+* @param s     the scheduler
+* @param label the FreeRTOS task running it
+*/
+void printSchedulerStats(Scheduler& s, const char* label)
+{
+  unsigned long elapsed = s.GetStatsTime();
+  unsigned long busy = 0;
+  for (uint8_t id = 0; id < s.GetTaskCount(); id++)
+  {
+    const SchedulerTaskStats& stats = s.GetStats(id);
+    DEBUG_MSG("%s: %-10s %5lu runs, lateness avg %lu us max %lu us, duration max %lu us, cpu %lu us (%.2f%%)\n",
+      label, s.GetName(id), stats.runs, stats.runs ? stats.totalLateness / stats.runs : 0,
+      stats.maxLateness, stats.maxDuration, stats.totalDuration,
+      elapsed ? stats.totalDuration / (elapsed * 10.0) : 0.0);
+    busy += stats.totalDuration;
+  }
+  DEBUG_MSG("%s: core %d, cpu %.2f%% over %lu ms\n", label, xPortGetCoreID(),
+    elapsed ? busy / (elapsed * 10.0) : 0.0, elapsed);
+  s.ResetStats();
+}
+
+/**
+* Application statistics task: application tasks, loop iterations and queues
+*/
+void printAppStats()
+{
+  printSchedulerStats(scheduler, "app");
+  DEBUG_MSG("app: %lu loop iterations\n", loopCounter);
+  loopCounter = 0;
+  LoRaNodeQueueStats queue;
+  for (uint8_t i = 0; Node.GetQueueStats(i, queue); i++)
+  {
+    DEBUG_MSG("queue: %-8s depth %u/%u, max %u, %lu dropped\n",
+      queue.name, queue.depth, queue.capacity, queue.maxDepth, queue.dropped);
+  }
+  SensorStats* sensor;
+  for (uint8_t i = 0; (sensor = Node.GetSensorStats(i)) != NULL; i++)
+  {
+    DEBUG_MSG("sensor: %-12s sample %lu runs, avg %lu us, max %lu us\n", Node.GetSensorName(i),
+      sensor->sample.runs, sensor->sample.runs ? sensor->sample.totalTime / sensor->sample.runs : 0,
+      sensor->sample.maxTime);
+    memset(&sensor->sample, 0, sizeof(sensor->sample));
+  }
+}
+
+/**
+* Display statistics task: display tasks, render latency, line queue and bytes sent to the panel
+*/
+void printDisplayStats()
+{
+  printSchedulerStats(displayScheduler, "display");
+  DEBUG_MSG("display: %lu lines, latency avg %lu us max %lu us, queue depth %u/%u max %u, %lu bytes sent to the panel\n",
+    displayStats.lines, displayStats.lines ? displayStats.totalLatency / displayStats.lines : 0,
+    displayStats.maxLatency, displayLines.Depth(), displayLines.Capacity(), displayLines.GetMaxDepth(),
+    display.GetBytesSent() - lastDisplayBytes);
+  lastDisplayBytes = display.GetBytesSent();
+  memset(&displayStats, 0, sizeof(displayStats));
+}
+
+/**
+* Radio statistics task: radio tasks, iterations and LoRa register cache
+*/
+void printRadioStats()
+{
+  printSchedulerStats(radioScheduler, "radio");
+  uint32_t spiSaved = LoRa.spiTransactionsSaved();
+  DEBUG_MSG("radio: %lu iterations, %u SPI transactions saved by the register cache (%.3f per iteration)\n",
+    radioLoopCounter, spiSaved - lastSpiSaved,
+    radioLoopCounter ? (float)(spiSaved - lastSpiSaved) / radioLoopCounter : 0.0);
+  lastSpiSaved = spiSaved;
+  radioLoopCounter = 0;
+  DEBUG_MSG("radio: stack %u bytes, %u never used\n", RADIO_TASK_STACK, uxTaskGetStackHighWaterMark(radioTaskHandle));
+  const LoRaNodeReedStats& reed = Node.ReedStats;
+  DEBUG_MSG("reed: %lu edges, %lu closes, %lu opens, closed last %lu ms max %lu ms, latency to uplink avg %lu ms max %lu ms over %lu uplinks\n",
+    reed.edges, reed.closes, reed.opens, reed.lastClosedTime, reed.maxClosedTime,
+    reed.uplinks ? reed.totalLatency / reed.uplinks : 0, reed.maxLatency, reed.uplinks);
+  SensorStats* sensor;
+  for (uint8_t i = 0; (sensor = Node.GetSensorStats(i)) != NULL; i++)
+  {
+    DEBUG_MSG("sensor: %-12s encode %lu runs, avg %lu us, max %lu us\n", Node.GetSensorName(i),
+      sensor->encode.runs, sensor->encode.runs ? sensor->encode.totalTime / sensor->encode.runs : 0,
+      sensor->encode.maxTime);
+    memset(&sensor->encode, 0, sizeof(sensor->encode));
+  }
+}
+
+/**
+* Node events (reed switch interrupt): the uplink decision is due, the radio task updates
+* the display through the status it publishes
+*/
+void IRAM_ATTR onNodeEvent()
+{
+  radioScheduler.Post(radioTask);
+}
+
+/**
+* Node display lines changed (application task): the display task sends them
+* @param lines one bit per line changed
+*/
+void onDisplayChange(uint8_t lines)
+{
+  scheduler.Post(displayTask);
+}
+
+/**
+* Idle hook of the loop task: nothing is due for timeout ms, the task blocks until then or
+* until an event is posted, and the CPU sleeps meanwhile
+* @param timeout ms until the next deadline
+*/
+void idle(unsigned long timeout)
+{
+  scheduler.Wait(timeout);
+}
+
+/**
+* Idle hook of the radio task, see idle
+* @param timeout ms until the next deadline
+*/
+void radioIdle(unsigned long timeout)
+{
+  radioScheduler.Wait(timeout);
+}
+
+/**
+* Idle hook of the display task, see idle
+* @param timeout ms until the next deadline
+*/
+void displayIdle(unsigned long timeout)
+{
+  displayScheduler.Wait(timeout);
+}
+
+/**
+* Main loop of the LoRa Node, application core
+* Runs the application scheduler: one task per iteration, or waits for the next one
+*/
+void loop() {
+  loopCounter++;
+  scheduler.RunOnce();
+}
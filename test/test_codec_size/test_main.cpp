@@ -0,0 +1,194 @@
+#include <Arduino.h>
+#include <LoRa.h>
+#include <SX1276Sim.h>
+#include <ArduinoJson.h>
+#include <L2MBatch.h>
+#include <L2MCodec.h>
+#include <L2MFrame.h>
+#include <unity.h>
+#include <stdio.h>
+
+#define NODE_ID 1
+#define FRAME_OVERHEAD (L2M_FRAME_HEADER_SIZE + 2)
+#define BATCH_SAMPLES 8
+
+SX1276Sim sim;
+
+// the uplink of src/main.cpp, as its codecs encode it
+const uint32_t txCounter = 1234;
+const uint32_t pulseCounter = 56;
+const uint32_t closedTime = 1200;
+const int heading = 47;
+
+void setUp()
+{
+  sim = SX1276Sim();
+  LoRa.setTransport(sim);
+  TEST_ASSERT_EQUAL(1, LoRa.begin(866E6));
+  LoRa.setSignalBandwidth(125E3);
+  LoRa.setCodingRate4(5);
+  LoRa.enableCrc();
+}
+
+void tearDown()
+{
+  LoRa.end();
+}
+
+void fillJson(JsonDocument& payload)
+{
+  payload["node"] = "NODE_01";
+  payload["tx_counter"] = txCounter;
+  payload["pulse_counter"] = pulseCounter;
+  payload["closed_time"] = closedTime;
+  payload["heading"] = L2MHeadingName(L2MHeadingSector(heading));
+  payload["temperature"] = 21.5;
+  payload["mail"] = false;
+}
+
+size_t encodeJson(uint8_t* buffer, size_t size)
+{
+  StaticJsonDocument<255> payload;
+  fillJson(payload);
+  return serializeJson(payload, (char*)buffer, size);
+}
+
+size_t encodeMsgPack(uint8_t* buffer, size_t size)
+{
+  StaticJsonDocument<255> payload;
+  fillJson(payload);
+  return serializeMsgPack(payload, (char*)buffer, size);
+}
+
+size_t encodeCompact(uint8_t* buffer, size_t size)
+{
+  L2MUplink uplink = { NODE_ID, txCounter, L2MHeadingSector(heading), false, true, pulseCounter };
+  return L2MEncodeCompact(uplink, buffer, size);
+}
+
+/**
+* A batch of slowly changing samples, one per 5 s processing
+*/
+size_t encodeBatch(uint8_t* buffer, size_t size)
+{
+  L2MBatch batch;
+  for (int i = 0; i < BATCH_SAMPLES; i++) {
+    L2MSample sample = { (uint32_t)i * 5000, (int16_t)(heading + i % 3), (int16_t)(-210 + i), 85, (int16_t)(412 - i), i > 4, false, pulseCounter + (i > 4) };
+    batch.add(sample);
+  }
+  return batch.encode(NODE_ID, txCounter, BATCH_SAMPLES * 5000, buffer, size);
+}
+
+void test_codecs_detected()
+{
+  uint8_t buffer[LORA_MAX_PACKET_LENGTH];
+
+  TEST_ASSERT_EQUAL(L2M_CODEC_JSON, L2MDetectCodec(buffer, encodeJson(buffer, sizeof(buffer))));
+  TEST_ASSERT_EQUAL(L2M_CODEC_MSGPACK, L2MDetectCodec(buffer, encodeMsgPack(buffer, sizeof(buffer))));
+  TEST_ASSERT_EQUAL(L2M_CODEC_COMPACT, L2MDetectCodec(buffer, encodeCompact(buffer, sizeof(buffer))));
+  TEST_ASSERT_EQUAL(L2M_CODEC_BATCH, L2MDetectCodec(buffer, encodeBatch(buffer, sizeof(buffer))));
+}
+
+void test_compact_roundtrip()
+{
+  uint8_t buffer[L2M_COMPACT_MAX_SIZE];
+  size_t length = encodeCompact(buffer, sizeof(buffer));
+  L2MUplink uplink;
+
+  TEST_ASSERT_LESS_OR_EQUAL(L2M_COMPACT_MAX_SIZE, length);
+  TEST_ASSERT_TRUE(L2MDecodeCompact(buffer, length, uplink));
+  TEST_ASSERT_EQUAL(NODE_ID, uplink.nodeId);
+  TEST_ASSERT_EQUAL_UINT32(txCounter, uplink.counter);
+  TEST_ASSERT_EQUAL(L2M_HEADING_NE, uplink.heading);
+  TEST_ASSERT_FALSE(uplink.mail);
+  TEST_ASSERT_TRUE(uplink.reedSwitch);
+  TEST_ASSERT_EQUAL_UINT32(pulseCounter, uplink.closes);
+}
+
+void test_compact_from_older_nodes()
+{
+  // frames without the close count, ending with the flags
+  uint8_t buffer[L2M_COMPACT_MAX_SIZE];
+  size_t length = encodeCompact(buffer, sizeof(buffer)) - 1;
+  L2MUplink uplink;
+
+  TEST_ASSERT_TRUE(L2MDecodeCompact(buffer, length, uplink));
+  TEST_ASSERT_EQUAL_UINT32(txCounter, uplink.counter);
+  TEST_ASSERT_TRUE(uplink.reedSwitch);
+  TEST_ASSERT_EQUAL_UINT32(0, uplink.closes);
+}
+
+void test_batch_roundtrip()
+{
+  uint8_t buffer[LORA_MAX_PACKET_LENGTH];
+  size_t length = encodeBatch(buffer, sizeof(buffer));
+  L2MSample samples[BATCH_SAMPLES];
+  uint8_t nodeId;
+  uint32_t counter;
+
+  TEST_ASSERT_EQUAL(BATCH_SAMPLES, L2MDecodeBatch(buffer, length, 100000, nodeId, counter, samples, BATCH_SAMPLES));
+  TEST_ASSERT_EQUAL(NODE_ID, nodeId);
+  TEST_ASSERT_EQUAL_UINT32(txCounter, counter);
+  for (int i = 0; i < BATCH_SAMPLES; i++) {
+    TEST_ASSERT_EQUAL_INT16(heading + i % 3, samples[i].heading);
+    TEST_ASSERT_EQUAL_INT16(412 - i, samples[i].z);
+    TEST_ASSERT_EQUAL(i > 4, samples[i].reedSwitch);
+    TEST_ASSERT_EQUAL_UINT32(pulseCounter + (i > 4), samples[i].closes);
+  }
+}
+
+void test_time_on_air_matches_radio()
+{
+  uint8_t buffer[LORA_MAX_PACKET_LENGTH];
+  size_t length = encodeJson(buffer, sizeof(buffer)) + FRAME_OVERHEAD;
+
+  LoRa.setSpreadingFactor(7);
+  LoRa.beginPacket();
+  LoRa.write(buffer, length);
+  LoRa.endPacket(true);
+
+  TEST_ASSERT_EQUAL_UINT32(sim.lastTimeOnAir(), LoRa.timeOnAir(length));
+}
+
+void benchmark_bytes_and_airtime()
+{
+  const char* names[] = { "JSON", "MsgPack", "compact", "batch/8" };
+  size_t (*encoders[])(uint8_t*, size_t) = { encodeJson, encodeMsgPack, encodeCompact, encodeBatch };
+  uint8_t buffer[LORA_MAX_PACKET_LENGTH];
+  size_t frames[4];
+  char message[128];
+
+  TEST_MESSAGE("codec     payload  on air  SF7 ToA  SF12 ToA  (per sample)");
+  for (int i = 0; i < 4; i++) {
+    size_t payload = encoders[i](buffer, sizeof(buffer));
+    frames[i] = payload + FRAME_OVERHEAD;
+    int samples = (i == 3) ? BATCH_SAMPLES : 1;
+
+    LoRa.setSpreadingFactor(7);
+    uint32_t sf7 = LoRa.timeOnAir(frames[i]);
+    LoRa.setSpreadingFactor(12);
+    uint32_t sf12 = LoRa.timeOnAir(frames[i]);
+
+    snprintf(message, sizeof(message), "%-8s  %5u B  %4u B  %5.1f ms  %6.1f ms  (%.1f B, %.1f ms at SF12)",
+             names[i], (unsigned)payload, (unsigned)frames[i], sf7 / 1000.0, sf12 / 1000.0,
+             (double)frames[i] / samples, sf12 / 1000.0 / samples);
+    TEST_MESSAGE(message);
+  }
+
+  // the binary codecs carry the same fields in a fraction of the bytes
+  TEST_ASSERT_LESS_THAN(frames[0], frames[1]);
+  TEST_ASSERT_LESS_THAN(frames[0] / 4, frames[2]);
+  TEST_ASSERT_LESS_THAN(frames[2], frames[3] / BATCH_SAMPLES);
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_codecs_detected);
+  RUN_TEST(test_compact_roundtrip);
+  RUN_TEST(test_compact_from_older_nodes);
+  RUN_TEST(test_batch_roundtrip);
+  RUN_TEST(test_time_on_air_matches_radio);
+  RUN_TEST(benchmark_bytes_and_airtime);
+  return UNITY_END();
+}
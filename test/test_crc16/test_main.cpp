@@ -0,0 +1,197 @@
+#include <L2MCrc16.h>
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define RANDOM_FRAMES 100000
+#define BENCHMARK_BYTES (4UL * 1024 * 1024)
+
+/**
+* The bit-serial CRC that main.cpp used before L2MCrc16, kept verbatim as the
+* reference: frames on air must not change
+*/
+uint16_t crc16_ccitt(char* data, unsigned int data_len) {
+    uint16_t crc = 0xFFFF;
+
+    if (data_len == 0)
+        return 0;
+
+    for (unsigned int i = 0; i < data_len; ++i) {
+        uint16_t dbyte = data[i];
+        crc ^= dbyte << 8;
+
+        for (unsigned char j = 0; j < 8; ++j) {
+            uint16_t mix = crc & 0x8000;
+            crc = (crc << 1);
+            if (mix)
+                crc = crc ^ 0x1021;
+        }
+    }
+
+    return crc;
+}
+
+uint32_t seed = 1;
+
+// deterministic pseudo random bytes, the same vectors on every run
+uint8_t nextRandom()
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+double seconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_check_value()
+{
+  // CRC-16/CCITT-FALSE check value
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, L2MCrc16::compute((const uint8_t*)"123456789", 9));
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16_ccitt((char*)"123456789", 9));
+}
+
+void test_golden_vectors()
+{
+  struct Vector {
+    const char* data;
+    size_t length;
+    uint16_t crc;
+  };
+  // CRC-16/CCITT-FALSE of each vector. The reference sign extends bytes above 0x7F, which
+  // only sets bits that are shifted out: high bytes must give the standard CRC too
+  const Vector vectors[] = {
+    { "\x00", 1, 0xE1F0 },
+    { "\xFF", 1, 0xFF00 },
+    { "\x80", 1, 0x7078 },
+    { "A", 1, 0xB915 },
+    { "\x80\x81\xFE\xFF", 4, 0x7BAC },
+    { "{\"node\":\"NODE_01\",\"pulse_counter\":12,\"heading\":\"NE\",\"mail\":false}", 65, 0xF391 },
+  };
+
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+    TEST_ASSERT_EQUAL_HEX16(vectors[i].crc, crc16_ccitt((char*)vectors[i].data, vectors[i].length));
+    TEST_ASSERT_EQUAL_HEX16(vectors[i].crc, L2MCrc16::compute((const uint8_t*)vectors[i].data, vectors[i].length));
+  }
+}
+
+void test_random_frames_match_reference()
+{
+  uint8_t frame[255];
+
+  for (int n = 0; n < RANDOM_FRAMES; n++) {
+    size_t length = 1 + nextRandom() % sizeof(frame);
+    for (size_t i = 0; i < length; i++) {
+      frame[i] = nextRandom();
+    }
+    TEST_ASSERT_EQUAL_HEX16(crc16_ccitt((char*)frame, length), L2MCrc16::compute(frame, length));
+  }
+}
+
+void test_incremental_update()
+{
+  uint8_t frame[200];
+  for (size_t i = 0; i < sizeof(frame); i++) {
+    frame[i] = nextRandom();
+  }
+  uint16_t expected = L2MCrc16::compute(frame, sizeof(frame));
+
+  // any split, as the frame writer feeds the CRC chunk by chunk
+  for (size_t chunk = 1; chunk <= 33; chunk++) {
+    L2MCrc16 crc;
+    for (size_t i = 0; i < sizeof(frame); i += chunk) {
+      size_t length = (sizeof(frame) - i < chunk) ? sizeof(frame) - i : chunk;
+      if (length == 1) {
+        crc.update(frame[i]);
+      } else {
+        crc.update(frame + i, length);
+      }
+    }
+    TEST_ASSERT_EQUAL_HEX16(expected, crc.value());
+  }
+
+  L2MCrc16 crc;
+  crc.update(frame, 10);
+  crc.begin();
+  crc.update(frame, sizeof(frame));
+  TEST_ASSERT_EQUAL_HEX16(expected, crc.value());
+}
+
+void test_check_frame()
+{
+  uint8_t frame[32 + 2];
+  for (size_t i = 0; i < 32; i++) {
+    frame[i] = nextRandom();
+  }
+  uint16_t crc = L2MCrc16::compute(frame, 32);
+  // least significant byte first, as sendToLora2MQTTGateway() always wrote it
+  frame[32] = crc & 0xFF;
+  frame[33] = crc >> 8;
+
+  TEST_ASSERT_TRUE(L2MCrc16::check(frame, sizeof(frame)));
+  frame[5] ^= 0x10;
+  TEST_ASSERT_FALSE(L2MCrc16::check(frame, sizeof(frame)));
+  TEST_ASSERT_FALSE(L2MCrc16::check(frame, 1));
+}
+
+void benchmark_throughput()
+{
+  static uint8_t data[4096];
+  char message[96];
+  volatile uint16_t sink = 0;
+
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = nextRandom();
+  }
+
+  double start = seconds();
+  for (unsigned long done = 0; done < BENCHMARK_BYTES; done += sizeof(data)) {
+    sink ^= crc16_ccitt((char*)data, sizeof(data));
+  }
+  double bitwise = seconds() - start;
+
+  start = seconds();
+  for (unsigned long done = 0; done < BENCHMARK_BYTES; done += sizeof(data)) {
+    sink ^= L2MCrc16::compute(data, sizeof(data));
+  }
+  double sliced = seconds() - start;
+
+  start = seconds();
+  for (unsigned long done = 0; done < BENCHMARK_BYTES; done += sizeof(data)) {
+    L2MCrc16 crc;
+    for (size_t i = 0; i < sizeof(data); i++) {
+      crc.update(data[i]);
+    }
+    sink ^= crc.value();
+  }
+  double bytewise = seconds() - start;
+
+  snprintf(message, sizeof(message), "host MB/s: bit-serial %.0f, table %.0f, slice-by-4 %.0f",
+           BENCHMARK_BYTES / bitwise / 1e6, BENCHMARK_BYTES / bytewise / 1e6, BENCHMARK_BYTES / sliced / 1e6);
+  TEST_MESSAGE(message);
+  (void)sink;
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_check_value);
+  RUN_TEST(test_golden_vectors);
+  RUN_TEST(test_random_frames_match_reference);
+  RUN_TEST(test_incremental_update);
+  RUN_TEST(test_check_frame);
+  RUN_TEST(benchmark_throughput);
+  return UNITY_END();
+}
@@ -0,0 +1,224 @@
+#include <Arduino.h>
+#include <LoRa.h>
+#include <SX1276Sim.h>
+#include <L2MFragment.h>
+#include <L2MFrame.h>
+#include <LoRaRxWindows.h>
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+// the fragmentation and confirmed uplink settings of src/main.cpp
+#define LORA_MAX_RETRIES 3
+#define LORA_BACKOFF_BASE 2000
+#define FRAME_OVERHEAD (L2M_FRAME_HEADER_SIZE + 2)
+#define MESSAGE_LENGTH 1000
+#define TRANSFERS 200
+
+SX1276Sim sim;
+
+/**
+* Frame loss model, same for both directions. Gilbert-Elliott: a good and a bad state
+* with a loss rate each, and the probabilities to move from one state to the other after
+* each frame. A uniform loss rate is the special case of a single state.
+*/
+struct LossModel {
+  const char* name;
+  float goodLoss;
+  float badLoss;
+  float goodToBad;
+  float badToGood;
+};
+
+const LossModel lossless = { "lossless", 0.0f, 0.0f, 0.0f, 1.0f };
+const LossModel uniform10 = { "uniform 10%", 0.1f, 0.1f, 0.0f, 1.0f };
+const LossModel uniform20 = { "uniform 20%", 0.2f, 0.2f, 0.0f, 1.0f };
+const LossModel uniform30 = { "uniform 30%", 0.3f, 0.3f, 0.0f, 1.0f };
+// 20% loss on average, in bursts of 4 frames
+const LossModel bursty20 = { "bursty 20%", 0.05f, 0.8f, 0.0625f, 0.25f };
+
+class Channel {
+public:
+  Channel(const LossModel& model, uint32_t seed) : _model(model), _bad(false), _state(seed) {}
+
+  bool lost()
+  {
+    bool lost = uniform() < (_bad ? _model.badLoss : _model.goodLoss);
+    _bad = _bad ? (uniform() >= _model.badToGood) : (uniform() < _model.goodToBad);
+    return lost;
+  }
+
+  uint8_t jitter()
+  {
+    return (uint8_t)(next() >> 24);
+  }
+
+private:
+  uint32_t next()
+  {
+    _state = _state * 1664525UL + 1013904223UL;
+    return _state;
+  }
+
+  float uniform()
+  {
+    return (next() >> 8) / 16777216.0f;
+  }
+
+  const LossModel& _model;
+  bool _bad;
+  uint32_t _state;
+};
+
+struct TransferStats {
+  uint32_t delivered;
+  uint32_t failed;
+  uint32_t fragmentsSent;   // first transmissions and repeats
+  uint32_t rounds;
+  uint64_t time;            // us, from the first fragment to the last ACK, messages given up included
+};
+
+void setUp()
+{
+  sim = SX1276Sim();
+  LoRa.setTransport(sim);
+  TEST_ASSERT_EQUAL(1, LoRa.begin(866E6));
+  LoRa.setSpreadingFactor(7);
+  LoRa.setSignalBandwidth(125E3);
+  LoRa.setCodingRate4(5);
+  LoRa.enableCrc();
+}
+
+void tearDown()
+{
+  LoRa.end();
+}
+
+/**
+* Send one message as the node does: fragments of a round back to back, the last one
+* requests the ACK and is retried like a confirmed uplink (ACK in RX1, otherwise the end
+* of RX2 and an exponential backoff with jitter), until LORA_MAX_RETRIES repeats
+* Counted as delivered once the gateway holds the whole message, intact
+*/
+void transfer(const uint8_t* message, size_t fragmentSize, Channel& channel, uint8_t messageId, TransferStats& stats)
+{
+  static L2MFragmenter fragmenter;
+  static L2MReassembler reassembler;
+  uint8_t fragment[L2M_FRAGMENT_HEADER_SIZE + 255];
+  uint8_t ack[L2M_FRAGMENT_ACK_SIZE];
+  uint32_t ackAirtime = LoRa.timeOnAir(L2M_FRAGMENT_ACK_SIZE + FRAME_OVERHEAD);
+
+  memcpy(fragmenter.buffer(), message, MESSAGE_LENGTH);
+  TEST_ASSERT_TRUE(fragmenter.begin(messageId, MESSAGE_LENGTH, fragmentSize));
+
+  while (fragmenter.active()) {
+    int index = fragmenter.nextFragment();
+    TEST_ASSERT_GREATER_OR_EQUAL(0, index);
+    bool ackRequest = fragmenter.isLastOfRound(index);
+    size_t length = fragmenter.encode(index, ackRequest, fragment, sizeof(fragment));
+    uint32_t airtime = LoRa.timeOnAir(length + FRAME_OVERHEAD);
+    fragmenter.sent(index);
+
+    for (int retries = 0; ; retries++) {
+      stats.time += airtime;
+      bool received = !channel.lost();
+      if (received) {
+        reassembler.add(fragment, length);
+      }
+      if (!ackRequest) {
+        break;
+      }
+      if (received && !channel.lost()) {
+        // the gateway answers in RX1
+        reassembler.encodeAck(ack, sizeof(ack));
+        TEST_ASSERT_TRUE(fragmenter.acknowledge(ack, sizeof(ack)));
+        stats.time += LORA_RX1_DELAY * 1000UL + ackAirtime;
+        break;
+      }
+      if (retries == LORA_MAX_RETRIES) {
+        fragmenter.abort();
+        stats.failed++;
+        return;
+      }
+      // nothing by the end of RX2, then the backoff
+      unsigned long backoff = (unsigned long)LORA_BACKOFF_BASE << retries;
+      backoff += backoff * channel.jitter() / 256;
+      stats.time += (LORA_RX2_DELAY + backoff) * 1000UL;
+      stats.fragmentsSent++;
+    }
+    stats.fragmentsSent++;
+  }
+  stats.rounds += fragmenter.rounds();
+
+  TEST_ASSERT_TRUE(reassembler.complete());
+  TEST_ASSERT_EQUAL(MESSAGE_LENGTH, reassembler.length());
+  TEST_ASSERT_EQUAL_MEMORY(message, reassembler.data(), MESSAGE_LENGTH);
+  stats.delivered++;
+}
+
+/**
+* Goodput of TRANSFERS messages of MESSAGE_LENGTH bytes, kbit/s of message data
+*/
+float goodput(size_t fragmentSize, const LossModel& model, TransferStats& stats)
+{
+  uint8_t message[MESSAGE_LENGTH];
+  Channel channel(model, 12345);
+  memset(&stats, 0, sizeof(stats));
+
+  for (int i = 0; i < TRANSFERS; i++) {
+    for (size_t j = 0; j < sizeof(message); j++) {
+      message[j] = (uint8_t)(i * 31 + j * 7);
+    }
+    transfer(message, fragmentSize, channel, (uint8_t)(i + 1), stats);
+  }
+  return stats.time ? (float)stats.delivered * MESSAGE_LENGTH * 8 * 1000 / stats.time : 0;
+}
+
+void test_lossless_transfer_time()
+{
+  // one round: the fragments back to back, then the ACK in RX1
+  TransferStats stats;
+  float kbps = goodput(240, lossless, stats);
+  TEST_ASSERT_EQUAL_UINT32(TRANSFERS, stats.delivered);
+  TEST_ASSERT_EQUAL_UINT32(TRANSFERS * 5, stats.fragmentsSent);
+  TEST_ASSERT_EQUAL_UINT32(TRANSFERS, stats.rounds);
+  uint64_t expected = 4 * LoRa.timeOnAir(L2M_FRAGMENT_HEADER_SIZE + 240 + FRAME_OVERHEAD)
+                    + LoRa.timeOnAir(L2M_FRAGMENT_HEADER_SIZE + 40 + FRAME_OVERHEAD)
+                    + LORA_RX1_DELAY * 1000UL + LoRa.timeOnAir(L2M_FRAGMENT_ACK_SIZE + FRAME_OVERHEAD);
+  TEST_ASSERT_EQUAL_UINT32(expected * TRANSFERS, stats.time);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, (float)MESSAGE_LENGTH * 8 * 1000 / expected, kbps);
+}
+
+void test_goodput_under_loss()
+{
+  const LossModel* models[] = { &lossless, &uniform10, &uniform20, &uniform30, &bursty20 };
+  const size_t fragmentSizes[] = { 240, 100, 50 };
+  char message[160];
+
+  for (size_t f = 0; f < sizeof(fragmentSizes) / sizeof(fragmentSizes[0]); f++) {
+    float previous = 1e9f;
+    for (size_t m = 0; m < sizeof(models) / sizeof(models[0]); m++) {
+      TransferStats stats;
+      float kbps = goodput(fragmentSizes[f], *models[m], stats);
+      snprintf(message, sizeof(message), "SF7, %3u B fragments, %-12s %.2f kbit/s, %.1f fragments and %.2f rounds per message, %u/%u failed",
+               (unsigned)fragmentSizes[f], models[m]->name, kbps,
+               (float)stats.fragmentsSent / TRANSFERS, (float)stats.rounds / (stats.delivered ? stats.delivered : 1),
+               (unsigned)stats.failed, TRANSFERS);
+      TEST_MESSAGE(message);
+      // messages are delivered intact or given up, the goodput decreases with the uniform loss rate
+      TEST_ASSERT_EQUAL_UINT32(TRANSFERS, stats.delivered + stats.failed);
+      if (models[m] != &bursty20) {
+        TEST_ASSERT_LESS_THAN(previous, kbps);
+        previous = kbps;
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_lossless_transfer_time);
+  RUN_TEST(test_goodput_under_loss);
+  return UNITY_END();
+}
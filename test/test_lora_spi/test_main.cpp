@@ -0,0 +1,161 @@
+#include <Arduino.h>
+#include <LoRa.h>
+#include <SX1276Sim.h>
+#include <unity.h>
+#include <stdio.h>
+
+// a typical JSON uplink frame: ~120 bytes of payload and the 2 CRC bytes
+#define FRAME_PAYLOAD 120
+#define FRAME_CRC 2
+#define BENCHMARK_PACKETS 10000
+
+SX1276Sim sim;
+uint8_t payload[FRAME_PAYLOAD];
+
+void setUp()
+{
+  sim = SX1276Sim();
+  LoRa.setTransport(sim);
+  TEST_ASSERT_EQUAL(1, LoRa.begin(866E6));
+  LoRa.setSpreadingFactor(7);
+  LoRa.setSignalBandwidth(125E3);
+  LoRa.enableCrc();
+
+  for (size_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = 'a' + i % 26;
+  }
+}
+
+void tearDown()
+{
+  LoRa.end();
+}
+
+/**
+* Send one frame the way the node does: payload, then the CRC trailer.
+* @param perByte write the frame one byte at a time instead of in bursts
+* @return the SPI transactions the packet cost
+*/
+uint32_t sendFrame(bool perByte)
+{
+  const uint8_t crc[FRAME_CRC] = { 0x34, 0x12 };
+
+  LoRa.resetSpiTransactionCount();
+  LoRa.beginPacket();
+  if (perByte) {
+    for (size_t i = 0; i < sizeof(payload); i++) {
+      LoRa.write(payload[i]);
+    }
+    LoRa.write(crc[0]);
+    LoRa.write(crc[1]);
+  } else {
+    LoRa.write(payload, sizeof(payload));
+    LoRa.write(crc, sizeof(crc));
+  }
+  LoRa.endPacket(true);
+  uint32_t transactions = LoRa.spiTransactionCount();
+
+  // let the packet go out, the TxDone wait is not part of the cost
+  sim.advance(sim.lastTimeOnAir() + 1000);
+  return transactions;
+}
+
+void test_burst_write_is_one_transaction()
+{
+  LoRa.beginPacket();
+  LoRa.resetSpiTransactionCount();
+  TEST_ASSERT_EQUAL(FRAME_PAYLOAD, LoRa.write(payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL_UINT32(1, LoRa.spiTransactionCount());
+}
+
+void test_payload_length_written_once()
+{
+  sendFrame(false);
+
+  // the shadowed payload length reaches the radio, and the FIFO holds the frame
+  TEST_ASSERT_EQUAL_UINT8(FRAME_PAYLOAD + FRAME_CRC, sim.registerValue(0x22));
+  TEST_ASSERT_EQUAL_UINT8(FRAME_PAYLOAD + FRAME_CRC, sim.txPayloadLength());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(payload, sim.txPayload(), FRAME_PAYLOAD);
+  TEST_ASSERT_EQUAL_UINT8(0x34, sim.txPayload()[FRAME_PAYLOAD]);
+  TEST_ASSERT_EQUAL_UINT8(0x12, sim.txPayload()[FRAME_PAYLOAD + 1]);
+}
+
+void test_write_past_packet_length_fails()
+{
+  uint8_t big[LORA_MAX_PACKET_LENGTH + 10];
+  memset(big, 0x55, sizeof(big));
+
+  // a write that does not fit is refused whole, and the packet is never sent short
+  LoRa.beginPacket();
+  TEST_ASSERT_EQUAL(0, LoRa.write(big, sizeof(big)));
+  TEST_ASSERT_NOT_EQUAL(0, LoRa.getWriteError());
+  TEST_ASSERT_EQUAL(0, LoRa.endPacket());
+
+  LoRa.beginPacket();
+  TEST_ASSERT_EQUAL(LORA_MAX_PACKET_LENGTH, LoRa.write(big, LORA_MAX_PACKET_LENGTH));
+  TEST_ASSERT_EQUAL(0, LoRa.getWriteError());
+  TEST_ASSERT_EQUAL(0, LoRa.write(big, 1));
+  TEST_ASSERT_NOT_EQUAL(0, LoRa.getWriteError());
+  TEST_ASSERT_EQUAL(0, LoRa.endPacket());
+  TEST_ASSERT_EQUAL_UINT32(0, sim.txPacketCount());
+
+  // the next packet starts clean
+  LoRa.beginPacket();
+  TEST_ASSERT_EQUAL(0, LoRa.getWriteError());
+  TEST_ASSERT_EQUAL(FRAME_PAYLOAD, LoRa.write(payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL(1, LoRa.endPacket());
+  TEST_ASSERT_EQUAL_UINT32(1, sim.txPacketCount());
+}
+
+void test_transactions_per_packet()
+{
+  // the first packet after begin() also leaves the sleep mode and sets the
+  // header mode: compare packets sent in the steady state
+  sendFrame(false);
+
+  uint32_t burst = sendFrame(false);
+  uint32_t perByte = sendFrame(true);
+  char message[96];
+
+  snprintf(message, sizeof(message), "%u B frame: %u SPI transactions in bursts, %u byte per byte",
+           FRAME_PAYLOAD + FRAME_CRC, (unsigned)burst, (unsigned)perByte);
+  TEST_MESSAGE(message);
+
+  // one transaction per write call, whatever its length: the payload
+  // no longer scales the cost of a packet
+  TEST_ASSERT_LESS_OR_EQUAL(10, burst);
+  TEST_ASSERT_EQUAL_UINT32(burst + (FRAME_PAYLOAD + FRAME_CRC) - 2, perByte);
+}
+
+void benchmark_packet_cpu_time()
+{
+  char message[96];
+  unsigned long start = micros();
+
+  for (int i = 0; i < BENCHMARK_PACKETS; i++) {
+    sendFrame(false);
+  }
+  unsigned long burst = micros() - start;
+
+  start = micros();
+  for (int i = 0; i < BENCHMARK_PACKETS; i++) {
+    sendFrame(true);
+  }
+  unsigned long perByte = micros() - start;
+
+  snprintf(message, sizeof(message), "host time per packet: %.2f us in bursts, %.2f us byte per byte",
+           (double)burst / BENCHMARK_PACKETS, (double)perByte / BENCHMARK_PACKETS);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_UINT32(2 * BENCHMARK_PACKETS, sim.txPacketCount());
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_burst_write_is_one_transaction);
+  RUN_TEST(test_payload_length_written_once);
+  RUN_TEST(test_write_past_packet_length_fails);
+  RUN_TEST(test_transactions_per_packet);
+  RUN_TEST(benchmark_packet_cpu_time);
+  return UNITY_END();
+}
@@ -0,0 +1,433 @@
+#include <Arduino.h>
+#include <LoRa.h>
+#include <SX1276Sim.h>
+#include <ArduinoJson.h>
+#include <LoRaLink.h>
+#include <L2MCodec.h>
+#include <L2MCrc16.h>
+#include <L2MFrame.h>
+#include <unity.h>
+#include <stdio.h>
+
+// the node settings of src/main.cpp
+#define NODE_ADDRESS 0x01
+#define NODE_GROUP 0xF1
+#define LORA_MSG_MAX_SIZE 255
+#define BENCHMARK_FRAMES 10000
+
+SX1276Sim sim;
+LoRaLink loraLink(LoRa, LORA_MSG_MAX_SIZE);
+int interrupts;
+int txDone;
+
+void onInterrupt()
+{
+  interrupts++;
+}
+
+void onTxDone()
+{
+  txDone++;
+}
+
+void setUp()
+{
+  sim = SX1276Sim();
+  interrupts = 0;
+  txDone = 0;
+
+  LoRa.setTransport(sim);
+  TEST_ASSERT_EQUAL(1, LoRa.begin(866E6));
+  LoRa.setSpreadingFactor(7);
+  LoRa.setSignalBandwidth(125E3);
+  LoRa.setSyncWord(0xB2);
+  LoRa.enableCrc();
+  LoRa.onInterrupt(onInterrupt);
+  loraLink.Begin(NODE_ADDRESS, NODE_GROUP);
+  LoRa.onTxDone(onTxDone);
+}
+
+void tearDown()
+{
+  LoRa.onTxDone(NULL);
+  LoRa.onInterrupt(NULL);
+  LoRa.setRxFilter(NULL, 0);
+  LoRa.disableRxQueue();
+  LoRa.end();
+}
+
+/**
+* Send a JSON uplink as sendToLora2MQTTGateway() does: payload serialized into the link
+* frame, CRC appended on the fly
+* @return the frame length, 0 if it did not fit
+*/
+size_t sendUplink(uint32_t counter)
+{
+  StaticJsonDocument<128> payload;
+  payload["tx_counter"] = counter;
+  payload["heading"] = "NE";
+  payload["mail"] = false;
+
+  L2MFrameHeader header = { L2M_ADDRESS_GATEWAY, NODE_ADDRESS, L2M_MSG_UPLINK | L2M_CODEC_JSON, (uint8_t)counter };
+  serializeJson(payload, loraLink.BeginFrame(header));
+  size_t length = loraLink.EndFrame();
+  if ((length > 0) && !loraLink.Send()) {
+    return 0;
+  }
+  return length;
+}
+
+/**
+* Build a gateway frame: header, payload, CRC16 least significant byte first
+* @return the frame length
+*/
+size_t buildFrame(uint8_t destination, uint8_t type, const char* json, uint8_t* frame)
+{
+  L2MFrameHeader header = { destination, L2M_ADDRESS_GATEWAY, type, 7 };
+  size_t length = L2MEncodeHeader(header, frame, L2M_FRAME_HEADER_SIZE);
+  memcpy(frame + length, json, strlen(json));
+  length += strlen(json);
+  uint16_t crc = L2MCrc16::compute(frame, length);
+  frame[length++] = crc & 0xff;
+  frame[length++] = crc >> 8;
+  return length;
+}
+
+/**
+* Build a JSON downlink
+* @return the frame length
+*/
+size_t buildDownlink(uint8_t destination, const char* json, uint8_t* frame)
+{
+  return buildFrame(destination, L2M_MSG_DOWNLINK | L2M_CODEC_JSON, json, frame);
+}
+
+void test_uplink_frame_on_air()
+{
+  size_t length = sendUplink(42);
+  TEST_ASSERT_EQUAL_UINT32(0, LoRa.getWriteError());
+
+  TEST_ASSERT_GREATER_THAN(L2M_FRAME_HEADER_SIZE + 2, length);
+  TEST_ASSERT_EQUAL(length, sim.txPayloadLength());
+  TEST_ASSERT_TRUE(L2MCrc16::check(sim.txPayload(), length));
+
+  L2MFrameHeader header;
+  TEST_ASSERT_TRUE(L2MDecodeHeader(sim.txPayload(), length, header));
+  TEST_ASSERT_EQUAL_HEX8(L2M_ADDRESS_GATEWAY, header.destination);
+  TEST_ASSERT_EQUAL_HEX8(NODE_ADDRESS, header.source);
+  TEST_ASSERT_EQUAL_HEX8(L2M_MSG_UPLINK | L2M_CODEC_JSON, header.type);
+
+  StaticJsonDocument<128> payload;
+  TEST_ASSERT_FALSE(deserializeJson(payload, (const char*)sim.txPayload() + L2M_FRAME_HEADER_SIZE,
+                                    length - L2M_FRAME_HEADER_SIZE - 2));
+  TEST_ASSERT_EQUAL(42, payload["tx_counter"].as<int>());
+  TEST_ASSERT_EQUAL_STRING("NE", payload["heading"].as<const char*>());
+}
+
+void test_tx_done_served_in_task_context()
+{
+  sendUplink(1);
+  sim.advance(sim.lastTimeOnAir() + 1000);
+
+  // the interrupt only notified, the callback waits for handleInterrupt()
+  TEST_ASSERT_EQUAL(1, interrupts);
+  TEST_ASSERT_EQUAL(0, txDone);
+
+  LoRa.handleInterrupt();
+  TEST_ASSERT_EQUAL(1, txDone);
+
+  // nothing pending any more
+  LoRa.handleInterrupt();
+  TEST_ASSERT_EQUAL(1, txDone);
+}
+
+void test_downlink_queued_with_metadata()
+{
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildDownlink(NODE_ADDRESS, "{\"calibration\":true}", frame);
+
+  LoRa.receive();
+  TEST_ASSERT_TRUE(sim.injectPacket(frame, length, -22, 100));
+  TEST_ASSERT_EQUAL(1, interrupts);
+  TEST_ASSERT_EQUAL(0, LoRa.rxQueueDepth());
+
+  LoRa.handleInterrupt();
+  TEST_ASSERT_EQUAL(1, LoRa.rxQueueDepth());
+
+  LoRaPacket* packet = LoRa.nextPacket();
+  TEST_ASSERT_NOT_NULL(packet);
+  TEST_ASSERT_EQUAL(length, packet->length);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(frame, packet->data, length);
+  TEST_ASSERT_EQUAL(100 - 164, packet->rssi);
+  TEST_ASSERT_EQUAL(-22, packet->snrQuarterDb);
+  TEST_ASSERT_TRUE(packet->snr() == -5.5);
+
+  // receiveLoraMessage(): CRC, header, zero-copy JSON behind the header
+  L2MFrameHeader header;
+  const uint8_t* data;
+  size_t dataLength;
+  TEST_ASSERT_TRUE(packet == loraLink.Receive(header, data, dataLength));
+  TEST_ASSERT_EQUAL_HEX8(NODE_ADDRESS, header.destination);
+  TEST_ASSERT_EQUAL_HEX8(L2M_MSG_DOWNLINK | L2M_CODEC_JSON, header.type);
+  TEST_ASSERT_EQUAL(length - L2M_FRAME_HEADER_SIZE - 2, dataLength);
+  StaticJsonDocument<128> payload;
+  TEST_ASSERT_FALSE(deserializeJson(payload, (char*)data, dataLength));
+  TEST_ASSERT_TRUE(payload["calibration"].as<bool>());
+
+  loraLink.Release();
+  TEST_ASSERT_NULL(LoRa.nextPacket());
+  TEST_ASSERT_NULL(loraLink.Receive(header, data, dataLength));
+}
+
+void test_crc_error_not_queued()
+{
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildDownlink(NODE_ADDRESS, "{}", frame);
+
+  LoRa.receive();
+  sim.injectPacket(frame, length, 40, 100, true);
+  LoRa.handleInterrupt();
+
+  TEST_ASSERT_EQUAL(0, LoRa.rxQueueDepth());
+  TEST_ASSERT_EQUAL_UINT32(1, LoRa.rxCrcErrorCount());
+}
+
+void test_frame_crc_error_dropped()
+{
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildDownlink(NODE_ADDRESS, "{\"sf\":9}", frame);
+  frame[length - 1] ^= 0x01;
+
+  // the radio CRC passed, the frame CRC16 did not: dropped by the link, the next frame comes out
+  uint32_t crcErrors = loraLink.GetCrcErrors();
+  LoRa.receive();
+  sim.injectPacket(frame, length);
+  LoRa.handleInterrupt();
+  length = buildDownlink(NODE_ADDRESS, "{}", frame);
+  sim.injectPacket(frame, length);
+  LoRa.handleInterrupt();
+  TEST_ASSERT_EQUAL(2, LoRa.rxQueueDepth());
+
+  L2MFrameHeader header;
+  const uint8_t* data;
+  size_t dataLength;
+  TEST_ASSERT_NOT_NULL(loraLink.Receive(header, data, dataLength));
+  TEST_ASSERT_EQUAL(2, dataLength);
+  TEST_ASSERT_EQUAL_UINT32(crcErrors + 1, loraLink.GetCrcErrors());
+  loraLink.Release();
+  TEST_ASSERT_EQUAL(0, LoRa.rxQueueDepth());
+}
+
+void test_oversized_frame_not_sent()
+{
+  char json[LORA_MSG_MAX_SIZE];
+  memset(json, 'x', sizeof(json) - 1);
+  json[sizeof(json) - 1] = '\0';
+
+  // the frame writer stops at LORA_MSG_MAX_SIZE, the partial packet is dropped and the radio sleeps
+  L2MFrameHeader header = { L2M_ADDRESS_GATEWAY, NODE_ADDRESS, L2M_MSG_UPLINK | L2M_CODEC_JSON, 1 };
+  loraLink.BeginFrame(header).print(json);
+  TEST_ASSERT_EQUAL(0, loraLink.EndFrame());
+  TEST_ASSERT_EQUAL_HEX8(0x80, sim.registerValue(0x01));
+  TEST_ASSERT_EQUAL_UINT32(0, sim.txPacketCount());
+  // nothing to send again either
+  TEST_ASSERT_FALSE(loraLink.Resend());
+  TEST_ASSERT_EQUAL_UINT32(0, sim.txPacketCount());
+}
+
+void test_resend_same_bytes()
+{
+  uint8_t first[LORA_MAX_PACKET_LENGTH];
+  size_t length = sendUplink(42);
+  TEST_ASSERT_GREATER_THAN(LORA_FRAME_WRITER_CHUNK, length);
+  sim.advance(sim.lastTimeOnAir() + 1000);
+  LoRa.handleInterrupt();
+  memcpy(first, sim.txPayload(), length);
+
+  // a retransmission is the same frame, byte for byte, nothing is encoded again
+  TEST_ASSERT_TRUE(loraLink.Resend());
+  sim.advance(sim.lastTimeOnAir() + 1000);
+  LoRa.handleInterrupt();
+  TEST_ASSERT_EQUAL_UINT32(2, sim.txPacketCount());
+  TEST_ASSERT_EQUAL(length, sim.txPayloadLength());
+  TEST_ASSERT_EQUAL_MEMORY(first, sim.txPayload(), length);
+}
+
+void test_queue_overflow()
+{
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildDownlink(NODE_ADDRESS, "{}", frame);
+
+  LoRa.receive();
+  for (int i = 0; i < LORA_RX_QUEUE_SIZE; i++) {
+    sim.injectPacket(frame, length);
+    LoRa.handleInterrupt();
+  }
+
+  // one slot is always kept free
+  TEST_ASSERT_EQUAL(LORA_RX_QUEUE_SIZE - 1, LoRa.rxQueueDepth());
+  TEST_ASSERT_EQUAL_UINT32(1, LoRa.rxOverflowCount());
+}
+
+void test_filter_runs_in_task_context()
+{
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildDownlink(0x02, "{\"calibration\":true}", frame);
+
+  LoRa.receive();
+  sim.injectPacket(frame, length);
+  TEST_ASSERT_EQUAL(1, interrupts);
+  TEST_ASSERT_EQUAL_UINT32(0, LoRa.rxFilteredCount());
+
+  LoRa.handleInterrupt();
+  TEST_ASSERT_EQUAL_UINT32(1, LoRa.rxFilteredCount());
+  TEST_ASSERT_EQUAL(0, LoRa.rxQueueDepth());
+
+  // group and broadcast downlinks go through
+  length = buildDownlink(NODE_GROUP, "{}", frame);
+  sim.injectPacket(frame, length);
+  LoRa.handleInterrupt();
+  length = buildDownlink(L2M_ADDRESS_BROADCAST, "{}", frame);
+  sim.injectPacket(frame, length);
+  LoRa.handleInterrupt();
+  TEST_ASSERT_EQUAL(2, LoRa.rxQueueDepth());
+}
+
+/**
+* Inject a frame and serve its RxDone as the radio task does
+* @return true if the RX filter queued it
+*/
+bool filterQueues(uint8_t destination, uint8_t type)
+{
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildFrame(destination, type, "{}", frame);
+  uint32_t filtered = LoRa.rxFilteredCount();
+  sim.injectPacket(frame, length);
+  LoRa.handleInterrupt();
+  bool queued = LoRa.rxQueueDepth() > 0;
+  if (queued) {
+    loraLink.Release();
+  }
+  // a frame is either queued or counted as filtered
+  return queued && (LoRa.rxFilteredCount() == filtered);
+}
+
+void test_filter_accepts_gateway_frames()
+{
+  const uint8_t kinds[] = { L2M_MSG_DOWNLINK | L2M_CODEC_JSON, L2M_MSG_ACK, L2M_MSG_FRAGMENT | L2M_CODEC_JSON, L2M_MSG_FRAGMENT_ACK };
+  const uint8_t accepted[] = { NODE_ADDRESS, NODE_GROUP, L2M_ADDRESS_BROADCAST };
+  const uint8_t rejected[] = { 0x02, 0xF2, L2M_ADDRESS_GATEWAY };
+
+  LoRa.receive();
+  for (size_t k = 0; k < sizeof(kinds); k++) {
+    for (size_t d = 0; d < sizeof(accepted); d++) {
+      TEST_ASSERT_TRUE(filterQueues(accepted[d], kinds[k]));
+    }
+    for (size_t d = 0; d < sizeof(rejected); d++) {
+      TEST_ASSERT_FALSE(filterQueues(rejected[d], kinds[k]));
+    }
+  }
+}
+
+void test_filter_drops_node_frames()
+{
+  // uplinks of the other nodes, even addressed to the node, are never queued
+  const uint8_t kinds[] = { L2M_MSG_UPLINK | L2M_CODEC_JSON, L2M_MSG_CONFIRMED | L2M_CODEC_COMPACT, L2M_MSG_LOG | L2M_CODEC_COMPACT };
+  uint32_t filtered = LoRa.rxFilteredCount();
+
+  LoRa.receive();
+  for (size_t k = 0; k < sizeof(kinds); k++) {
+    TEST_ASSERT_FALSE(filterQueues(NODE_ADDRESS, kinds[k]));
+    TEST_ASSERT_FALSE(filterQueues(L2M_ADDRESS_BROADCAST, kinds[k]));
+  }
+  TEST_ASSERT_EQUAL_UINT32(filtered + 2 * sizeof(kinds), LoRa.rxFilteredCount());
+
+  // nor is a packet too short for a frame header
+  uint8_t runt[] = { NODE_ADDRESS, L2M_ADDRESS_GATEWAY };
+  TEST_ASSERT_FALSE(loraLink.Accept(runt, sizeof(runt)));
+}
+
+void test_filter_reads_header_only()
+{
+  char json[101];
+  memset(json, ' ', 100);
+  json[0] = '{';
+  json[99] = '}';
+  json[100] = '\0';
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildDownlink(0x02, json, frame);
+
+  LoRa.receive();
+  sim.injectPacket(frame, length);
+  uint32_t foreign = sim.spiByteCount();
+  LoRa.handleInterrupt();
+  foreign = sim.spiByteCount() - foreign;
+
+  length = buildDownlink(NODE_ADDRESS, json, frame);
+  sim.injectPacket(frame, length);
+  uint32_t own = sim.spiByteCount();
+  LoRa.handleInterrupt();
+  own = sim.spiByteCount() - own;
+
+  char message[96];
+  snprintf(message, sizeof(message), "SPI bytes for a %u B downlink: %u for another node, %u for the node",
+           (unsigned)length, (unsigned)foreign, (unsigned)own);
+  TEST_MESSAGE(message);
+  // the foreign payload is never read from the FIFO
+  TEST_ASSERT_LESS_THAN(20, foreign);
+  TEST_ASSERT_GREATER_THAN(length, own);
+}
+
+void benchmark_send_receive()
+{
+  uint8_t frame[LORA_MAX_PACKET_LENGTH];
+  size_t length = buildDownlink(NODE_ADDRESS, "{\"tx_interval\":20000,\"sf\":8}", frame);
+  char message[96];
+
+  unsigned long start = micros();
+  for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+    sendUplink(i);
+    sim.advance(sim.lastTimeOnAir() + 1000);
+    LoRa.handleInterrupt();
+  }
+  unsigned long send = micros() - start;
+  TEST_ASSERT_EQUAL(BENCHMARK_FRAMES, txDone);
+
+  LoRa.receive();
+  start = micros();
+  for (int i = 0; i < BENCHMARK_FRAMES; i++) {
+    sim.injectPacket(frame, length);
+    LoRa.handleInterrupt();
+    L2MFrameHeader header;
+    const uint8_t* data;
+    size_t dataLength;
+    TEST_ASSERT_NOT_NULL(loraLink.Receive(header, data, dataLength));
+    StaticJsonDocument<128> payload;
+    deserializeJson(payload, (char*)data, dataLength);
+    loraLink.Release();
+  }
+  unsigned long receive = micros() - start;
+
+  snprintf(message, sizeof(message), "host time per frame: %.2f us to send a JSON uplink, %.2f us to receive a downlink",
+           (double)send / BENCHMARK_FRAMES, (double)receive / BENCHMARK_FRAMES);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_uplink_frame_on_air);
+  RUN_TEST(test_tx_done_served_in_task_context);
+  RUN_TEST(test_downlink_queued_with_metadata);
+  RUN_TEST(test_crc_error_not_queued);
+  RUN_TEST(test_frame_crc_error_dropped);
+  RUN_TEST(test_oversized_frame_not_sent);
+  RUN_TEST(test_resend_same_bytes);
+  RUN_TEST(test_queue_overflow);
+  RUN_TEST(test_filter_runs_in_task_context);
+  RUN_TEST(test_filter_accepts_gateway_frames);
+  RUN_TEST(test_filter_drops_node_frames);
+  RUN_TEST(test_filter_reads_header_only);
+  RUN_TEST(benchmark_send_receive);
+  return UNITY_END();
+}
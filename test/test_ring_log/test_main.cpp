@@ -0,0 +1,308 @@
+#include <Arduino.h>
+#include <LoRa.h>
+#include <SX1276Sim.h>
+#include <L2MCodec.h>
+#include <L2MFlashSim.h>
+#include <L2MFrame.h>
+#include <L2MRingLog.h>
+#include <unity.h>
+#include <stdio.h>
+
+// the store-and-forward settings of src/main.cpp: 8 sectors of 4 KB, 16 records per replay frame
+#define LORA_LOG_SECTORS 8
+#define LORA_LOG_BATCH 16
+#define LORA_MSG_MAX_SIZE 255
+#define NODE_ID 1
+#define FRAME_OVERHEAD (L2M_FRAME_HEADER_SIZE + 2)
+#define UPLINK_INTERVAL 10      // s, between two logged uplinks
+#define BENCHMARK_RECORDS 16000
+
+SX1276Sim sim;
+L2MFlashSim* flash;
+
+void setUp()
+{
+  flash = new L2MFlashSim(4096, LORA_LOG_SECTORS);
+}
+
+void tearDown()
+{
+  delete flash;
+}
+
+uint8_t flagsOf(uint32_t i)
+{
+  L2MUplink uplink = { NODE_ID, i, (uint8_t)(i % 8), (i % 3) == 0, (i % 5) == 0, 0 };
+  return L2MEncodeFlags(uplink);
+}
+
+/**
+* Replay the log as the node does: batches of up to LORA_LOG_BATCH records, each
+* acknowledged once decoded, as the gateway ACK would
+* @param  now      seconds since boot
+* @param  replayed number of records replayed
+* @param  frames   number of frames sent
+* @param  onAir    bytes on air, frame header and CRC included
+* @param  airtime  if not NULL, time on air of the frames with the current modem settings, us
+*/
+void replay(L2MRingLog& log, uint32_t now, size_t& replayed, size_t& frames, size_t& onAir, uint32_t* airtime = NULL)
+{
+  L2MLogRecord records[LORA_LOG_BATCH];
+  uint8_t batch[LORA_MSG_MAX_SIZE - FRAME_OVERHEAD];
+  replayed = 0;
+  frames = 0;
+  onAir = 0;
+
+  while (log.pending() > 0) {
+    size_t count = log.peek(records, LORA_LOG_BATCH);
+    size_t encoded;
+    size_t length = L2MEncodeLogBatch(records, count, log.boot(), now, batch, sizeof(batch), encoded);
+    TEST_ASSERT_GREATER_THAN(0, encoded);
+
+    // the gateway side
+    size_t offset = 1;
+    for (size_t i = 0; i < encoded; i++) {
+      L2MUplink uplink;
+      uint32_t age;
+      size_t n = L2MDecodeLogRecord(batch + offset, length - offset, uplink, age);
+      TEST_ASSERT_GREATER_THAN(0, n);
+      TEST_ASSERT_EQUAL_UINT32(records[i].counter, uplink.counter);
+      // the log does not store the closes, they are marked absent
+      TEST_ASSERT_EQUAL_UINT32(L2M_CLOSES_UNKNOWN, uplink.closes);
+      if (records[i].boot == log.boot()) {
+        TEST_ASSERT_EQUAL_UINT32(now - records[i].time, age);
+      } else {
+        TEST_ASSERT_EQUAL_UINT32(L2M_LOG_AGE_UNKNOWN, age);
+      }
+      offset += n;
+    }
+    TEST_ASSERT_EQUAL(length, offset);
+
+    TEST_ASSERT_EQUAL(encoded, log.acknowledge(records[encoded - 1].sequence));
+    replayed += encoded;
+    frames++;
+    onAir += length + FRAME_OVERHEAD;
+    if (airtime) {
+      *airtime += LoRa.timeOnAir(length + FRAME_OVERHEAD);
+    }
+  }
+}
+
+void test_records_replayed_in_order()
+{
+  L2MRingLog log(*flash);
+  TEST_ASSERT_TRUE(log.begin());
+  for (uint32_t i = 0; i < 40; i++) {
+    TEST_ASSERT_TRUE(log.append(i * UPLINK_INTERVAL, 1000 + i, flagsOf(i)));
+  }
+  TEST_ASSERT_EQUAL(40, log.pending());
+
+  L2MLogRecord records[LORA_LOG_BATCH];
+  TEST_ASSERT_EQUAL(LORA_LOG_BATCH, log.peek(records, LORA_LOG_BATCH));
+  for (uint32_t i = 0; i < LORA_LOG_BATCH; i++) {
+    TEST_ASSERT_EQUAL_UINT32(i, records[i].sequence);
+    TEST_ASSERT_EQUAL_UINT32(1000 + i, records[i].counter);
+    TEST_ASSERT_EQUAL_HEX8(flagsOf(i), records[i].flags);
+  }
+
+  size_t replayed, frames, onAir;
+  replay(log, 40 * UPLINK_INTERVAL, replayed, frames, onAir);
+  TEST_ASSERT_EQUAL(40, replayed);
+  TEST_ASSERT_EQUAL(3, frames);
+  TEST_ASSERT_EQUAL(0, log.pending());
+}
+
+void test_record_closes_decoded_when_present()
+{
+  // flags with bit 6, age 3 s, counter 300, closes 12
+  const uint8_t record[] = { 0x80 | L2M_HEADING_E | L2M_LOG_FLAG_CLOSES, 0x03, 0xAC, 0x02, 0x0C };
+  L2MUplink uplink;
+  uint32_t age;
+  TEST_ASSERT_EQUAL(sizeof(record), L2MDecodeLogRecord(record, sizeof(record), uplink, age));
+  TEST_ASSERT_EQUAL_UINT32(3, age);
+  TEST_ASSERT_EQUAL_UINT32(300, uplink.counter);
+  TEST_ASSERT_EQUAL_UINT32(12, uplink.closes);
+  TEST_ASSERT_EQUAL(L2M_HEADING_E, uplink.heading);
+  // truncated before the closes
+  TEST_ASSERT_EQUAL(0, L2MDecodeLogRecord(record, sizeof(record) - 1, uplink, age));
+}
+
+void test_survives_reset()
+{
+  {
+    L2MRingLog log(*flash);
+    TEST_ASSERT_TRUE(log.begin());
+    for (uint32_t i = 0; i < 10; i++) {
+      log.append(i, 1000 + i, flagsOf(i));
+    }
+    L2MLogRecord records[4];
+    log.peek(records, 4);
+    TEST_ASSERT_EQUAL(4, log.acknowledge(records[3].sequence));
+  }
+
+  // reset: the acknowledged records stay acknowledged, the others are replayed with an unknown age
+  L2MRingLog log(*flash);
+  TEST_ASSERT_TRUE(log.begin());
+  TEST_ASSERT_EQUAL(6, log.pending());
+  TEST_ASSERT_EQUAL_UINT16(1, log.boot());
+  L2MLogRecord record;
+  TEST_ASSERT_EQUAL(1, log.peek(&record, 1));
+  TEST_ASSERT_EQUAL_UINT32(4, record.sequence);
+
+  log.append(0, 2000, 0);
+  size_t replayed, frames, onAir;
+  replay(log, 5, replayed, frames, onAir);
+  TEST_ASSERT_EQUAL(7, replayed);
+}
+
+void test_cut_write_never_seen()
+{
+  {
+    L2MRingLog log(*flash);
+    TEST_ASSERT_TRUE(log.begin());
+    log.append(0, 1000, 0);
+    log.append(1, 1001, 0);
+    // reset in the middle of the third record, before its state byte
+    flash->failProgramAfter(8);
+    TEST_ASSERT_FALSE(log.append(2, 1002, 0));
+  }
+
+  L2MRingLog log(*flash);
+  TEST_ASSERT_TRUE(log.begin());
+  TEST_ASSERT_EQUAL(2, log.pending());
+  // the half written slot is skipped
+  TEST_ASSERT_TRUE(log.append(0, 1003, 0));
+  L2MLogRecord records[3];
+  TEST_ASSERT_EQUAL(3, log.peek(records, 3));
+  TEST_ASSERT_EQUAL_UINT32(1000, records[0].counter);
+  TEST_ASSERT_EQUAL_UINT32(1001, records[1].counter);
+  TEST_ASSERT_EQUAL_UINT32(1003, records[2].counter);
+}
+
+void test_oldest_dropped_when_full()
+{
+  L2MRingLog log(*flash);
+  TEST_ASSERT_TRUE(log.begin());
+  size_t capacity = log.capacity();
+  TEST_ASSERT_EQUAL(7 * 256, capacity);
+
+  for (uint32_t i = 0; i < capacity + 300; i++) {
+    TEST_ASSERT_TRUE(log.append(i, i, 0));
+  }
+  // the ring wrapped onto the first sector, its 256 records are dropped
+  TEST_ASSERT_EQUAL_UINT32(256, log.droppedCount());
+  TEST_ASSERT_GREATER_OR_EQUAL(capacity, log.pending());
+  L2MLogRecord record;
+  log.peek(&record, 1);
+  TEST_ASSERT_EQUAL_UINT32(256, record.counter);
+}
+
+void test_write_amplification()
+{
+  L2MRingLog log(*flash);
+  TEST_ASSERT_TRUE(log.begin());
+  const uint32_t records = 4 * 8 * 256;
+
+  // the gateway is back after every uplink: append, then acknowledge in place
+  for (uint32_t i = 0; i < records; i++) {
+    TEST_ASSERT_TRUE(log.append(i, i, 0));
+    L2MLogRecord record;
+    log.peek(&record, 1);
+    log.acknowledge(record.sequence);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, log.droppedCount());
+
+  double programmed = (double)flash->bytesProgrammed() / records;
+  double erased = (double)flash->sectorsErased() / records;
+  char message[140];
+  snprintf(message, sizeof(message), "per record: %.2f bytes programmed (16 B slot), 1/%.0f sector erase, most worn sector erased %u times in %u records",
+           programmed, 1 / erased, (unsigned)flash->maxSectorErases(), (unsigned)records);
+  TEST_MESSAGE(message);
+  // slot plus state byte cleared, one erase per sector of records from the second lap on, even wear
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 17.0, programmed);
+  TEST_ASSERT_UINT32_WITHIN(1, records / 256 / 8, flash->maxSectorErases());
+  TEST_ASSERT_LESS_OR_EQUAL(records / 256, flash->sectorsErased());
+}
+
+void test_replay_bytes_on_air()
+{
+  sim = SX1276Sim();
+  LoRa.setTransport(sim);
+  TEST_ASSERT_EQUAL(1, LoRa.begin(866E6));
+  LoRa.setSignalBandwidth(125E3);
+  LoRa.setCodingRate4(5);
+  LoRa.enableCrc();
+
+  // the uplinks of a one hour outage, sent one by one with the compact codec
+  const uint32_t outage = 3600 / UPLINK_INTERVAL;
+  uint8_t compact[L2M_COMPACT_MAX_SIZE];
+  L2MUplink uplink = { NODE_ID, 1234 + outage, L2M_HEADING_NE, false, false, 0 };
+  size_t single = L2MEncodeCompact(uplink, compact, sizeof(compact)) + FRAME_OVERHEAD;
+
+  char message[140];
+  for (int sf = 7; sf <= 12; sf += 5) {
+    LoRa.setSpreadingFactor(sf);
+
+    // the same uplinks logged, one every UPLINK_INTERVAL s, then replayed
+    L2MFlashSim area(4096, LORA_LOG_SECTORS);
+    L2MRingLog log(area);
+    TEST_ASSERT_TRUE(log.begin());
+    for (uint32_t i = 0; i < outage; i++) {
+      log.append(i * UPLINK_INTERVAL, 1234 + i, flagsOf(i));
+    }
+    size_t replayed, frames, onAir;
+    uint32_t airtime = 0;
+    replay(log, outage * UPLINK_INTERVAL, replayed, frames, onAir, &airtime);
+    TEST_ASSERT_EQUAL(outage, replayed);
+
+    snprintf(message, sizeof(message), "SF%d, %u records: replay %u frames, %.2f B and %.1f ms per record; single frames %u B and %.1f ms",
+             sf, (unsigned)outage, (unsigned)frames, (double)onAir / outage, airtime / 1000.0 / outage,
+             (unsigned)single, LoRa.timeOnAir(single) / 1000.0);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN(single, onAir / outage);
+    TEST_ASSERT_LESS_THAN(LoRa.timeOnAir(single) / 2, airtime / outage);
+  }
+  LoRa.end();
+}
+
+void benchmark_replay_throughput()
+{
+  L2MFlashSim large(4096, 64);
+  L2MRingLog log(large);
+  TEST_ASSERT_TRUE(log.begin());
+
+  unsigned long start = micros();
+  for (uint32_t i = 0; i < BENCHMARK_RECORDS; i++) {
+    log.append(i, i, flagsOf(i));
+  }
+  unsigned long append = micros() - start;
+  TEST_ASSERT_EQUAL_UINT32(0, log.droppedCount());
+
+  uint32_t read = large.bytesRead();
+  size_t replayed, frames, onAir;
+  start = micros();
+  replay(log, BENCHMARK_RECORDS, replayed, frames, onAir);
+  unsigned long replay = micros() - start;
+  TEST_ASSERT_EQUAL(BENCHMARK_RECORDS, replayed);
+  read = large.bytesRead() - read;
+
+  char message[140];
+  snprintf(message, sizeof(message), "host time per record: %.2f us to append, %.2f us to replay (%.0f records/s), %.1f flash bytes read",
+           (double)append / BENCHMARK_RECORDS, (double)replay / BENCHMARK_RECORDS,
+           BENCHMARK_RECORDS * 1e6 / (replay ? replay : 1), (double)read / BENCHMARK_RECORDS);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_records_replayed_in_order);
+  RUN_TEST(test_record_closes_decoded_when_present);
+  RUN_TEST(test_survives_reset);
+  RUN_TEST(test_cut_write_never_seen);
+  RUN_TEST(test_oldest_dropped_when_full);
+  RUN_TEST(test_write_amplification);
+  RUN_TEST(test_replay_bytes_on_air);
+  RUN_TEST(benchmark_replay_throughput);
+  return UNITY_END();
+}
@@ -0,0 +1,285 @@
+#include <Arduino.h>
+#include <LoRa.h>
+#include <SX1276Sim.h>
+#include <LoRaLink.h>
+#include <LoRaRxWindows.h>
+#include <L2MFrame.h>
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NODE_ADDRESS 0x01
+#define NODE_GROUP 0xF1
+#define LORA_MSG_MAX_SIZE 255
+
+SX1276Sim sim;
+LoRaLink loraLink(LoRa, LORA_MSG_MAX_SIZE);
+LoRaRxWindows rxWindows(LoRa);
+unsigned long interruptTime;   // us, at the last DIO0 rise
+unsigned long txEndTime;       // ms, at TxDone
+bool txDone;
+int downlinks;
+
+void onInterrupt()
+{
+  interruptTime = sim.micros();
+}
+
+void onTxDone()
+{
+  txDone = true;
+}
+
+void setUp()
+{
+  sim = SX1276Sim();
+  txDone = false;
+  downlinks = 0;
+  LoRa.setTransport(sim);
+  TEST_ASSERT_EQUAL(1, LoRa.begin(866E6));
+  LoRa.setSpreadingFactor(7);
+  LoRa.setSignalBandwidth(125E3);
+  LoRa.setSyncWord(0xB2);
+  LoRa.enableCrc();
+  LoRa.onInterrupt(onInterrupt);
+  loraLink.Begin(NODE_ADDRESS, NODE_GROUP);
+  LoRa.onTxDone(onTxDone);
+  rxWindows.Configure();
+}
+
+void tearDown()
+{
+  LoRa.onTxDone(NULL);
+  LoRa.onInterrupt(NULL);
+  LoRa.setRxFilter(NULL, 0);
+  LoRa.disableRxQueue();
+  LoRa.end();
+}
+
+/**
+* The receive windows part of runRadio(): interrupts served, windows started at TxDone and
+* serviced, frames received
+*/
+void runRadio()
+{
+  LoRa.handleInterrupt();
+  if (txDone) {
+    txDone = false;
+    LoRa.sleep();
+    txEndTime = interruptTime / 1000;
+    rxWindows.Start(txEndTime);
+  }
+  rxWindows.Service(sim.millis());
+  L2MFrameHeader header;
+  const uint8_t* payload;
+  size_t length;
+  while (loraLink.Receive(header, payload, length)) {
+    downlinks++;
+    rxWindows.SetDownlinkReceived();
+    loraLink.Release();
+  }
+}
+
+/**
+* Let time go by up to the next run the windows ask for, or up to limit, and run
+* @param limit us, sim.micros() not to go past
+*/
+void runNext(unsigned long limit)
+{
+  unsigned long next = limit;
+  if (!rxWindows.IsOff()) {
+    unsigned long run = rxWindows.GetNextRun(sim.millis()) * 1000UL;
+    if ((long)(run - next) < 0) {
+      next = run;
+    }
+  }
+  if ((long)(next - sim.micros()) > 0) {
+    sim.advance(next - sim.micros());
+  }
+  runRadio();
+}
+
+/**
+* Run the radio task up to a time relative to the end of the uplink
+* @param offset us after TxDone
+*/
+void runUntil(long offset)
+{
+  unsigned long target = txEndTime * 1000UL + offset;
+  while ((long)(target - sim.micros()) > 0) {
+    runNext(target);
+  }
+}
+
+/**
+* Run the radio task until the windows of the uplink are over
+* @return ms from TxDone to the end of the windows
+*/
+unsigned long runUntilOff()
+{
+  while (!rxWindows.IsOff()) {
+    runNext(sim.micros() + 10000000UL);
+  }
+  return sim.millis() - txEndTime;
+}
+
+/**
+* Send a confirmed uplink, its TxDone starts the receive windows
+*/
+void sendUplink()
+{
+  L2MFrameHeader header = { L2M_ADDRESS_GATEWAY, NODE_ADDRESS, L2M_MSG_CONFIRMED, 7 };
+  uint8_t payload[12] = { 0 };
+  loraLink.BeginFrame(header).write(payload, sizeof(payload));
+  loraLink.EndFrame();
+  loraLink.Send();
+  sim.advance(sim.lastTimeOnAir());
+  runRadio();
+  TEST_ASSERT_EQUAL(RX1_WAIT, rxWindows.GetState());
+}
+
+/**
+* Gateway frame for the node, CRC included
+* @param  type  frame type
+* @param  frame the frame
+* @param  size  frame length
+*/
+void buildFrame(uint8_t type, uint8_t* frame, size_t size)
+{
+  L2MFrameHeader header = { NODE_ADDRESS, L2M_ADDRESS_GATEWAY, type, 7 };
+  memset(frame, 0x28, size);
+  L2MEncodeHeader(header, frame, size);
+  uint16_t crc = L2MCrc16::compute(frame, size - 2);
+  frame[size - 2] = crc & 0xff;
+  frame[size - 1] = crc >> 8;
+}
+
+/**
+* Gateway ACK whose preamble starts offset us after the nominal window time, the DIO0
+* interrupt runs the radio task
+* @return true if the radio was listening
+*/
+bool sendAck(unsigned long delay, long offset)
+{
+  uint8_t ack[L2M_FRAME_HEADER_SIZE + 3];
+  buildFrame(L2M_MSG_ACK, ack, sizeof(ack));
+
+  runUntil((long)delay * 1000L + offset);
+  bool listening = sim.injectPacket(ack, sizeof(ack));
+  runRadio();
+  return listening;
+}
+
+/**
+* Gateway downlink of LORA_DOWNLINK_MAX_SIZE bytes whose preamble starts offset us after the
+* nominal window time, on air for its whole time on air
+* @return true if the radio was listening when the preamble started
+*/
+bool sendLongDownlink(unsigned long delay, long offset)
+{
+  uint8_t downlink[LORA_DOWNLINK_MAX_SIZE];
+  buildFrame(L2M_MSG_DOWNLINK, downlink, sizeof(downlink));
+
+  runUntil((long)delay * 1000L + offset);
+  return sim.startPacket(downlink, sizeof(downlink));
+}
+
+void test_ack_on_time()
+{
+  sendUplink();
+  TEST_ASSERT_TRUE(sendAck(LORA_RX1_DELAY, 0));
+  TEST_ASSERT_EQUAL(1, downlinks);
+  // RX2 is skipped
+  runUntilOff();
+  TEST_ASSERT_FALSE(sim.isReceiving());
+  TEST_ASSERT_EQUAL_UINT32(0, sim.rxTimeoutCount());
+}
+
+void test_ack_early_by_margin()
+{
+  sendUplink();
+  // the radio sleeps until the window opens
+  TEST_ASSERT_FALSE(sendAck(LORA_RX1_DELAY, -(LORA_RX_WINDOW_MARGIN * 1000L) - 1000));
+  TEST_ASSERT_TRUE(sendAck(LORA_RX1_DELAY, -(LORA_RX_WINDOW_MARGIN * 1000L)));
+  TEST_ASSERT_EQUAL(1, downlinks);
+}
+
+void test_ack_late_at_sf7()
+{
+  // 46 symbols of 1.024 ms: the preamble is detected up to 27 ms after the nominal time
+  TEST_ASSERT_EQUAL_UINT32(46, rxWindows.GetSymbols());
+
+  sendUplink();
+  TEST_ASSERT_TRUE(sendAck(LORA_RX1_DELAY, 25000));
+  runUntilOff();
+  TEST_ASSERT_EQUAL(1, downlinks);
+
+  sendUplink();
+  TEST_ASSERT_FALSE(sendAck(LORA_RX1_DELAY, 30000));
+  TEST_ASSERT_EQUAL_UINT32(1, sim.rxTimeoutCount());
+}
+
+void test_missed_rx1_caught_in_rx2()
+{
+  sendUplink();
+  runUntil((LORA_RX2_DELAY - LORA_RX_WINDOW_MARGIN) * 1000L);
+  TEST_ASSERT_EQUAL(0, downlinks);
+  TEST_ASSERT_EQUAL_UINT32(1, sim.rxTimeoutCount());
+  TEST_ASSERT_EQUAL(RX2_OPEN, rxWindows.GetState());
+
+  TEST_ASSERT_TRUE(sendAck(LORA_RX2_DELAY, 10000));
+  TEST_ASSERT_EQUAL(1, downlinks);
+  runUntilOff();
+}
+
+void test_window_timing_per_spreading_factor()
+{
+  char message[160];
+  for (int sf = 7; sf <= 12; sf++) {
+    LoRa.setSpreadingFactor(sf);
+    rxWindows.Configure();
+    long late = (long)(rxWindows.GetSymbols() * LoRa.symbolTime()) - LORA_RX_WINDOW_MARGIN * 1000L;
+
+    // the window detects a preamble at least LORA_RX_WINDOW_MARGIN ms late, and no later
+    TEST_ASSERT_GREATER_OR_EQUAL(LORA_RX_WINDOW_MARGIN * 1000L, late);
+    downlinks = 0;
+    sendUplink();
+    TEST_ASSERT_TRUE(sendAck(LORA_RX1_DELAY, late - 100));
+    runUntilOff();
+    TEST_ASSERT_EQUAL(1, downlinks);
+    // nothing detected: RX1 is over before RX2 opens, even with a preamble and no valid header
+    sendUplink();
+    TEST_ASSERT_FALSE(sendAck(LORA_RX1_DELAY, late + 100));
+    while (rxWindows.GetState() == RX1_OPEN) {
+      runNext(sim.micros() + 10000000UL);
+    }
+    unsigned long rx1Close = sim.millis() - txEndTime;
+    TEST_ASSERT_EQUAL(RX2_WAIT, rxWindows.GetState());
+    TEST_ASSERT_LESS_THAN(LORA_RX2_DELAY - LORA_RX_WINDOW_MARGIN, rx1Close);
+    TEST_ASSERT_LESS_THAN(LORA_RX2_DELAY - LORA_RX_WINDOW_MARGIN, LORA_RX1_DELAY - LORA_RX_WINDOW_MARGIN + rxWindows.GetLength());
+    runUntilOff();
+    TEST_ASSERT_EQUAL(1, downlinks);
+
+    // a downlink of the largest size detected at the last moment: its header holds the window open
+    sendUplink();
+    TEST_ASSERT_TRUE(sendLongDownlink(LORA_RX1_DELAY, late - 100));
+    unsigned long rxWindowsLength = runUntilOff();
+    TEST_ASSERT_EQUAL(2, downlinks);
+    TEST_ASSERT_GREATER_THAN(LORA_RX1_DELAY - LORA_RX_WINDOW_MARGIN + rxWindows.GetLength(), rxWindowsLength);
+
+    snprintf(message, sizeof(message), "SF%d: %u symbols, ACK detected from %d ms early to %.1f ms late, RX1 closed at %lu ms, %lu ms after a header",
+             sf, (unsigned)rxWindows.GetSymbols(), LORA_RX_WINDOW_MARGIN, late / 1000.0, rx1Close, rxWindows.GetDownlinkTime());
+    TEST_MESSAGE(message);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ack_on_time);
+  RUN_TEST(test_ack_early_by_margin);
+  RUN_TEST(test_ack_late_at_sf7);
+  RUN_TEST(test_missed_rx1_caught_in_rx2);
+  RUN_TEST(test_window_timing_per_spreading_factor);
+  return UNITY_END();
+}